@@ -15,16 +15,85 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-
 #include "common.h"
+#include <errno.h>
+#include <poll.h>
 #include <alsa/asoundlib.h>
+#include "audio_conversion.h"
+
+/*
+ * ALSA capture
+ *
+ * The card is opened with its native rate and sample format where
+ * possible so the plug layer does not have to convert anything. The
+ * resampler in front of the MPX generator takes care of the rate.
+ *
+ * Capture is non-blocking and waits on the poll descriptors of the
+ * device. Overruns are recovered from and counted instead of being
+ * treated as fatal.
+ */
+
+// how long to wait for audio before giving up on a read (ms)
+#define CAPTURE_TIMEOUT	1000
 
 static size_t buffer_size;
 static snd_pcm_t *pcm;
 
-int8_t open_alsa_input(char *input, uint32_t sample_rate, size_t num_frames) {
+/*
+ * Capture formats in order of preference
+ *
+ * Float and 32-bit capture keep the full resolution of 24-bit sources.
+ */
+static const snd_pcm_format_t capture_formats[] = {
+	SND_PCM_FORMAT_FLOAT_LE,
+	SND_PCM_FORMAT_S32_LE,
+	SND_PCM_FORMAT_S24_LE,
+	SND_PCM_FORMAT_S24_3LE,
+	SND_PCM_FORMAT_S16_LE,
+	SND_PCM_FORMAT_UNKNOWN // terminator
+};
+
+static snd_pcm_format_t format;
+static unsigned int channels;
+static size_t frame_size;
+// conversion buffer
+static uint8_t *buf;
+
+// requested period and buffer sizes (0 leaves it to the driver)
+static snd_pcm_uframes_t req_period_size;
+static snd_pcm_uframes_t req_buffer_size;
+
+static struct pollfd *fds;
+static unsigned int nfds;
+
+static uint32_t xruns;
+
+/*
+ * Sets the period and buffer size to ask the card for (in frames)
+ */
+void set_alsa_capture_size(size_t period_size, size_t buf_size) {
+	req_period_size = period_size;
+	req_buffer_size = buf_size;
+}
+
+static size_t format_size(snd_pcm_format_t fmt) {
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE:
+		return 2;
+	case SND_PCM_FORMAT_S24_3LE:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+int8_t open_alsa_input(char *input, uint32_t *sample_rate, size_t num_frames) {
 	int err;
 	snd_pcm_hw_params_t *hw_params;
+	snd_pcm_sw_params_t *sw_params;
+	snd_pcm_uframes_t period_size, buf_size;
+	snd_pcm_uframes_t avail_min;
+	unsigned int rate;
 
 	buffer_size = num_frames;
 
@@ -34,7 +103,7 @@ int8_t open_alsa_input(char *input, uint32_t sample_rate, size_t num_frames) {
 		return -1;
 	}
 
-	err = snd_pcm_open(&pcm, input, SND_PCM_STREAM_CAPTURE, 0);
+	err = snd_pcm_open(&pcm, input, SND_PCM_STREAM_CAPTURE, SND_PCM_NONBLOCK);
 	if (err < 0) {
 		fprintf(stderr, "Error: cannot open input audio device '%s' (%s)\n", input, snd_strerror(err));
 		return -1;
@@ -52,56 +121,241 @@ int8_t open_alsa_input(char *input, uint32_t sample_rate, size_t num_frames) {
 		return -1;
 	}
 
-	err = snd_pcm_hw_params_set_format(pcm, hw_params, SND_PCM_FORMAT_S16_LE);
+	// only accept rates the hardware can do
+	snd_pcm_hw_params_set_rate_resample(pcm, hw_params, 0);
+
+	for (uint8_t i = 0; capture_formats[i] != SND_PCM_FORMAT_UNKNOWN; i++) {
+		format = capture_formats[i];
+		err = snd_pcm_hw_params_test_format(pcm, hw_params, format);
+		if (err == 0) break;
+	}
+
+	err = snd_pcm_hw_params_set_format(pcm, hw_params, format);
 	if (err < 0) {
 		fprintf(stderr, "Error: cannot set sample format (%s)\n", snd_strerror(err));
 		return -1;
 	}
 
-	err = snd_pcm_hw_params_set_rate(pcm, hw_params, sample_rate, 0);
+	// the requested rate is only a hint
+	rate = *sample_rate;
+	err = snd_pcm_hw_params_set_rate_near(pcm, hw_params, &rate, 0);
 	if (err < 0) {
 		fprintf(stderr, "Error: cannot set sample rate (%s)\n", snd_strerror(err));
 		return -1;
 	}
 
-	err = snd_pcm_hw_params_set_channels(pcm, hw_params, 2);
-	if (err < 0) {
+	channels = 2;
+	err = snd_pcm_hw_params_set_channels_near(pcm, hw_params, &channels);
+	if (err < 0 || channels > 2) {
 		fprintf(stderr, "Error: cannot set channel count (%s)\n", snd_strerror(err));
 		return -1;
 	}
 
+	period_size = req_period_size ? req_period_size : num_frames;
+	err = snd_pcm_hw_params_set_period_size_near(pcm, hw_params, &period_size, 0);
+	if (err < 0) {
+		fprintf(stderr, "Error: cannot set period size (%s)\n", snd_strerror(err));
+		return -1;
+	}
+
+	buf_size = req_buffer_size ? req_buffer_size : period_size * 4;
+	err = snd_pcm_hw_params_set_buffer_size_near(pcm, hw_params, &buf_size);
+	if (err < 0) {
+		fprintf(stderr, "Error: cannot set buffer size (%s)\n", snd_strerror(err));
+		return -1;
+	}
+
 	err = snd_pcm_hw_params(pcm, hw_params);
 	if (err < 0) {
 		fprintf(stderr, "Error: cannot set parameters (%s)\n", snd_strerror(err));
 		return -1;
 	}
 
+	snd_pcm_hw_params_get_period_size(hw_params, &period_size, 0);
+	snd_pcm_hw_params_get_buffer_size(hw_params, &buf_size);
 	snd_pcm_hw_params_free(hw_params);
 
+	// wake up once a full block is available
+	avail_min = period_size;
+	if (avail_min < num_frames) avail_min = num_frames < buf_size ? num_frames : buf_size;
+	err = snd_pcm_sw_params_malloc(&sw_params);
+	if (err < 0) {
+		fprintf(stderr, "Error: cannot allocate software parameter structure (%s)\n", snd_strerror(err));
+		return -1;
+	}
+	snd_pcm_sw_params_current(pcm, sw_params);
+	snd_pcm_sw_params_set_avail_min(pcm, sw_params, avail_min);
+	err = snd_pcm_sw_params(pcm, sw_params);
+	snd_pcm_sw_params_free(sw_params);
+	if (err < 0) {
+		fprintf(stderr, "Error: cannot set software parameters (%s)\n", snd_strerror(err));
+		return -1;
+	}
+
 	err = snd_pcm_prepare(pcm);
 	if (err < 0) {
 		fprintf(stderr, "Error: cannot prepare audio interface for use (%s)\n", snd_strerror(err));
 		return -1;
 	}
 
+	nfds = snd_pcm_poll_descriptors_count(pcm);
+	fds = malloc(nfds * sizeof(struct pollfd));
+	snd_pcm_poll_descriptors(pcm, fds, nfds);
+
+	fprintf(stderr, "Capturing at %u Hz, %u channel(s) in %s format, "
+		"period %lu, buffer %lu frames.\n",
+		rate, channels, snd_pcm_format_name(format),
+		(unsigned long)period_size, (unsigned long)buf_size);
+
+	frame_size = channels * format_size(format);
+	// stereo float capture goes straight into the audio buffer
+	if (!(format == SND_PCM_FORMAT_FLOAT_LE && channels == 2)) {
+		buf = malloc(num_frames * frame_size);
+	}
+
+	*sample_rate = rate;
+	xruns = 0;
+
 	return 0;
 }
 
-int16_t read_alsa_input(short *buffer) {
-	int16_t frames_read;
-	uint16_t frames;
+/*
+ * Converts captured frames to stereo floats
+ */
+static void convert_frames(uint8_t *in, float *out, size_t frames) {
+	size_t samples = frames * channels;
+	float *dest = (channels == 2) ? out : out + frames;
+
+	switch (format) {
+	case SND_PCM_FORMAT_FLOAT_LE:
+		memcpy(dest, in, samples * sizeof(float));
+		break;
+	case SND_PCM_FORMAT_S32_LE:
+		int2float((int32_t *)in, dest, samples);
+		break;
+	case SND_PCM_FORMAT_S24_LE:
+		s24le2float((int32_t *)in, dest, samples);
+		break;
+	case SND_PCM_FORMAT_S24_3LE:
+		s24_3le2float(in, dest, samples);
+		break;
+	default:
+		short2float((int16_t *)in, dest, samples);
+		break;
+	}
+
+	// mono is converted into the back half of the buffer first
+	if (channels == 1) stereoizef(dest, out, frames);
+}
+
+/*
+ * Waits until the device has audio for us
+ *
+ * Returns 0 when there is, 1 on timeout and -1 on error
+ */
+static int8_t wait_for_capture() {
+	unsigned short revents;
+	int r;
+
+	for (;;) {
+		r = poll(fds, nfds, CAPTURE_TIMEOUT);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (r == 0) return 1;
 
-	frames_read = snd_pcm_readi(pcm, buffer, buffer_size);
-	if (frames_read < 0) {
-		fprintf(stderr, "Error: read from audio device failed (%s)\n", snd_strerror(frames_read));
-		frames = -1;
-	} else {
-		frames = frames_read;
+		snd_pcm_poll_descriptors_revents(pcm, fds, nfds, &revents);
+		if (revents & POLLERR) return 0; // let readi report it
+		if (revents & POLLIN) return 0;
 	}
+}
+
+/*
+ * Reads one block of audio
+ *
+ * Returns the number of frames read. This may be less than a full
+ * block if the device stops delivering audio, so the caller gets to
+ * check whether it should stop.
+ */
+int read_alsa_input(float *buffer) {
+	snd_pcm_sframes_t frames_read;
+	size_t frames = 0;
+	uint8_t *dest;
+	int err;
+
+	while (frames < buffer_size) {
+		if (buf == NULL) {
+			dest = (uint8_t *)(buffer + frames * 2);
+		} else {
+			dest = buf + frames * frame_size;
+		}
+
+		frames_read = snd_pcm_readi(pcm, dest, buffer_size - frames);
+
+		if (frames_read == -EAGAIN) {
+			err = wait_for_capture();
+			if (err < 0) {
+				fprintf(stderr, "Error: polling the audio device failed\n");
+				return -1;
+			}
+			if (err > 0) {
+				fprintf(stderr, "Warning: no audio from the capture device\n");
+				break;
+			}
+			continue;
+		}
+
+		if (frames_read < 0) {
+			// overrun (-EPIPE) or suspend (-ESTRPIPE)
+			err = snd_pcm_recover(pcm, frames_read, 1);
+			if (err < 0) {
+				fprintf(stderr, "Error: read from audio device failed (%s)\n", snd_strerror(frames_read));
+				return -1;
+			}
+			xruns++;
+			fprintf(stderr, "Warning: capture overrun (%u so far)\n", xruns);
+			continue;
+		}
+
+		frames += frames_read;
+	}
+
+	if (buf != NULL) convert_frames(buf, buffer, frames);
 
 	return frames;
 }
 
+/*
+ * Poll descriptors of the capture device for an event loop
+ */
+int get_alsa_input_fds(struct pollfd *poll_fds, unsigned int space) {
+	if (nfds > space) return -1;
+	memcpy(poll_fds, fds, nfds * sizeof(struct pollfd));
+	return nfds;
+}
+
+/*
+ * Whether a full block can be read without waiting
+ */
+uint8_t alsa_input_ready() {
+	snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+
+	// errors (overruns) are dealt with by the next read
+	return avail < 0 || (size_t)avail >= buffer_size;
+}
+
+/*
+ * Frames captured but not read yet
+ */
+long get_alsa_input_delay() {
+	snd_pcm_sframes_t delay;
+
+	if (snd_pcm_delay(pcm, &delay) < 0) return 0;
+
+	return delay;
+}
+
 int8_t close_alsa_input() {
 	int8_t err;
 
@@ -110,5 +364,10 @@ int8_t close_alsa_input() {
 		fprintf(stderr, "Error: could not close source (%s)\n", snd_strerror(err));
 	}
 
+	if (buf != NULL) free(buf);
+	buf = NULL;
+	if (fds != NULL) free(fds);
+	fds = NULL;
+
 	return err;
 }
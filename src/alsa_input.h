@@ -16,6 +16,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-extern int8_t open_alsa_input(char *input_card, uint32_t sample_rate, size_t buf_size);
-extern int16_t read_alsa_input(short *buffer);
+#include <poll.h>
+
+extern void set_alsa_capture_size(size_t period_size, size_t buf_size);
+extern int8_t open_alsa_input(char *input_card, uint32_t *sample_rate, size_t buf_size);
+extern int read_alsa_input(float *buffer);
+extern int get_alsa_input_fds(struct pollfd *poll_fds, unsigned int space);
+extern uint8_t alsa_input_ready();
+extern long get_alsa_input_delay();
 extern int8_t close_alsa_input();
@@ -18,11 +18,29 @@
 
 #include "common.h"
 #include <alsa/asoundlib.h>
+#include "output.h"
 
 static snd_pcm_t *pcm;
+static snd_pcm_uframes_t buffer_size;
+// frames in an output block
+static snd_pcm_uframes_t block_frames;
+
+static snd_pcm_format_t get_pcm_format(uint8_t format) {
+	switch (format) {
+	case OUTPUT_FORMAT_S24:
+		return SND_PCM_FORMAT_S24_3LE;
+	case OUTPUT_FORMAT_S32:
+		return SND_PCM_FORMAT_S32_LE;
+	case OUTPUT_FORMAT_FLOAT:
+		return SND_PCM_FORMAT_FLOAT_LE;
+	default:
+		return SND_PCM_FORMAT_S16_LE;
+	}
+}
 
-int8_t open_alsa_output(char *output_device, unsigned int sample_rate, unsigned int channels) {
+int8_t open_alsa_output(char *output_device, unsigned int sample_rate, unsigned int channels, uint8_t format) {
 	int8_t err;
+	snd_pcm_uframes_t period_size;
 #if 0
 	snd_pcm_hw_params_t *hw_params;
 
@@ -86,7 +104,7 @@ int8_t open_alsa_output(char *output_device, unsigned int sample_rate, unsigned
 
 	snd_pcm_hw_params_free(hw_params);
 #else
-	err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE,
+	err = snd_pcm_set_params(pcm, get_pcm_format(format),
 		SND_PCM_ACCESS_RW_INTERLEAVED,
 		channels, sample_rate,
 		0,
@@ -95,8 +113,12 @@ int8_t open_alsa_output(char *output_device, unsigned int sample_rate, unsigned
 		fprintf(stderr, "Cannot open open output device (%s)\n", snd_strerror(err));
 		return -1;
 	}
+	fprintf(stderr, "Playing in %s format.\n", snd_pcm_format_name(get_pcm_format(format)));
 #endif
 
+	// for the latency estimate
+	if (snd_pcm_get_params(pcm, &buffer_size, &period_size) < 0) buffer_size = 0;
+
 #if 0
 	err = snd_pcm_prepare(pcm);
 	if (err < 0) {
@@ -108,7 +130,7 @@ int8_t open_alsa_output(char *output_device, unsigned int sample_rate, unsigned
 	return 0;
 }
 
-int16_t write_alsa_output(short *buffer, size_t frames) {
+int write_alsa_output(void *buffer, size_t frames) {
 	int frames_written;
 
 	frames_written = snd_pcm_writei(pcm, buffer, frames);
@@ -125,6 +147,70 @@ int16_t write_alsa_output(short *buffer, size_t frames) {
 	return frames_written;
 }
 
+/*
+ * Sets the size of the blocks that will be written. Poll wakeups are
+ * held off until a whole block (or the whole buffer if it is smaller)
+ * fits, so an event loop does not spin on a partly free buffer.
+ */
+int8_t set_alsa_output_block(size_t frames) {
+	snd_pcm_sw_params_t *sw_params;
+	int err;
+
+	block_frames = frames < buffer_size ? frames : buffer_size;
+
+	err = snd_pcm_sw_params_malloc(&sw_params);
+	if (err < 0) {
+		fprintf(stderr, "Error: cannot allocate software parameter structure (%s)\n", snd_strerror(err));
+		return -1;
+	}
+	snd_pcm_sw_params_current(pcm, sw_params);
+	snd_pcm_sw_params_set_avail_min(pcm, sw_params, block_frames);
+	err = snd_pcm_sw_params(pcm, sw_params);
+	snd_pcm_sw_params_free(sw_params);
+	if (err < 0) {
+		fprintf(stderr, "Error: cannot set software parameters (%s)\n", snd_strerror(err));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Poll descriptors of the playback device for an event loop
+ */
+int get_alsa_output_fds(struct pollfd *fds, unsigned int space) {
+	int count = snd_pcm_poll_descriptors_count(pcm);
+
+	if (count < 0 || (unsigned int)count > space) return -1;
+	return snd_pcm_poll_descriptors(pcm, fds, count);
+}
+
+/*
+ * Whether a block can be written without waiting
+ */
+uint8_t alsa_output_ready() {
+	snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+
+	// errors (underruns) are dealt with by the next write
+	return avail < 0 || (snd_pcm_uframes_t)avail >= block_frames;
+}
+
+/*
+ * Frames queued up in the sound card, including any FIFO after the
+ * buffer, until the next one written is played
+ */
+long get_alsa_output_delay() {
+	snd_pcm_sframes_t delay;
+
+	if (snd_pcm_delay(pcm, &delay) < 0) return 0;
+
+	return delay;
+}
+
+size_t get_alsa_output_buffer() {
+	return buffer_size;
+}
+
 int8_t close_alsa_output() {
 	int err;
 
@@ -16,6 +16,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-extern int open_alsa_output(char *output_card, unsigned int sample_rate, unsigned int channels);
-extern int write_alsa_output(short *buffer, size_t frames);
-extern int close_alsa_output();
+#include <poll.h>
+
+extern int8_t open_alsa_output(char *output_card, unsigned int sample_rate, unsigned int channels, uint8_t format);
+extern int write_alsa_output(void *buffer, size_t frames);
+extern int8_t set_alsa_output_block(size_t frames);
+extern int get_alsa_output_fds(struct pollfd *fds, unsigned int space);
+extern uint8_t alsa_output_ready();
+extern long get_alsa_output_delay();
+extern size_t get_alsa_output_buffer();
+extern int8_t close_alsa_output();
@@ -0,0 +1,350 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2019 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "audio_conversion.h"
+
+/*
+ * Vector versions are used for SSE2 (and AVX2 when built with -mavx2)
+ * on x86 and NEON on 64-bit ARM. Each function finishes off whatever
+ * does not fill a whole vector with the plain C loop, which is also
+ * what other targets get.
+ *
+ * Rounding is round-to-nearest-even on all paths, and overs and NaN
+ * come out the same as from the C loop (tests/conversion_test.c).
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+void float2short(float *inbuf, int16_t *outbuf, size_t inbufsize) {
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	const __m256 scale8 = _mm256_set1_ps(S16_SCALE);
+	const __m256 max8 = _mm256_set1_ps(65536.0f);
+	const __m256 min8 = _mm256_set1_ps(-65536.0f);
+	for (; i + 16 <= inbufsize; i += 16) {
+		// out of range values become 0x80000000 which packs saturates
+		// the wrong way, so clamp in float first
+		__m256 fa = _mm256_mul_ps(_mm256_loadu_ps(inbuf + i), scale8);
+		__m256 fb = _mm256_mul_ps(_mm256_loadu_ps(inbuf + i + 8), scale8);
+		// NaN to 0
+		fa = _mm256_and_ps(fa, _mm256_cmp_ps(fa, fa, _CMP_ORD_Q));
+		fb = _mm256_and_ps(fb, _mm256_cmp_ps(fb, fb, _CMP_ORD_Q));
+		__m256i a = _mm256_cvtps_epi32(_mm256_max_ps(_mm256_min_ps(fa, max8), min8));
+		__m256i b = _mm256_cvtps_epi32(_mm256_max_ps(_mm256_min_ps(fb, max8), min8));
+		// packs works within 128-bit lanes, put the halves back in order
+		__m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+		_mm256_storeu_si256((__m256i *)(outbuf + i), p);
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128 scale = _mm_set1_ps(S16_SCALE);
+	const __m128 max = _mm_set1_ps(65536.0f);
+	const __m128 min = _mm_set1_ps(-65536.0f);
+	for (; i + 8 <= inbufsize; i += 8) {
+		__m128 fa = _mm_mul_ps(_mm_loadu_ps(inbuf + i), scale);
+		__m128 fb = _mm_mul_ps(_mm_loadu_ps(inbuf + i + 4), scale);
+		fa = _mm_and_ps(fa, _mm_cmpord_ps(fa, fa));
+		fb = _mm_and_ps(fb, _mm_cmpord_ps(fb, fb));
+		__m128i a = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(fa, max), min));
+		__m128i b = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(fb, max), min));
+		_mm_storeu_si128((__m128i *)(outbuf + i), _mm_packs_epi32(a, b));
+	}
+#elif defined(USE_NEON)
+	const float32x4_t scale = vdupq_n_f32(S16_SCALE);
+	for (; i + 8 <= inbufsize; i += 8) {
+		int32x4_t a = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(inbuf + i), scale));
+		int32x4_t b = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(inbuf + i + 4), scale));
+		// vcvtnq saturates (NaN to 0), vqmovn narrows with saturation
+		vst1q_s16(outbuf + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+	}
+#endif
+
+	for (; i < inbufsize; i++) {
+		outbuf[i] = float2short_sample(inbuf[i]);
+	}
+}
+
+void float2int(float *inbuf, int32_t *outbuf, size_t inbufsize) {
+	size_t i = 0;
+
+	/*
+	 * Anything out of range converts to 0x80000000, which is right for
+	 * the negative overs. The positive ones are flipped to 0x7fffffff.
+	 */
+#if defined(__AVX2__)
+	const __m256 scale8 = _mm256_set1_ps(S32_SCALE);
+	for (; i + 8 <= inbufsize; i += 8) {
+		__m256 x = _mm256_mul_ps(_mm256_loadu_ps(inbuf + i), scale8);
+		x = _mm256_and_ps(x, _mm256_cmp_ps(x, x, _CMP_ORD_Q));
+		__m256i over = _mm256_castps_si256(_mm256_cmp_ps(x, scale8, _CMP_GE_OQ));
+		_mm256_storeu_si256((__m256i *)(outbuf + i),
+			_mm256_xor_si256(_mm256_cvtps_epi32(x), over));
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128 scale = _mm_set1_ps(S32_SCALE);
+	for (; i + 4 <= inbufsize; i += 4) {
+		__m128 x = _mm_mul_ps(_mm_loadu_ps(inbuf + i), scale);
+		x = _mm_and_ps(x, _mm_cmpord_ps(x, x));
+		__m128i over = _mm_castps_si128(_mm_cmpge_ps(x, scale));
+		_mm_storeu_si128((__m128i *)(outbuf + i),
+			_mm_xor_si128(_mm_cvtps_epi32(x), over));
+	}
+#elif defined(USE_NEON)
+	const float32x4_t scale = vdupq_n_f32(S32_SCALE);
+	for (; i + 4 <= inbufsize; i += 4) {
+		vst1q_s32(outbuf + i, vcvtnq_s32_f32(vmulq_f32(vld1q_f32(inbuf + i), scale)));
+	}
+#endif
+
+	for (; i < inbufsize; i++) {
+		outbuf[i] = float2int_sample(inbuf[i]);
+	}
+}
+
+/*
+ * Packed 24-bit, 3 bytes per sample
+ */
+void float2s24_3le(float *inbuf, uint8_t *outbuf, size_t inbufsize) {
+	int32_t chunk[64];
+	size_t n;
+
+	while (inbufsize) {
+		n = inbufsize > 64 ? 64 : inbufsize;
+
+		// left justified so the top 3 bytes are the sample
+		float2int(inbuf, chunk, n);
+		for (size_t i = 0; i < n; i++) {
+			outbuf[0] = chunk[i] >> 8;
+			outbuf[1] = chunk[i] >> 16;
+			outbuf[2] = chunk[i] >> 24;
+			outbuf += 3;
+		}
+
+		inbuf += n;
+		inbufsize -= n;
+	}
+}
+
+// converts 16 bit shorts (stored as two 8 bit ints) to floats
+void char2float(int8_t *inbuf, float *outbuf, size_t inbufsize) {
+	size_t i = 0, j = 0;
+
+	for (i = 0; i < inbufsize; i++) {
+		outbuf[i] = (int16_t)((inbuf[j+0] & 0xff) | (inbuf[j+1] & 0xff) << 8) / S16_SCALE;
+		j += 2;
+	}
+}
+
+// converts 16 bit shorts to floats
+void short2float(int16_t *inbuf, float *outbuf, size_t inbufsize) {
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128 scale = _mm_set1_ps(1.0f / S16_SCALE);
+	for (; i + 8 <= inbufsize; i += 8) {
+		__m128i x = _mm_loadu_si128((__m128i *)(inbuf + i));
+		// sign extend to 32 bits
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		_mm_storeu_ps(outbuf + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(outbuf + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+#elif defined(USE_NEON)
+	const float32x4_t scale = vdupq_n_f32(1.0f / S16_SCALE);
+	for (; i + 8 <= inbufsize; i += 8) {
+		int16x8_t x = vld1q_s16(inbuf + i);
+		vst1q_f32(outbuf + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), scale));
+		vst1q_f32(outbuf + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), scale));
+	}
+#endif
+
+	for (; i < inbufsize; i++) {
+		outbuf[i] = inbuf[i] * (1.0f / S16_SCALE);
+	}
+}
+
+// converts 32 bit ints to floats
+void int2float(int32_t *inbuf, float *outbuf, size_t inbufsize) {
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128 scale = _mm_set1_ps(1.0f / S32_SCALE);
+	for (; i + 4 <= inbufsize; i += 4) {
+		__m128i x = _mm_loadu_si128((__m128i *)(inbuf + i));
+		_mm_storeu_ps(outbuf + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+	}
+#elif defined(USE_NEON)
+	const float32x4_t scale = vdupq_n_f32(1.0f / S32_SCALE);
+	for (; i + 4 <= inbufsize; i += 4) {
+		vst1q_f32(outbuf + i, vmulq_f32(vcvtq_f32_s32(vld1q_s32(inbuf + i)), scale));
+	}
+#endif
+
+	for (; i < inbufsize; i++) {
+		outbuf[i] = inbuf[i] * (1.0f / S32_SCALE);
+	}
+}
+
+/*
+ * 24 bits in the low part of a 32 bit word (ALSA S24_LE)
+ */
+void s24le2float(int32_t *inbuf, float *outbuf, size_t inbufsize) {
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128 scale = _mm_set1_ps(1.0f / S32_SCALE);
+	for (; i + 4 <= inbufsize; i += 4) {
+		// move the sign bit up to the top
+		__m128i x = _mm_slli_epi32(_mm_loadu_si128((__m128i *)(inbuf + i)), 8);
+		_mm_storeu_ps(outbuf + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+	}
+#elif defined(USE_NEON)
+	const float32x4_t scale = vdupq_n_f32(1.0f / S32_SCALE);
+	for (; i + 4 <= inbufsize; i += 4) {
+		int32x4_t x = vshlq_n_s32(vld1q_s32(inbuf + i), 8);
+		vst1q_f32(outbuf + i, vmulq_f32(vcvtq_f32_s32(x), scale));
+	}
+#endif
+
+	for (; i < inbufsize; i++) {
+		outbuf[i] = (int32_t)((uint32_t)inbuf[i] << 8) * (1.0f / S32_SCALE);
+	}
+}
+
+/*
+ * Packed 24-bit, 3 bytes per sample
+ */
+void s24_3le2float(uint8_t *inbuf, float *outbuf, size_t inbufsize) {
+	int32_t sample;
+
+	for (size_t i = 0; i < inbufsize; i++) {
+		// shift into the top of a 32 bit int to keep the sign
+		sample = (int32_t)((uint32_t)inbuf[0] << 8 | (uint32_t)inbuf[1] << 16 | (uint32_t)inbuf[2] << 24);
+		outbuf[i] = sample * (1.0f / S32_SCALE);
+		inbuf += 3;
+	}
+}
+
+// s16le
+void stereoizes16(int16_t *inbuf, int16_t *outbuf, size_t inbufsize) {
+	size_t i = 0, j = 0;
+
+#if defined(__SSE2__)
+	for (; i + 8 <= inbufsize; i += 8) {
+		__m128i x = _mm_loadu_si128((__m128i *)(inbuf + i));
+		_mm_storeu_si128((__m128i *)(outbuf + j), _mm_unpacklo_epi16(x, x));
+		_mm_storeu_si128((__m128i *)(outbuf + j + 8), _mm_unpackhi_epi16(x, x));
+		j += 16;
+	}
+#elif defined(USE_NEON)
+	for (; i + 8 <= inbufsize; i += 8) {
+		int16x8_t x = vld1q_s16(inbuf + i);
+		vst2q_s16(outbuf + j, (int16x8x2_t){{x, x}});
+		j += 16;
+	}
+#endif
+
+	for (; i < inbufsize; i++) {
+		outbuf[j+0] = outbuf[j+1] = inbuf[i];
+		j += 2;
+	}
+}
+
+/*
+ * This may be used in place with the mono samples in the back half of
+ * the output buffer, as every block is loaded before anything that
+ * overlaps it is stored.
+ */
+void stereoizef(float *inbuf, float *outbuf, size_t inbufsize) {
+	size_t i = 0, j = 0;
+
+#if defined(__SSE2__)
+	for (; i + 4 <= inbufsize; i += 4) {
+		__m128 x = _mm_loadu_ps(inbuf + i);
+		_mm_storeu_ps(outbuf + j, _mm_unpacklo_ps(x, x));
+		_mm_storeu_ps(outbuf + j + 4, _mm_unpackhi_ps(x, x));
+		j += 8;
+	}
+#elif defined(USE_NEON)
+	for (; i + 4 <= inbufsize; i += 4) {
+		float32x4_t x = vld1q_f32(inbuf + i);
+		vst2q_f32(outbuf + j, (float32x4x2_t){{x, x}});
+		j += 8;
+	}
+#endif
+
+	for (; i < inbufsize; i++) {
+		outbuf[j+0] = outbuf[j+1] = inbuf[i];
+		j += 2;
+	}
+}
+
+void interleavef(float *left, float *right, float *outbuf, size_t frames) {
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	for (; i + 4 <= frames; i += 4) {
+		__m128 l = _mm_loadu_ps(left + i);
+		__m128 r = _mm_loadu_ps(right + i);
+		_mm_storeu_ps(outbuf + i * 2, _mm_unpacklo_ps(l, r));
+		_mm_storeu_ps(outbuf + i * 2 + 4, _mm_unpackhi_ps(l, r));
+	}
+#elif defined(USE_NEON)
+	for (; i + 4 <= frames; i += 4) {
+		vst2q_f32(outbuf + i * 2, (float32x4x2_t){{vld1q_f32(left + i), vld1q_f32(right + i)}});
+	}
+#endif
+
+	for (; i < frames; i++) {
+		outbuf[i*2+0] = left[i];
+		outbuf[i*2+1] = right[i];
+	}
+}
+
+void deinterleavef(float *inbuf, float *left, float *right, size_t frames) {
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	for (; i + 4 <= frames; i += 4) {
+		__m128 a = _mm_loadu_ps(inbuf + i * 2);
+		__m128 b = _mm_loadu_ps(inbuf + i * 2 + 4);
+		_mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+#elif defined(USE_NEON)
+	for (; i + 4 <= frames; i += 4) {
+		float32x4x2_t x = vld2q_f32(inbuf + i * 2);
+		vst1q_f32(left + i, x.val[0]);
+		vst1q_f32(right + i, x.val[1]);
+	}
+#endif
+
+	for (; i < frames; i++) {
+		left[i] = inbuf[i*2+0];
+		right[i] = inbuf[i*2+1];
+	}
+}
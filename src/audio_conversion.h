@@ -16,51 +16,64 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "common.h" // for lround
+/*
+ * Sample format conversion
+ *
+ * Float samples are in the range -1.0 to 1.0. Conversions to integer
+ * formats round to the nearest value and saturate, so overs clip
+ * instead of wrapping around. NaN becomes 0.
+ */
 
-// float to short
-static inline void float2short(float *inbuf, int16_t *outbuf, size_t inbufsize) {
-	for (size_t i = 0; i < inbufsize; i++) {
-		outbuf[i] = lround(inbuf[i] * 32767);
-	}
-}
+// scale factors
+#define S16_SCALE	32767.0f
+#define S24_SCALE	8388608.0f
+#define S32_SCALE	2147483648.0f
 
-// converts 16 bit shorts (stored as two 8 bit ints) to floats
-static inline void char2float(int8_t *inbuf, float *outbuf, size_t inbufsize) {
-	size_t i = 0, j = 0;
+// largest float below 2^31, anything above does not fit an int32_t
+#define S32_MAX_F	2147483520.0f
 
-	for (i = 0; i < inbufsize; i++) {
-		outbuf[i] = ((inbuf[j+0] & 0xff) | (inbuf[j+1] << 8)) / 32767.0;
-		j += 2;
-	}
+// single sample versions for use inside other loops
+static inline int16_t float2short_sample(float in) {
+	float x = in * S16_SCALE;
+	if (x > 32767.0f) return 32767;
+	if (x < -32768.0f) return -32768;
+	if (isnan(x)) return 0;
+	return lrintf(x);
 }
 
-// converts 16 bit shorts to floats
-static inline void short2float(int16_t *inbuf, float *outbuf, size_t inbufsize) {
-	for (size_t i = 0; i < inbufsize; i++) {
-		outbuf[i] = inbuf[i] / 32767.0;
-	}
+static inline int32_t float2s24_sample(float in) {
+	float x = in * S24_SCALE;
+	if (x > 8388607.0f) return 8388607;
+	if (x < -8388608.0f) return -8388608;
+	if (isnan(x)) return 0;
+	return lrintf(x);
 }
 
-// stereoizers
-// puts the same stuff into both channels
+static inline int32_t float2int_sample(float in) {
+	float x = in * S32_SCALE;
+	if (x > S32_MAX_F) return INT32_MAX;
+	if (x < -S32_SCALE) return INT32_MIN;
+	if (isnan(x)) return 0;
+	return lrintf(x);
+}
 
-// s16le
-static inline void stereoizes16(int16_t *inbuf, int16_t *outbuf, size_t inbufsize) {
-	size_t i = 0, j = 0;
+// float to integer
+extern void float2short(float *inbuf, int16_t *outbuf, size_t inbufsize);
+extern void float2s24_3le(float *inbuf, uint8_t *outbuf, size_t inbufsize);
+extern void float2int(float *inbuf, int32_t *outbuf, size_t inbufsize);
 
-	for (i = 0; i < inbufsize; i++) {
-		outbuf[j+0] = outbuf[j+1] = inbuf[i];
-		j += 2;
-	}
-}
+// integer to float
+extern void char2float(int8_t *inbuf, float *outbuf, size_t inbufsize);
+extern void short2float(int16_t *inbuf, float *outbuf, size_t inbufsize);
+extern void s24_3le2float(uint8_t *inbuf, float *outbuf, size_t inbufsize);
+extern void s24le2float(int32_t *inbuf, float *outbuf, size_t inbufsize);
+extern void int2float(int32_t *inbuf, float *outbuf, size_t inbufsize);
 
-// float
-static inline void stereoizef(float *inbuf, float *outbuf, size_t inbufsize) {
-	size_t i = 0, j = 0;
+// stereoizers
+// puts the same stuff into both channels
+extern void stereoizes16(int16_t *inbuf, int16_t *outbuf, size_t inbufsize);
+extern void stereoizef(float *inbuf, float *outbuf, size_t inbufsize);
 
-	for (i = 0; i < inbufsize; i++) {
-		outbuf[j+0] = outbuf[j+1] = inbuf[i];
-		j += 2;
-	}
-}
+// planar <-> interleaved stereo
+extern void interleavef(float *left, float *right, float *outbuf, size_t frames);
+extern void deinterleavef(float *inbuf, float *left, float *right, size_t frames);
@@ -0,0 +1,77 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "clock_drift.h"
+
+/*
+ * Clock drift compensation
+ *
+ * When capturing from one sound card and playing back on another, the
+ * two run on different crystals and the buffer between them slowly
+ * fills up or drains. The controller watches the fill level of that
+ * buffer and returns a correction factor for the resampling ratio.
+ *
+ * The integral term settles at the actual frequency offset between the
+ * two clocks, which is what gets reported as the drift estimate.
+ */
+
+// smoothing of the fill level (per update)
+#define FILL_SMOOTHING	0.005
+
+void init_drift_ctl(struct drift_ctl_t *ctl, double target) {
+	memset(ctl, 0, sizeof(struct drift_ctl_t));
+	ctl->target = target;
+	ctl->avg_fill = target;
+	ctl->kp = 2e-3;
+	ctl->ki = 200e-9;
+	ctl->correction = 1.0;
+}
+
+/*
+ * Feeds the current fill level of the buffer to the controller
+ *
+ * Returns the factor to multiply the nominal resampling ratio with
+ */
+double update_drift_ctl(struct drift_ctl_t *ctl, size_t fill) {
+	double error, adj;
+
+	ctl->avg_fill += (fill - ctl->avg_fill) * FILL_SMOOTHING;
+
+	// positive when the buffer is running low, so more output is needed
+	error = (ctl->target - ctl->avg_fill) / ctl->target;
+
+	ctl->integral += error * ctl->ki;
+	if (ctl->integral > MAX_DRIFT_PPM * 1e-6) ctl->integral = MAX_DRIFT_PPM * 1e-6;
+	if (ctl->integral < -MAX_DRIFT_PPM * 1e-6) ctl->integral = -MAX_DRIFT_PPM * 1e-6;
+
+	adj = ctl->integral + error * ctl->kp;
+	if (adj > MAX_DRIFT_PPM * 1e-6) adj = MAX_DRIFT_PPM * 1e-6;
+	if (adj < -MAX_DRIFT_PPM * 1e-6) adj = -MAX_DRIFT_PPM * 1e-6;
+
+	ctl->correction = 1.0 + adj;
+
+	return ctl->correction;
+}
+
+/*
+ * Estimated clock offset of the source relative to the sink
+ */
+double get_drift_ppm(struct drift_ctl_t *ctl) {
+	return -ctl->integral * 1e6;
+}
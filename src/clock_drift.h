@@ -0,0 +1,42 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// largest correction the controller will apply
+#define MAX_DRIFT_PPM	1000.0
+
+/*
+ * PI controller for clock drift compensation
+ *
+ * Keeps the fill level of a buffer between two clock domains at the
+ * target by nudging the resampling ratio.
+ */
+typedef struct drift_ctl_t {
+	// fill level to hold, in frames
+	double target;
+	// smoothed fill level
+	double avg_fill;
+	double integral;
+	double kp;
+	double ki;
+	// current ratio correction
+	double correction;
+} drift_ctl_t;
+
+extern void init_drift_ctl(struct drift_ctl_t *ctl, double target);
+extern double update_drift_ctl(struct drift_ctl_t *ctl, size_t fill);
+extern double get_drift_ppm(struct drift_ctl_t *ctl);
@@ -19,20 +19,20 @@
 #include "common.h"
 #include <fcntl.h>
 
-#include "rds.h"
 #include "fm_mpx.h"
 
-//#define CONTROL_PIPE_MESSAGES
-
-#define CTL_BUFFER_SIZE 100
+#include "control_pipe.h"
 
-static FILE *f_ctl;
+//#define CONTROL_PIPE_MESSAGES
 
 /*
  * Opens a file (pipe) to be used to control the RDS coder, in non-blocking mode.
  */
 
-int open_control_pipe(char *filename) {
+int open_control_pipe(struct control_pipe_t *ctl, char *filename, struct fm_mpx_t *mpx) {
+	ctl->f = NULL;
+	ctl->mpx = mpx;
+
 	int fd = open(filename, O_RDONLY | O_NONBLOCK);
 	if (fd == -1) return -1;
 
@@ -40,30 +40,29 @@ int open_control_pipe(char *filename) {
 	flags = fcntl(fd, F_GETFL, 0) | O_NONBLOCK;
 	if (fcntl(fd, F_SETFL, flags) == -1) return -1;
 
-	f_ctl = fdopen(fd, "r");
-	if (f_ctl == NULL) return -1;
+	ctl->f = fdopen(fd, "r");
+	if (ctl->f == NULL) return -1;
 
 	return 0;
 }
 
 
 /*
- * Polls the control file (pipe), non-blockingly, and if a command is received,
- * processes it and updates the RDS data.
+ * Processes a single command line and updates the encoder's RDS data.
+ * The buffer must be at least CTL_BUFFER_SIZE bytes long since the
+ * arguments are truncated in place.
+ *
+ * Returns 1 if the command was accepted, -1 otherwise.
  */
 
-int poll_control_pipe() {
-	static char buf[CTL_BUFFER_SIZE];
-
-	char *res = fgets(buf, CTL_BUFFER_SIZE, f_ctl);
-	if (res == NULL) return -1;
+int process_ascii_cmd(struct fm_mpx_t *mpx, char *res) {
 	if (strlen(res) > 3 && res[2] == ' ') {
 		char *arg = res+3;
 		if (arg[strlen(arg)-1] == '\n') arg[strlen(arg)-1] = 0;
 		if (res[0] == 'P' && res[1] == 'I') {
 			arg[4] = 0;
 			uint16_t pi = strtoul(arg, NULL, 16);
-			set_rds_pi(pi);
+			set_rds_pi(&mpx->rds, pi);
 #ifdef CONTROL_PIPE_MESSAGES
 			fprintf(stderr, "PI set to: \"%04X\"\n", pi);
 #endif
@@ -71,7 +70,7 @@ int poll_control_pipe() {
 		}
 		if (res[0] == 'P' && res[1] == 'S') {
 			arg[8] = 0;
-			set_rds_ps(arg);
+			set_rds_ps(&mpx->rds, arg);
 #ifdef CONTROL_PIPE_MESSAGES
 			fprintf(stderr, "PS set to: \"%s\"\n", arg);
 #endif
@@ -79,7 +78,7 @@ int poll_control_pipe() {
 		}
 		if (res[0] == 'R' && res[1] == 'T') {
 			arg[64] = 0;
-			set_rds_rt(arg);
+			set_rds_rt(&mpx->rds, arg);
 #ifdef CONTROL_PIPE_MESSAGES
 			fprintf(stderr, "RT set to: \"%s\"\n", arg);
 #endif
@@ -87,7 +86,7 @@ int poll_control_pipe() {
 		}
 		if (res[0] == 'T' && res[1] == 'A') {
 			uint8_t ta = (arg[0] == 'O' && arg[1] == 'N');
-			set_rds_ta(ta);
+			set_rds_ta(&mpx->rds, ta);
 #ifdef CONTROL_PIPE_MESSAGES
 			fprintf(stderr, "Set TA to %s\n", ta ? "ON" : "OFF");
 #endif
@@ -95,7 +94,7 @@ int poll_control_pipe() {
 		}
 		if (res[0] == 'T' && res[1] == 'P') {
 			uint8_t tp = (arg[0] == 'O' && arg[1] == 'N');
-			set_rds_tp(tp);
+			set_rds_tp(&mpx->rds, tp);
 #ifdef CONTROL_PIPE_MESSAGES
 			fprintf(stderr, "Set TP to %s\n", tp ? "ON" : "OFF");
 #endif
@@ -103,7 +102,7 @@ int poll_control_pipe() {
 		}
 		if (res[0] == 'M' && res[1] == 'S') {
 			uint8_t ms = (arg[0] == 'O' && arg[1] == 'N');
-			set_rds_ms(ms);
+			set_rds_ms(&mpx->rds, ms);
 #ifdef CONTROL_PIPE_MESSAGES
 			fprintf(stderr, "Set MS to %s\n", ms ? "ON" : "OFF");
 #endif
@@ -111,7 +110,7 @@ int poll_control_pipe() {
 		}
 		if (res[0] == 'A' && res[1] == 'B') {
 			uint8_t ab = (arg[0] == 'A');
-			set_rds_ab(ab);
+			set_rds_ab(&mpx->rds, ab);
 #ifdef CONTROL_PIPE_MESSAGES
 			fprintf(stderr, "Set AB to %s\n", ab ? "A" : "B");
 #endif
@@ -119,7 +118,7 @@ int poll_control_pipe() {
 		}
 		if (res[0] == 'D' && res[1] == 'I') {
 			uint8_t di = strtoul(arg, NULL, 10);
-			set_rds_di(di);
+			set_rds_di(&mpx->rds, di);
 #ifdef CONTROL_PIPE_MESSAGES
 			fprintf(stderr, "DI value set to %u\n", di);
 #endif
@@ -133,7 +132,7 @@ int poll_control_pipe() {
 		if (res[0] == 'P' && res[1] == 'T' && res[2] == 'Y') {
 			uint8_t pty = strtoul(arg, NULL, 10);
 			if (pty <= 31) {
-				set_rds_pty(pty);
+				set_rds_pty(&mpx->rds, pty);
 #ifdef CONTROL_PIPE_MESSAGES
 				if (!pty) {
 					fprintf(stderr, "PTY disabled\n");
@@ -144,7 +143,7 @@ int poll_control_pipe() {
 				fprintf(stderr, "Wrong PTY identifier! The PTY range is 0 - 31.\n");
 #endif
 			}
-			return 1;
+			return (pty <= 31) ? 1 : -1;
 		}
 		if (res[0] == 'R' && res[1] == 'T' && res[2] == 'P') {
 			uint8_t tags[8];
@@ -153,26 +152,45 @@ int poll_control_pipe() {
 				fprintf(stderr, "RT+ tag 1: type: %u, start: %u, length: %u\n", tags[0], tags[1], tags[2]);
 				fprintf(stderr, "RT+ tag 2: type: %u, start: %u, length: %u\n", tags[3], tags[4], tags[5]);
 #endif
-				set_rds_rtplus_tags((uint8_t *)tags);
+				set_rds_rtplus_tags(&mpx->rds, (uint8_t *)tags);
+				return 1;
 			}
 #ifdef CONTROL_PIPE_MESSAGES
-			else {
-				fprintf(stderr, "Could not parse RT+ tag info.\n");
-			}
+			fprintf(stderr, "Could not parse RT+ tag info.\n");
 #endif
-			return 1;
+			return -1;
 		}
 		if (res[0] == 'M' && res[1] == 'P' && res[2] == 'X') {
 			uint8_t gains[5];
 			if (sscanf(arg, "%hhu,%hhu,%hhu,%hhu,%hhu", &gains[0], &gains[1], &gains[2], &gains[3], &gains[4]) == 5) {
 				for (int i = 0; i < 5; i++) {
-					set_carrier_volume(i, gains[i]);
+					set_carrier_volume(mpx, i, gains[i]);
 				}
+				return 1;
 			}
-			return 1;
+			return -1;
 		}
 		if (res[0] == 'V' && res[1] == 'O' && res[2] == 'L') {
-			set_output_volume(strtoul(arg, NULL, 10));
+			set_output_volume(mpx, strtoul(arg, NULL, 10));
+			return 1;
+		}
+		if (res[0] == 'S' && res[1] == 'T' && res[2] == 'M') {
+			int8_t stereo_mode = parse_stereo_mode(arg);
+			if (stereo_mode < 0 || change_stereo_mode(mpx, stereo_mode) < 0) {
+#ifdef CONTROL_PIPE_MESSAGES
+				fprintf(stderr, "Could not change the stereo mode to %s.\n", arg);
+#endif
+				return -1;
+			}
+#ifdef CONTROL_PIPE_MESSAGES
+			fprintf(stderr, "Stereo mode set to %s\n", arg);
+#endif
+			return 1;
+		}
+		if (res[0] == 'A' && res[1] == 'S' && res[2] == 'Y') {
+			float asymmetry = strtof(arg, NULL);
+			if (asymmetry < -1.0f || asymmetry > 1.0f) return -1;
+			set_asym_dsb(mpx, asymmetry);
 			return 1;
 		}
 	}
@@ -185,14 +203,13 @@ int poll_control_pipe() {
 #ifdef CONTROL_PIPE_MESSAGES
 				fprintf(stderr, "RT+ flags: running: %u, toggle: %u\n", running, toggle);
 #endif
-				set_rds_rtplus_flags(running, toggle);
+				set_rds_rtplus_flags(&mpx->rds, running, toggle);
+				return 1;
 			}
 #ifdef CONTROL_PIPE_MESSAGES
-			else {
-				fprintf(stderr, "Could not parse RT+ flags.\n");
-			}
+			fprintf(stderr, "Could not parse RT+ flags.\n");
 #endif
-			return 1;
+			return -1;
 		}
 		if (res[0] == 'P' && res[1] == 'T' && res[2] == 'Y' && res[3] == 'N') {
 			arg[8] = 0;
@@ -201,12 +218,12 @@ int poll_control_pipe() {
 				fprintf(stderr, "PTYN disabled\n");
 #endif
 				char tmp[8] = {0};
-				set_rds_ptyn(tmp);
+				set_rds_ptyn(&mpx->rds, tmp);
 			} else {
 #ifdef CONTROL_PIPE_MESSAGES
 				fprintf(stderr, "PTYN set to: \"%s\"\n", arg);
 #endif
-				set_rds_ptyn(arg);
+				set_rds_ptyn(&mpx->rds, arg);
 			}
 			return 1;
 		}
@@ -214,10 +231,21 @@ int poll_control_pipe() {
 	return -1;
 }
 
-int close_control_pipe() {
-	if (f_ctl) {
-		return fclose(f_ctl);
-	} else {
-		return 0;
-	}
+/*
+ * Polls the control file (pipe), non-blockingly, and if a command is received,
+ * processes it and updates the RDS data.
+ */
+
+int poll_control_pipe(struct control_pipe_t *ctl) {
+	char *res = fgets(ctl->buf, CTL_BUFFER_SIZE, ctl->f);
+	if (res == NULL) return -1;
+	return process_ascii_cmd(ctl->mpx, res);
+}
+
+int close_control_pipe(struct control_pipe_t *ctl) {
+	int r = 0;
+
+	if (ctl->f) r = fclose(ctl->f);
+	ctl->f = NULL;
+	return r;
 }
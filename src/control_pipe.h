@@ -16,6 +16,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-extern int open_control_pipe(char *filename);
-extern int close_control_pipe();
-extern int poll_control_pipe();
+#define CTL_BUFFER_SIZE 100
+
+typedef struct control_pipe_t {
+	FILE *f;
+	// the encoder the commands are for
+	struct fm_mpx_t *mpx;
+	char buf[CTL_BUFFER_SIZE];
+} control_pipe_t;
+
+extern int open_control_pipe(struct control_pipe_t *ctl, char *filename, struct fm_mpx_t *mpx);
+extern int close_control_pipe(struct control_pipe_t *ctl);
+extern int poll_control_pipe(struct control_pipe_t *ctl);
+extern int process_ascii_cmd(struct fm_mpx_t *mpx, char *cmd);
@@ -0,0 +1,246 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "control_pipe.h"
+#include "control_socket.h"
+
+/*
+ * Control server on a UNIX domain (stream) socket
+ *
+ * Unlike the control pipe, any number of clients (up to MAX_CTL_CLIENTS)
+ * may be connected at the same time. A client may send several commands
+ * in one message, one per line. Every command gets a reply line, "OK" or
+ * "ERR", in the order the commands were received.
+ *
+ * All sockets are non-blocking and are only touched from the control
+ * thread so the DSP threads are never held up by a slow client.
+ */
+
+static int set_nonblocking(int fd) {
+	int flags;
+	flags = fcntl(fd, F_GETFL, 0) | O_NONBLOCK;
+	return fcntl(fd, F_SETFL, flags);
+}
+
+/*
+ * Creates the socket and starts listening on it
+ */
+int open_control_socket(struct control_socket_t *ctl, char *path, struct fm_mpx_t *mpx) {
+	struct ctl_client_t *clients = ctl->clients;
+	struct sockaddr_un addr;
+
+	ctl->listen_fd = -1;
+	ctl->mpx = mpx;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: control socket path is too long.\n");
+		return -1;
+	}
+
+	for (uint8_t i = 0; i < MAX_CTL_CLIENTS; i++) {
+		clients[i].fd = -1;
+		clients[i].len = 0;
+	}
+
+	ctl->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (ctl->listen_fd == -1) return -1;
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	// remove a stale socket from a previous run
+	unlink(path);
+
+	if (bind(ctl->listen_fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) == -1 ||
+	    listen(ctl->listen_fd, MAX_CTL_CLIENTS) == -1 ||
+	    set_nonblocking(ctl->listen_fd) == -1) {
+		close(ctl->listen_fd);
+		ctl->listen_fd = -1;
+		return -1;
+	}
+
+	strcpy(ctl->path, path);
+
+	return 0;
+}
+
+static void drop_client(struct ctl_client_t *client) {
+	close(client->fd);
+	client->fd = -1;
+	client->len = 0;
+}
+
+static void accept_clients(struct control_socket_t *ctl) {
+	struct ctl_client_t *clients = ctl->clients;
+	int fd;
+	uint8_t i;
+
+	while ((fd = accept(ctl->listen_fd, NULL, NULL)) != -1) {
+		for (i = 0; i < MAX_CTL_CLIENTS; i++) {
+			if (clients[i].fd == -1) break;
+		}
+
+		if (i == MAX_CTL_CLIENTS || set_nonblocking(fd) == -1) {
+			// no free slots
+			close(fd);
+			continue;
+		}
+
+		clients[i].fd = fd;
+		clients[i].len = 0;
+	}
+}
+
+/*
+ * Runs all complete lines in the client's buffer through the command
+ * parser and sends all of the replies back in one go
+ */
+static void process_client_cmds(struct control_socket_t *ctl, struct ctl_client_t *client) {
+	char cmd[CTL_BUFFER_SIZE];
+	// worst case is a buffer of empty lines: "ERR\n" for every byte
+	char reply[CTL_SOCK_BUFFER_SIZE * 4];
+	size_t reply_len = 0;
+	size_t start = 0;
+	size_t cmd_len;
+	char *eol;
+	ssize_t sent;
+
+	while ((eol = memchr(client->buf + start, '\n', client->len - start))) {
+		cmd_len = eol - (client->buf + start);
+
+		// commands longer than the parser buffer are rejected outright
+		if (cmd_len < CTL_BUFFER_SIZE) {
+			memset(cmd, 0, CTL_BUFFER_SIZE);
+			memcpy(cmd, client->buf + start, cmd_len);
+			if (cmd_len && cmd[cmd_len-1] == '\r') cmd[cmd_len-1] = 0;
+		} else {
+			cmd[0] = 0;
+		}
+
+		if (cmd[0] && process_ascii_cmd(ctl->mpx, cmd) > 0) {
+			memcpy(reply + reply_len, "OK\n", 3);
+			reply_len += 3;
+		} else {
+			memcpy(reply + reply_len, "ERR\n", 4);
+			reply_len += 4;
+		}
+
+		start += cmd_len + 1;
+	}
+
+	// keep any partial command for the next read
+	memmove(client->buf, client->buf + start, client->len - start);
+	client->len -= start;
+
+	if (!reply_len) return;
+
+	sent = send(client->fd, reply, reply_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (sent != (ssize_t)reply_len) {
+		// the client is not reading its replies
+		drop_client(client);
+	}
+}
+
+static void read_client(struct control_socket_t *ctl, struct ctl_client_t *client) {
+	ssize_t bytes;
+
+	for (;;) {
+		if (client->len == CTL_SOCK_BUFFER_SIZE) {
+			// a line that does not fit the buffer
+			drop_client(client);
+			return;
+		}
+
+		bytes = recv(client->fd, client->buf + client->len,
+			CTL_SOCK_BUFFER_SIZE - client->len, MSG_DONTWAIT);
+		if (bytes == 0) {
+			// client hung up
+			drop_client(client);
+			return;
+		}
+		if (bytes < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				drop_client(client);
+			return;
+		}
+
+		client->len += bytes;
+		process_client_cmds(ctl, client);
+		if (client->fd == -1) return;
+	}
+}
+
+/*
+ * Waits up to timeout ms for activity on the socket, then accepts new
+ * clients and handles any pending commands
+ */
+int poll_control_socket(struct control_socket_t *ctl, int timeout) {
+	struct ctl_client_t *clients = ctl->clients;
+	struct pollfd fds[MAX_CTL_CLIENTS + 1];
+	uint8_t slot[MAX_CTL_CLIENTS + 1];
+	nfds_t nfds = 0;
+	int r;
+
+	if (ctl->listen_fd == -1) return -1;
+
+	fds[nfds].fd = ctl->listen_fd;
+	fds[nfds].events = POLLIN;
+	nfds++;
+
+	for (uint8_t i = 0; i < MAX_CTL_CLIENTS; i++) {
+		if (clients[i].fd == -1) continue;
+		fds[nfds].fd = clients[i].fd;
+		fds[nfds].events = POLLIN;
+		slot[nfds] = i;
+		nfds++;
+	}
+
+	r = poll(fds, nfds, timeout);
+	if (r <= 0) return r;
+
+	for (nfds_t i = 1; i < nfds; i++) {
+		if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+			read_client(ctl, &clients[slot[i]]);
+		}
+	}
+
+	if (fds[0].revents & POLLIN) accept_clients(ctl);
+
+	return r;
+}
+
+int close_control_socket(struct control_socket_t *ctl) {
+	struct ctl_client_t *clients = ctl->clients;
+
+	if (ctl->listen_fd == -1) return 0;
+
+	for (uint8_t i = 0; i < MAX_CTL_CLIENTS; i++) {
+		if (clients[i].fd != -1) drop_client(&clients[i]);
+	}
+
+	close(ctl->listen_fd);
+	ctl->listen_fd = -1;
+	return unlink(ctl->path);
+}
@@ -0,0 +1,41 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/un.h>
+
+#define MAX_CTL_CLIENTS		16
+// per-client receive buffer (holds a batch of commands)
+#define CTL_SOCK_BUFFER_SIZE	4096
+
+typedef struct ctl_client_t {
+	int fd;
+	size_t len;
+	char buf[CTL_SOCK_BUFFER_SIZE];
+} ctl_client_t;
+
+typedef struct control_socket_t {
+	int listen_fd;
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	// the encoder the commands are for
+	struct fm_mpx_t *mpx;
+	struct ctl_client_t clients[MAX_CTL_CLIENTS];
+} control_socket_t;
+
+extern int open_control_socket(struct control_socket_t *ctl, char *path, struct fm_mpx_t *mpx);
+extern int poll_control_socket(struct control_socket_t *ctl, int timeout);
+extern int close_control_socket(struct control_socket_t *ctl);
@@ -0,0 +1,357 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <time.h>
+#include "dsp_kernels.h"
+
+/*
+ * Kernel registry
+ *
+ * Every instruction set has its own version of each kernel. They are
+ * all built into the same binary (with target attributes on x86, so no
+ * special compiler flags are needed) and the CPU is asked at startup
+ * which of them it can run.
+ *
+ * The vector versions keep more than one partial sum, so their results
+ * can differ from the scalar ones in the last bit.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define USE_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define USE_NEON
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#endif
+
+static float dot_scalar(const float *x, const float *h, uint16_t n) {
+	float sum = 0.0f;
+
+	for (uint16_t i = 0; i < n; i++) {
+		sum += x[i] * h[i];
+	}
+
+	return sum;
+}
+
+static int32_t dot_q15_scalar(const int16_t *x, const int16_t *h, uint16_t n) {
+	int32_t sum = 0;
+
+	for (uint16_t i = 0; i < n; i++) {
+		sum += x[i] * h[i];
+	}
+
+	return sum;
+}
+
+#ifdef USE_X86
+__attribute__((target("sse2")))
+static float dot_sse2(const float *x, const float *h, uint16_t n) {
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	uint16_t i = 0;
+	float sum;
+
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(h + i + 4)));
+	}
+	acc0 = _mm_add_ps(acc0, acc1);
+	acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+	acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+	sum = _mm_cvtss_f32(acc0);
+
+	for (; i < n; i++) {
+		sum += x[i] * h[i];
+	}
+
+	return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float *x, const float *h, uint16_t n) {
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m128 acc;
+	uint16_t i = 0;
+	float sum;
+
+	for (; i + 16 <= n; i += 16) {
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(h + i), acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(h + i + 8), acc1);
+	}
+	acc0 = _mm256_add_ps(acc0, acc1);
+	acc = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	sum = _mm_cvtss_f32(acc);
+
+	for (; i < n; i++) {
+		sum += x[i] * h[i];
+	}
+
+	return sum;
+}
+
+__attribute__((target("avx512f")))
+static float dot_avx512(const float *x, const float *h, uint16_t n) {
+	__m512 acc0 = _mm512_setzero_ps();
+	__m512 acc1 = _mm512_setzero_ps();
+	uint16_t i = 0;
+
+	for (; i + 32 <= n; i += 32) {
+		acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(h + i), acc0);
+		acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(h + i + 16), acc1);
+	}
+	if (i + 16 <= n) {
+		acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(h + i), acc0);
+		i += 16;
+	}
+	// the rest in one masked pass
+	if (i < n) {
+		__mmask16 mask = (1u << (n - i)) - 1;
+		acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, x + i),
+			_mm512_maskz_loadu_ps(mask, h + i), acc1);
+	}
+
+	return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("sse2")))
+static int32_t dot_q15_sse2(const int16_t *x, const int16_t *h, uint16_t n) {
+	__m128i acc = _mm_setzero_si128();
+	uint16_t i = 0;
+	int32_t sum;
+
+	for (; i + 8 <= n; i += 8) {
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(
+			_mm_loadu_si128((const __m128i *)(x + i)),
+			_mm_loadu_si128((const __m128i *)(h + i))));
+	}
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	sum = _mm_cvtsi128_si32(acc);
+
+	for (; i < n; i++) {
+		sum += x[i] * h[i];
+	}
+
+	return sum;
+}
+
+__attribute__((target("avx2")))
+static int32_t dot_q15_avx2(const int16_t *x, const int16_t *h, uint16_t n) {
+	__m256i acc = _mm256_setzero_si256();
+	__m128i acc128;
+	uint16_t i = 0;
+	int32_t sum;
+
+	for (; i + 16 <= n; i += 16) {
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(
+			_mm256_loadu_si256((const __m256i *)(x + i)),
+			_mm256_loadu_si256((const __m256i *)(h + i))));
+	}
+	acc128 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	acc128 = _mm_add_epi32(acc128, _mm_shuffle_epi32(acc128, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc128 = _mm_add_epi32(acc128, _mm_shuffle_epi32(acc128, _MM_SHUFFLE(2, 3, 0, 1)));
+	sum = _mm_cvtsi128_si32(acc128);
+
+	for (; i < n; i++) {
+		sum += x[i] * h[i];
+	}
+
+	return sum;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int32_t dot_q15_avx512(const int16_t *x, const int16_t *h, uint16_t n) {
+	__m512i acc = _mm512_setzero_si512();
+	uint16_t i = 0;
+
+	for (; i + 32 <= n; i += 32) {
+		acc = _mm512_add_epi32(acc, _mm512_madd_epi16(
+			_mm512_loadu_si512(x + i), _mm512_loadu_si512(h + i)));
+	}
+	// the rest in one masked pass
+	if (i < n) {
+		__mmask32 mask = (1u << (n - i)) - 1;
+		acc = _mm512_add_epi32(acc, _mm512_madd_epi16(
+			_mm512_maskz_loadu_epi16(mask, x + i),
+			_mm512_maskz_loadu_epi16(mask, h + i)));
+	}
+
+	return _mm512_reduce_add_epi32(acc);
+}
+
+static uint8_t has_sse2() {
+	return __builtin_cpu_supports("sse2") != 0;
+}
+
+static uint8_t has_avx2() {
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+static uint8_t has_avx512() {
+	return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+#endif
+
+#ifdef USE_NEON
+static float dot_neon(const float *x, const float *h, uint16_t n) {
+	float32x4_t acc0 = vdupq_n_f32(0.0f);
+	float32x4_t acc1 = vdupq_n_f32(0.0f);
+	uint16_t i = 0;
+	float sum;
+
+	for (; i + 8 <= n; i += 8) {
+		acc0 = vfmaq_f32(acc0, vld1q_f32(x + i), vld1q_f32(h + i));
+		acc1 = vfmaq_f32(acc1, vld1q_f32(x + i + 4), vld1q_f32(h + i + 4));
+	}
+	sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+
+	for (; i < n; i++) {
+		sum += x[i] * h[i];
+	}
+
+	return sum;
+}
+
+static uint8_t has_neon() {
+	return (getauxval(AT_HWCAP) & HWCAP_ASIMD) != 0;
+}
+#endif
+
+// slowest first, the last one the CPU supports is the default
+static const struct dsp_isa_t {
+	char *name;
+	uint8_t (*supported)();
+	struct dsp_kernels_t kernels;
+} isas[] = {
+	{"scalar",	NULL,		{dot_scalar, dot_q15_scalar}},
+#ifdef USE_X86
+	{"sse2",	has_sse2,	{dot_sse2, dot_q15_sse2}},
+	{"avx2",	has_avx2,	{dot_avx2, dot_q15_avx2}},
+	{"avx512",	has_avx512,	{dot_avx512, dot_q15_avx512}},
+#endif
+#ifdef USE_NEON
+	// no NEON version of the Q15 dot product has been tested yet
+	{"neon",	has_neon,	{dot_neon, dot_q15_scalar}},
+#endif
+};
+
+#define NUM_ISAS	(sizeof(isas) / sizeof(struct dsp_isa_t))
+
+// scalar until a set has been picked
+struct dsp_kernels_t dsp = {dot_scalar, dot_q15_scalar};
+static const struct dsp_isa_t *current_isa = &isas[0];
+
+static uint8_t isa_supported(const struct dsp_isa_t *isa) {
+	return isa->supported == NULL || isa->supported();
+}
+
+/*
+ * Times a Hilbert transformer sized dot product with every supported
+ * set and returns the fastest
+ */
+static const struct dsp_isa_t *bench_isas() {
+	static float x[513], h[513];
+	const struct dsp_isa_t *best = &isas[0];
+	double best_time = 0.0, t, run_time;
+	struct timespec start, end;
+	volatile float sink;
+
+	for (uint16_t i = 0; i < 513; i++) {
+		x[i] = sinf(i * 0.1f);
+		h[i] = cosf(i * 0.3f);
+	}
+
+	for (uint8_t i = 0; i < NUM_ISAS; i++) {
+		if (!isa_supported(&isas[i])) continue;
+
+		// best of a few runs so a context switch does not decide it
+		t = 0.0;
+		for (uint8_t run = 0; run < 5; run++) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (uint16_t j = 0; j < 2000; j++) {
+				sink = isas[i].kernels.dot(x, h, 513);
+			}
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			(void)sink;
+			run_time = (end.tv_sec - start.tv_sec) +
+				(end.tv_nsec - start.tv_nsec) / 1e9;
+			if (!run || run_time < t) t = run_time;
+		}
+
+		if (best_time == 0.0 || t < best_time) {
+			best = &isas[i];
+			best_time = t;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Picks the kernels to use
+ *
+ * isa is the name of an instruction set, "auto" (or NULL) for the best
+ * one the CPU supports or "bench" to time the supported ones and keep
+ * the fastest. Must be called before any encoder is set up.
+ */
+int8_t init_dsp_kernels(char *isa) {
+	const struct dsp_isa_t *picked = NULL;
+
+#ifdef USE_X86
+	__builtin_cpu_init();
+#endif
+
+	if (isa == NULL || !strcmp(isa, "auto")) {
+		for (uint8_t i = 0; i < NUM_ISAS; i++) {
+			if (isa_supported(&isas[i])) picked = &isas[i];
+		}
+	} else if (!strcmp(isa, "bench")) {
+		picked = bench_isas();
+	} else {
+		for (uint8_t i = 0; i < NUM_ISAS; i++) {
+			if (strcmp(isas[i].name, isa)) continue;
+			if (!isa_supported(&isas[i])) {
+				fprintf(stderr, "Error: this CPU can not run the %s kernels.\n", isa);
+				return -1;
+			}
+			picked = &isas[i];
+		}
+		if (picked == NULL) {
+			fprintf(stderr, "Error: unknown kernels \"%s\". Available:", isa);
+			for (uint8_t i = 0; i < NUM_ISAS; i++) {
+				fprintf(stderr, " %s", isas[i].name);
+			}
+			fprintf(stderr, "\n");
+			return -1;
+		}
+	}
+
+	current_isa = picked;
+	dsp = picked->kernels;
+
+	return 0;
+}
+
+const char *get_dsp_isa() {
+	return current_isa->name;
+}
@@ -0,0 +1,35 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Hot DSP kernels, one set for every instruction set
+ *
+ * The set used is picked once at startup for the CPU the program runs
+ * on and called through the function pointers below.
+ */
+typedef struct dsp_kernels_t {
+	// dot product of n floats, summed in order on the scalar path
+	float (*dot)(const float *x, const float *h, uint16_t n);
+	// dot product of n Q15 values, exact in 32 bits for the fixed-point path
+	int32_t (*dot_q15)(const int16_t *x, const int16_t *h, uint16_t n);
+} dsp_kernels_t;
+
+extern struct dsp_kernels_t dsp;
+
+extern int8_t init_dsp_kernels(char *isa);
+extern const char *get_dsp_isa();
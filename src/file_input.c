@@ -17,33 +17,26 @@
  */
 
 #include "common.h"
-#include <sndfile.h>
 #include "audio_conversion.h"
+#include "file_input.h"
 
-#define shortf_memcpy(x, y, z) memcpy(x, y, z * 2 * sizeof(short))
-
-static uint8_t channels;
-static uint8_t audio_wait;
-static SNDFILE *inf;
-static short *buf;
-static size_t target_len;
-
-int8_t open_file_input(char *filename, uint32_t *sample_rate, uint8_t wait, size_t num_frames) {
+int8_t open_file_input(struct file_input_t *in, char *filename, uint32_t *sample_rate, uint8_t wait, size_t num_frames) {
 	// Open the input file
 	SF_INFO sfinfo;
 
-	target_len = num_frames;
+	memset(in, 0, sizeof(struct file_input_t));
+	in->target_len = num_frames;
 
 	// stdin or file on the filesystem?
 	if(filename[0] == '-' && filename[1] == 0) {
-		if(!(inf = sf_open_fd(fileno(stdin), SFM_READ, &sfinfo, 0))) {
+		if(!(in->inf = sf_open_fd(fileno(stdin), SFM_READ, &sfinfo, 0))) {
 			fprintf(stderr, "Error: could not open stdin for audio input.\n");
 			return -1;
 		} else {
 			fprintf(stderr, "Using stdin for audio input.\n");
 		}
 	} else {
-		if(!(inf = sf_open(filename, SFM_READ, &sfinfo))) {
+		if(!(in->inf = sf_open(filename, SFM_READ, &sfinfo))) {
 			fprintf(stderr, "Error: could not open input file %s.\n", filename);
 			return -1;
 		} else {
@@ -51,57 +44,65 @@ int8_t open_file_input(char *filename, uint32_t *sample_rate, uint8_t wait, size
 		}
 	}
 
+	if (sfinfo.channels > 2) {
+		fprintf(stderr, "Error: only mono and stereo audio is supported.\n");
+		sf_close(in->inf);
+		return -1;
+	}
+
 	*sample_rate = sfinfo.samplerate;
-	channels = sfinfo.channels;
-	audio_wait = wait;
+	in->channels = sfinfo.channels;
+	in->audio_wait = wait;
 
-	buf = malloc(num_frames * 2 * sizeof(short));
+	if (in->channels == 1) in->buf = malloc(num_frames * sizeof(float));
 
 	return 0;
 }
 
-int16_t read_file_input(short *audio) {
+int16_t read_file_input(struct file_input_t *in, float *audio) {
 	int16_t read_len;
-	uint16_t frames_to_read = target_len;
+	uint16_t frames_to_read = in->target_len;
 	uint16_t audio_len = 0;
-	static uint8_t silent;
+	uint8_t channels = in->channels;
+	// stereo files are read straight into the output buffer
+	float *dest = (channels == 2) ? audio : in->buf;
 
-	while (frames_to_read > 0 && audio_len < target_len) {
-		if ((read_len = sf_readf_short(inf, buf + (audio_len * channels), frames_to_read)) < 0) {
+	while (frames_to_read > 0 && audio_len < in->target_len) {
+		if ((read_len = sf_readf_float(in->inf, dest + (audio_len * channels), frames_to_read)) < 0) {
 			fprintf(stderr, "Error reading audio\n");
 			return -1;
 		}
 
 		audio_len += read_len;
 		frames_to_read -= read_len;
-		if (audio_len == 0) {
+		if (read_len == 0) {
 			// Check if we have more audio
-			if (sf_seek(inf, 0, SEEK_SET) < 0) {
-				if (audio_wait) {
-					if (silent) {
-						memset(buf, 0, target_len * 2 * sizeof(short));
+			if (sf_seek(in->inf, 0, SEEK_SET) < 0) {
+				if (in->audio_wait) {
+					if (in->silent) {
+						memset(dest + (audio_len * channels), 0,
+							frames_to_read * channels * sizeof(float));
 					} else {
-						silent = 1;
+						in->silent = 1;
 					}
 					frames_to_read = 0;
 				} else {
 					return -1;
 				}
 			} else {
-				silent = 0;
+				in->silent = 0;
 			}
 		}
 	}
 
 	if (channels == 1)
-		stereoizes16(buf, audio, target_len);
-	else
-		shortf_memcpy(audio, buf, target_len);
+		stereoizef(in->buf, audio, in->target_len);
 
 	return 1;
 }
 
-void close_file_input() {
-	if (buf != NULL) free(buf);
-	if (sf_close(inf)) fprintf(stderr, "Error closing audio file\n");
+void close_file_input(struct file_input_t *in) {
+	if (in->buf != NULL) free(in->buf);
+	in->buf = NULL;
+	if (sf_close(in->inf)) fprintf(stderr, "Error closing audio file\n");
 }
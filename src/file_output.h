@@ -18,6 +18,11 @@
 
 #include <sndfile.h>
 
-extern int open_file_output(char *filename, unsigned int sample_rate, unsigned int channels);
-extern int write_file_output(short *audio, size_t num_frames);
-extern void close_file_output();
+typedef struct file_output_t {
+	SNDFILE *outf;
+	uint8_t format;
+} file_output_t;
+
+extern int open_file_output(struct file_output_t *out, char *filename, unsigned int sample_rate, unsigned int channels, uint8_t format);
+extern int write_file_output(struct file_output_t *out, void *audio, size_t num_frames);
+extern void close_file_output(struct file_output_t *out);
@@ -0,0 +1,389 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "filter_design.h"
+
+/*
+ * Equiripple FIR design
+ *
+ * Both filters are worked out with the Parks-McClellan (Remez exchange)
+ * algorithm, which finds the cosine series of a given length with the
+ * smallest peak weighted error. The weights are chosen so the spec is
+ * met when that error is at most 1, and the length is grown until it
+ * is, so the filters come out as short as the spec allows.
+ */
+
+#define GRID_DENSITY	16
+#define MAX_ITERATIONS	50
+
+// longest series tried
+#define MAX_TERMS	1024
+
+/*
+ * Target on the design grid
+ *
+ * Frequencies are in radians of the cosine series, 0 - pi.
+ */
+typedef struct remez_band_t {
+	double lo, hi;
+	double desired;
+	double weight;
+	// desired and weight are divided and multiplied by cos(w / 2)
+	uint8_t half_cos;
+} remez_band_t;
+
+typedef struct remez_grid_t {
+	double *x; // cos(w)
+	double *desired;
+	double *weight;
+	uint8_t *band;
+	uint32_t len;
+} remez_grid_t;
+
+static void make_grid(struct remez_grid_t *grid, const struct remez_band_t *bands,
+	uint8_t num_bands, uint16_t terms) {
+	double total = 0.0, w, c;
+	uint32_t n, max_len;
+
+	for (uint8_t b = 0; b < num_bands; b++) total += bands[b].hi - bands[b].lo;
+
+	max_len = GRID_DENSITY * terms + 2 * num_bands + 1;
+	grid->x = malloc(max_len * sizeof(double));
+	grid->desired = malloc(max_len * sizeof(double));
+	grid->weight = malloc(max_len * sizeof(double));
+	grid->band = malloc(max_len);
+	grid->len = 0;
+
+	for (uint8_t b = 0; b < num_bands; b++) {
+		n = (uint32_t)(GRID_DENSITY * terms * (bands[b].hi - bands[b].lo) / total) + 1;
+		if (n < 2) n = 2;
+		if (grid->len + n > max_len) n = max_len - grid->len;
+		for (uint32_t i = 0; i < n; i++) {
+			w = bands[b].lo + (bands[b].hi - bands[b].lo) * i / (n - 1);
+			c = bands[b].half_cos ? cos(w / 2.0) : 1.0;
+			grid->x[grid->len] = cos(w);
+			grid->desired[grid->len] = bands[b].desired / c;
+			grid->weight[grid->len] = bands[b].weight * c;
+			grid->band[grid->len] = b;
+			grid->len++;
+		}
+	}
+}
+
+static void free_grid(struct remez_grid_t *grid) {
+	free(grid->x);
+	free(grid->desired);
+	free(grid->weight);
+	free(grid->band);
+}
+
+// barycentric interpolation through the extremal frequencies
+static double interpolate(double x, const double *xk, const double *ad,
+	const double *yk, uint16_t r) {
+	double num = 0.0, den = 0.0, d;
+
+	for (uint16_t k = 0; k < r; k++) {
+		d = x - xk[k];
+		if (fabs(d) < 1e-15) return yk[k];
+		d = ad[k] / d;
+		num += d * yk[k];
+		den += d;
+	}
+
+	return num / den;
+}
+
+/*
+ * Finds the cosine series of terms terms (a[0] + a[1] cos(w) + ...)
+ * with the smallest peak weighted error on the grid and returns that
+ * error
+ */
+static double remez(struct remez_grid_t *grid, uint16_t terms, double *a) {
+	uint16_t r = terms + 1;
+	uint32_t *ext = malloc((grid->len + 1) * sizeof(uint32_t));
+	uint32_t *cand = malloc((grid->len + 1) * sizeof(uint32_t));
+	double *xk = malloc(r * sizeof(double));
+	double *ad = malloc(r * sizeof(double));
+	double *yk = malloc(r * sizeof(double));
+	double *err = malloc(grid->len * sizeof(double));
+	double delta = 0.0, num, den, q, peak = 0.0;
+	uint32_t n, smallest;
+	uint8_t changed;
+
+	// start from evenly spaced extremal frequencies
+	for (uint16_t k = 0; k < r; k++) {
+		ext[k] = (uint32_t)((uint64_t)k * (grid->len - 1) / (r - 1));
+	}
+
+	for (uint8_t iter = 0; iter < MAX_ITERATIONS; iter++) {
+		for (uint16_t k = 0; k < r; k++) xk[k] = grid->x[ext[k]];
+
+		// scaled by 2 so the products neither overflow nor underflow
+		for (uint16_t k = 0; k < r; k++) {
+			q = 1.0;
+			for (uint16_t j = 0; j < r; j++) {
+				if (j != k) q *= 2.0 * (xk[k] - xk[j]);
+			}
+			ad[k] = 1.0 / q;
+		}
+
+		num = den = 0.0;
+		for (uint16_t k = 0; k < r; k++) {
+			num += ad[k] * grid->desired[ext[k]];
+			den += (k & 1 ? -ad[k] : ad[k]) / grid->weight[ext[k]];
+		}
+		delta = num / den;
+
+		for (uint16_t k = 0; k < r; k++) {
+			yk[k] = grid->desired[ext[k]] -
+				(k & 1 ? -delta : delta) / grid->weight[ext[k]];
+		}
+
+		for (uint32_t i = 0; i < grid->len; i++) {
+			err[i] = grid->weight[i] *
+				(grid->desired[i] - interpolate(grid->x[i], xk, ad, yk, r));
+		}
+
+		// local extremes of the error, band edges included
+		n = 0;
+		for (uint32_t i = 0; i < grid->len; i++) {
+			if (i > 0 && grid->band[i-1] == grid->band[i] &&
+			    err[i-1] * err[i] > 0.0 && fabs(err[i-1]) > fabs(err[i])) continue;
+			if (i + 1 < grid->len && grid->band[i+1] == grid->band[i] &&
+			    err[i+1] * err[i] > 0.0 && fabs(err[i+1]) >= fabs(err[i])) continue;
+			// keep the signs alternating
+			if (n && err[cand[n-1]] * err[i] > 0.0) {
+				if (fabs(err[i]) > fabs(err[cand[n-1]])) cand[n-1] = i;
+				continue;
+			}
+			cand[n++] = i;
+		}
+		if (n < r) break;
+
+		// drop the smallest ones until there are r left
+		while (n > r) {
+			if (n - r == 1) {
+				if (fabs(err[cand[0]]) < fabs(err[cand[n-1]])) {
+					memmove(cand, cand + 1, (n - 1) * sizeof(uint32_t));
+				}
+				n--;
+				continue;
+			}
+
+			smallest = 0;
+			for (uint32_t k = 1; k < n; k++) {
+				if (fabs(err[cand[k]]) < fabs(err[cand[smallest]])) smallest = k;
+			}
+			memmove(cand + smallest, cand + smallest + 1, (n - smallest - 1) * sizeof(uint32_t));
+			n--;
+			// its neighbours now have the same sign, keep the larger
+			if (smallest > 0 && smallest < n) {
+				if (fabs(err[cand[smallest]]) > fabs(err[cand[smallest-1]]))
+					cand[smallest-1] = cand[smallest];
+				memmove(cand + smallest, cand + smallest + 1, (n - smallest - 1) * sizeof(uint32_t));
+				n--;
+			}
+		}
+
+		changed = 0;
+		for (uint16_t k = 0; k < r; k++) {
+			if (ext[k] != cand[k]) changed = 1;
+			ext[k] = cand[k];
+		}
+
+		peak = 0.0;
+		for (uint32_t i = 0; i < grid->len; i++) {
+			if (fabs(err[i]) > peak) peak = fabs(err[i]);
+		}
+		if (!changed || peak - fabs(delta) < 1e-6 * peak) break;
+	}
+
+	if (peak < fabs(delta)) peak = fabs(delta);
+
+	// the series from its values at evenly spaced frequencies
+	for (uint16_t l = 0; l < terms; l++) {
+		err[l] = interpolate(cos(M_PI * l / (terms - 1)), xk, ad, yk, r);
+		if (l == 0 || l == terms - 1) err[l] /= 2.0;
+	}
+	for (uint16_t j = 0; j < terms; j++) {
+		a[j] = 0.0;
+		for (uint16_t l = 0; l < terms; l++) {
+			a[j] += err[l] * cos(M_PI * j * l / (terms - 1));
+		}
+		a[j] *= 2.0 / (terms - 1);
+		if (j == 0 || j == terms - 1) a[j] /= 2.0;
+	}
+
+	free(ext);
+	free(cand);
+	free(xk);
+	free(ad);
+	free(yk);
+	free(err);
+
+	return peak;
+}
+
+/*
+ * Designs the shortest series that meets the spec (weighted error of
+ * at most 1). Returns the number of terms or 0 if none of up to
+ * MAX_TERMS does.
+ */
+static uint16_t shortest_design(const struct remez_band_t *bands, uint8_t num_bands,
+	uint16_t guess, double *a) {
+	struct remez_grid_t grid;
+	uint16_t lo = 0, hi = 0, terms;
+
+	if (guess < 3) guess = 3;
+
+	// grow (or shrink) from the guess until the spec is bracketed
+	terms = guess;
+	for (;;) {
+		make_grid(&grid, bands, num_bands, terms);
+		if (remez(&grid, terms, a) <= 1.0) {
+			hi = terms;
+		} else {
+			lo = terms;
+		}
+		free_grid(&grid);
+
+		if (hi && lo) break;
+		if (!hi) {
+			if (terms == MAX_TERMS) return 0;
+			terms = terms * 5 / 4 + 1;
+			if (terms > MAX_TERMS) terms = MAX_TERMS;
+		} else {
+			if (terms <= 3) break;
+			terms = terms * 4 / 5;
+			if (terms < 3) terms = 3;
+		}
+	}
+
+	// then narrow it down
+	while (lo && hi - lo > 1) {
+		terms = (lo + hi) / 2;
+		make_grid(&grid, bands, num_bands, terms);
+		if (remez(&grid, terms, a) <= 1.0) {
+			hi = terms;
+		} else {
+			lo = terms;
+		}
+		free_grid(&grid);
+	}
+
+	make_grid(&grid, bands, num_bands, hi);
+	remez(&grid, hi, a);
+	free_grid(&grid);
+
+	return hi;
+}
+
+/*
+ * Returns the taps of the shortest linear phase low-pass filter that
+ * meets the spec, 2 * n - 1 of them, n being the number of terms of
+ * its cosine series
+ */
+float *design_low_pass(uint32_t sample_rate, struct low_pass_spec_t spec, uint16_t *size) {
+	// the ripple below unity is the larger one in dB
+	double pass_dev = 1.0 - pow(10.0, -spec.pass_ripple / 20.0);
+	double stop_dev = pow(10.0, -spec.stop_atten / 20.0);
+	double transition = (spec.stop_edge - spec.pass_edge) / sample_rate;
+	struct remez_band_t bands[2] = {
+		{0.0, M_2PI * spec.pass_edge / sample_rate, 1.0, 1.0 / pass_dev, 0},
+		{M_2PI * spec.stop_edge / sample_rate, M_PI, 0.0, 1.0 / stop_dev, 0}
+	};
+	double a[MAX_TERMS];
+	uint16_t terms, half;
+	float *taps;
+
+	// Kaiser's estimate of the length
+	terms = (uint16_t)((-20.0 * log10(sqrt(pass_dev * stop_dev)) - 13.0) /
+		(14.6 * transition) / 2.0) + 1;
+
+	terms = shortest_design(bands, 2, terms, a);
+	if (!terms) {
+		fprintf(stderr, "Error: no low-pass filter meets the spec.\n");
+		return NULL;
+	}
+
+	half = terms - 1;
+	*size = 2 * terms - 1;
+	taps = malloc(*size * sizeof(float));
+	taps[half] = a[0];
+	for (uint16_t j = 1; j < terms; j++) {
+		taps[half-j] = taps[half+j] = a[j] / 2.0;
+	}
+
+	return taps;
+}
+
+/*
+ * Returns the taps of the shortest Hilbert transformer that meets the
+ * spec
+ *
+ * Every other tap of an antisymmetric filter with its band centered
+ * on a quarter of the sample rate is 0, so only the others are
+ * returned, oldest sample first. They are applied to the current
+ * sample and every other one before it. The group delay is size - 1
+ * samples.
+ *
+ * The response only has to be right between low_edge and the
+ * Nyquist frequency less low_edge, which is symmetric around a quarter
+ * of the sample rate. Mapping that half of the band onto 0 - pi turns
+ * the odd sine series into a cosine series times cos(w / 2).
+ */
+float *design_hilbert(uint32_t sample_rate, struct hilbert_spec_t spec, uint16_t *size) {
+	double dev = 1.0 - pow(10.0, -spec.ripple / 20.0);
+	struct remez_band_t band = {
+		0.0, M_PI - 2.0 * M_2PI * spec.low_edge / sample_rate, 1.0, 1.0 / dev, 1
+	};
+	double a[MAX_TERMS], b;
+	uint16_t terms;
+	float *taps;
+
+	// the same estimate, with the transition across 0
+	terms = (uint16_t)((-20.0 * log10(dev) - 13.0) /
+		(14.6 * 4.0 * spec.low_edge / sample_rate) / 4.0) + 1;
+
+	terms = shortest_design(&band, 1, terms, a);
+	if (!terms) {
+		fprintf(stderr, "Error: no Hilbert transformer meets the spec.\n");
+		return NULL;
+	}
+
+	/*
+	 * cos(t) (a[0] + a[1] cos(2t) + ...) as b[1] cos(t) + b[2] cos(3t) + ...,
+	 * with t = pi / 2 - w so cos((2k - 1) t) = +/-sin((2k - 1) w)
+	 */
+	*size = 2 * terms;
+	taps = malloc(*size * sizeof(float));
+	for (uint16_t k = 1; k <= terms; k++) {
+		b = a[k-1] / 2.0;
+		if (k < terms) b += a[k] / 2.0;
+		if (k == 1) b += a[0] / 2.0;
+		// the taps are half the sine series
+		b /= 2.0;
+		if (!(k & 1)) b = -b;
+		// tap (2k - 1) before and after the center
+		taps[terms-k] = b;
+		taps[terms+k-1] = -b;
+	}
+
+	return taps;
+}
@@ -0,0 +1,44 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Low-pass filter spec
+ *
+ * Edges are in Hz, the ripple is the peak passband deviation and the
+ * attenuation the minimum stopband attenuation, both in dB.
+ */
+typedef struct low_pass_spec_t {
+	float pass_edge;
+	float stop_edge;
+	float pass_ripple;
+	float stop_atten;
+} low_pass_spec_t;
+
+/*
+ * Hilbert transformer spec
+ *
+ * The response is held within ripple dB of unity from low_edge up to
+ * the Nyquist frequency less low_edge.
+ */
+typedef struct hilbert_spec_t {
+	float low_edge;
+	float ripple;
+} hilbert_spec_t;
+
+extern float *design_low_pass(uint32_t sample_rate, struct low_pass_spec_t spec, uint16_t *size);
+extern float *design_hilbert(uint32_t sample_rate, struct hilbert_spec_t spec, uint16_t *size);
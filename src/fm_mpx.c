@@ -17,139 +17,191 @@
  */
 
 #include "common.h"
+#include <pthread.h>
+#include <strings.h>
 
-#include "rds.h"
-#ifdef RDS2
-#include "rds2.h"
-#endif
 #include "fm_mpx.h"
-#include "mpx_carriers.h"
-#include "ssb.h"
-
-static float mpx_vol;
+#include "fm_mpx_q15.h"
+#include "dsp_kernels.h"
+#include "rds_modulator.h"
+#include "shared_tables.h"
 
 // MPX carrier index
 enum mpx_carrier_index {
 	CARRIER_19K,
-	CARRIER_38K,
-	CARRIER_57K,
-#ifdef RDS2
-	CARRIER_67K,
-	CARRIER_71K,
-	CARRIER_76K,
-#endif
+	CARRIER_38K
 };
 
 static const float carrier_frequencies[] = {
 	19000.0, // pilot tone
 	38000.0, // stereo difference
+	0.0 // terminator
+};
+
+// subcarrier index
+enum subcarrier_index {
+	CARRIER_57K,
+
+	// RDS2
+	CARRIER_67K,
+	CARRIER_71K,
+	CARRIER_76K
+};
+
+static const float subcarrier_frequencies[] = {
 	57000.0, // RDS
 
-#ifdef RDS2
-	// RDS 2
+	// RDS2
 	66500.0, // stream 1
 	71250.0, // stream 2
-	76000.0,  // stream 2
-#endif
-	0.0 // terminator
+	76000.0  // stream 3
 };
 
 /*
- * filter state
+ * Low-pass filter coefficients, one set per quality tier
  *
+ * Shared by all encoders. Each set is worked out by the first encoder
+ * to use it and all of them are freed when the last encoder exits.
  */
-static struct filter_t fir_low_pass;
+static struct low_pass_design_t {
+	float *coeffs;
+	uint16_t size;
+	// points into the shared or built-in tables
+	uint8_t shared;
+} low_pass_designs[NUM_QUALITY_TIERS];
+static uint16_t encoder_count;
+static pthread_mutex_t coeffs_mutex = PTHREAD_MUTEX_INITIALIZER;
+// one quality or stereo mode change is set up at a time
+static pthread_mutex_t change_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void set_output_volume(struct fm_mpx_t *mpx, uint8_t vol) {
+	if (vol > 100) vol = 100;
+	mpx->mpx_vol = (vol / 100.0f);
+}
+
+// applied by the output stage
+float get_output_volume(struct fm_mpx_t *mpx) {
+	return mpx->mpx_vol;
+}
+
+// default subcarrier volumes
+static const float default_volumes[] = {
+	0.09, // pilot tone: 9% modulation
+	0.09, // RDS: 4.5% modulation
+
+	0.09, // RDS 2
+	0.09,
+	0.09
+};
 
 /*
- * delay buffers for hilbert transform
+ * Quality tiers
  *
+ * Every tier keeps the audio at least 40 dB down from 18.5 kHz, so
+ * neither it nor its image in the stereo sideband gets near the pilot.
+ * The Hilbert transformer holds the other SSB sideband about 25 dB down
+ * from 300 Hz in the low tier, 30 dB from 150 Hz in the standard one
+ * and 36 dB from 50 Hz in the reference one.
  */
-static struct delay_line_t left_delay;
-static struct delay_line_t right_delay;
+static const struct quality_tier_t {
+	char *name;
+	struct low_pass_spec_t low_pass;
+	struct hilbert_spec_t hilbert;
+} quality_tiers[NUM_QUALITY_TIERS] = {
+	{"low",		{15000.0f, 18500.0f, 0.5f, 40.0f},	{300.0f, 1.0f}},
+	{"standard",	{15000.0f, 18500.0f, 0.1f, 60.0f},	{150.0f, 0.5f}},
+	{"reference",	{15000.0f, 18500.0f, 0.05f, 80.0f},	{50.0f, 0.25f}}
+};
+
+// length of the fade from one tier (or stereo mode) to the next (10 ms)
+#define QUALITY_FADE_FRAMES	(MPX_SAMPLE_RATE / 100)
+
+static char *stereo_mode_names[NUM_STEREO_MODES] = {"ssb", "dsb", "asym"};
 
 /*
- * Local cscillator object
- * this is where the MPX waveforms are stored
- *
+ * Largest stereo difference taken as mono (half a 16-bit step), so
+ * resampled mono that is off by a rounding error still counts
  */
-static struct osc_t mpx_osc;
+#define MONO_THRESHOLD		(1.0f / 65536.0f)
+
+static void select_kernels(struct fm_mpx_t *mpx);
+static void select_audio_kernel(struct fm_mpx_t *mpx);
 
 /*
- * Hilbert transformer object
- *
+ * Safe to call from other threads: the subcarrier kernel is picked
+ * again at the start of the next block, by the thread generating the
+ * subcarriers.
  */
-static struct hilbert_fir_t ssb_ht;
-
-void set_output_volume(uint8_t vol) {
-	if (vol > 100) vol = 100;
-	mpx_vol = (vol / 100.0f);
+void set_carrier_volume(struct fm_mpx_t *mpx, uint8_t carrier, uint8_t new_volume) {
+	if (carrier > 4) return;
+	if (new_volume >= 15) mpx->volumes[carrier] = 0.09f;
+	mpx->volumes[carrier] = new_volume / 100.0f;
+	// the new volume is seen before the flag
+	__atomic_store_n(&mpx->volumes_changed, 1, __ATOMIC_RELEASE);
 }
 
-// subcarrier volumes
-static float volumes[] = {
-	0.09, // pilot tone: 9% modulation
-	0.09, // RDS: 4.5% modulation
+/*
+ * All taps are stored, even though the filter is symmetric, so it can
+ * be run as a plain dot product
+ */
+static int8_t get_low_pass_design(struct low_pass_design_t *design, uint32_t sample_rate,
+	struct low_pass_spec_t spec) {
+	char key[SHARED_TABLE_KEY_LENGTH];
+	const float *shared;
+	uint32_t len;
 
-	0.09, // RDS 2
-	0.09,
-	0.09
-};
+	// short, so the longest key still fits in SHARED_TABLE_KEY_LENGTH
+	snprintf(key, SHARED_TABLE_KEY_LENGTH, "lp %u %.0f %.0f %.2f %.0f", sample_rate,
+		spec.pass_edge, spec.stop_edge, spec.pass_ripple, spec.stop_atten);
 
-void set_carrier_volume(uint8_t carrier, uint8_t new_volume) {
-	if (carrier > 4) return;
-	if (new_volume >= 15) volumes[carrier] = 0.09f;
-	volumes[carrier] = new_volume / 100.0f;
+	shared = find_shared_table(key, &len);
+	if (shared != NULL) {
+		design->coeffs = (float *)shared;
+		design->size = len;
+		design->shared = 1;
+		return 0;
+	}
+
+	design->coeffs = design_low_pass(sample_rate, spec, &design->size);
+	if (design->coeffs == NULL) return -1;
+	design->shared = 0;
+
+	share_table(key, design->coeffs, design->size);
+
+	return 0;
 }
 
-static void init_fir_filter(struct filter_t *flt, uint32_t sample_rate, uint16_t half_size) {
+static void init_fir_filter(struct filter_t *flt, uint32_t sample_rate, uint16_t size, float *coeffs) {
 
 	memset(flt, 0, sizeof(struct filter_t));
 
 	flt->sample_rate = sample_rate;
-	flt->half_size = half_size;
-	flt->size = 2 * half_size - 1;
+	flt->size = size;
 
 	// setup input buffers
-	flt->in[0] = malloc(flt->size * sizeof(float));
-	flt->in[1] = malloc(flt->size * sizeof(float));
-	flt->filter = malloc(flt->half_size * sizeof(float));
-
-	// Here we divide this coefficient by two because it will be counted twice
-	// when applying the filter
-	flt->filter[half_size-1] = (float)(2 * 24000 / sample_rate / 2);
-
-	// Only store half of the filter since it is symmetric
-	double filter, window;
-	for (int i = 1; i < half_size; i++) {
-		filter = sin(M_2PI * 24000 * i / sample_rate) / (M_PI * i); // sinc
-		window = 0.54 - 0.46 * cos(M_2PI * (double)(half_size + i) / (double)(2 * half_size)); // Hamming window
-		flt->filter[half_size-1-i] = (float)(filter * window);
-	}
+	flt->in[0] = calloc(2 * flt->size, sizeof(float));
+	flt->in[1] = calloc(2 * flt->size, sizeof(float));
+	flt->filter = coeffs;
 }
 
+/*
+ * Every sample is stored twice, size samples apart, so the last size
+ * samples are always in one piece starting at index
+ */
 static inline void fir_filter_add(struct filter_t *flt, float *in_buffer) {
-	flt->in[0][flt->index] = in_buffer[0];
-	flt->in[1][flt->index] = in_buffer[1];
+	flt->in[0][flt->index] = flt->in[0][flt->index + flt->size] = in_buffer[0];
+	flt->in[1][flt->index] = flt->in[1][flt->index + flt->size] = in_buffer[1];
 	if (++flt->index == flt->size) flt->index = 0;
 }
 
 static inline void fir_filter_apply(struct filter_t *flt) {
+	flt->out[0] = dsp.dot(flt->in[0] + flt->index, flt->filter, flt->size);
+	flt->out[1] = dsp.dot(flt->in[1] + flt->index, flt->filter, flt->size);
+}
 
-	/* As the FIR filter is symmetric, we do not multiply all
-	   the coefficients independently, but two-by-two, thus reducing
-	   the total number of multiplications by a factor of two
-	 */
-	int16_t ifbi = flt->index;  // ifbi = increasing FIR Buffer Index
-	int16_t dfbi = flt->index;  // dfbi = decreasing FIR Buffer Index
-	flt->out[0] = 0;
-	flt->out[1] = 0;
-	for (int fi = 0; fi < flt->half_size; fi++) {  // fi = Filter Index
-		if(--dfbi == -1) dfbi = flt->size-1;
-		flt->out[0] += flt->filter[fi] * (flt->in[0][ifbi] + flt->in[0][dfbi]);
-		flt->out[1] += flt->filter[fi] * (flt->in[1][ifbi] + flt->in[1][dfbi]);
-		if(++ifbi == flt->size) ifbi = 0;
-	}
-	// End of FIR filter
+// for when both channels are the same
+static inline void fir_filter_apply_mono(struct filter_t *flt) {
+	flt->out[0] = flt->out[1] = dsp.dot(flt->in[0] + flt->index, flt->filter, flt->size);
 }
 
 static inline void fir_filter_get(struct filter_t *flt, float *out) {
@@ -160,20 +212,16 @@ static inline void fir_filter_get(struct filter_t *flt, float *out) {
 static void exit_fir_filter(struct filter_t *flt) {
 	free(flt->in[0]);
 	free(flt->in[1]);
-	free(flt->filter);
 }
 
 /*
  * filter delays needed for SSB
  *
  */
-static void init_delay_line(struct delay_line_t *delay_line, uint32_t sample_rate) {
-	delay_line->buffer = malloc(sample_rate * sizeof(float));
-	memset(delay_line->buffer, 0, sample_rate * sizeof(float));
-}
-
-static void set_delay_line(struct delay_line_t *delay_line, uint32_t new_delay) {
-	delay_line->delay = new_delay;
+static void init_delay_line(struct delay_line_t *delay_line, uint32_t delay) {
+	delay_line->buffer = calloc(delay, sizeof(float));
+	delay_line->delay = delay;
+	delay_line->idx = 0;
 }
 
 static inline float delay_line(struct delay_line_t *delay_line, float in) {
@@ -186,14 +234,139 @@ static void exit_delay_line(struct delay_line_t *delay_line) {
 	free(delay_line->buffer);
 }
 
-void fm_mpx_init() {
-	init_osc(&mpx_osc, MPX_SAMPLE_RATE, carrier_frequencies);
-	init_hilbert_transformer(&ssb_ht, 512);
-	init_fir_filter(&fir_low_pass, MPX_SAMPLE_RATE, 128);
-	init_delay_line(&left_delay, MPX_SAMPLE_RATE);
-	init_delay_line(&right_delay, MPX_SAMPLE_RATE);
-	set_delay_line(&left_delay, 256 /* half of HT filter size */);
-	set_delay_line(&right_delay, 256 /* half of HT filter size */);
+// delay of a set of audio filters in samples, not counting the padding
+static uint32_t audio_filters_delay(struct audio_filters_t *f) {
+	return (f->low_pass.size - 1) / 2 + f->ssb_ht.delay;
+}
+
+// samples it takes a sample to get through a set of audio filters
+static uint32_t audio_filters_span(struct audio_filters_t *f) {
+	return f->pad[0].delay + f->low_pass.size + 2 * f->ssb_ht.num_coeffs;
+}
+
+static void exit_audio_filters(struct audio_filters_t *f) {
+	exit_delay_line(&f->pad[0]);
+	exit_delay_line(&f->pad[1]);
+	exit_fir_filter(&f->low_pass);
+	exit_hilbert_transformer(&f->ssb_ht);
+	exit_delay_line(&f->left_delay);
+	exit_delay_line(&f->right_delay);
+}
+
+// group delay of the Hilbert transformer of a tier, from one of its own
+static int32_t get_hilbert_delay(uint8_t quality) {
+	struct hilbert_fir_t ht;
+	int32_t delay;
+
+	if (init_hilbert_transformer(&ht, MPX_SAMPLE_RATE, quality_tiers[quality].hilbert) < 0)
+		return -1;
+	delay = ht.delay;
+	exit_hilbert_transformer(&ht);
+
+	return delay;
+}
+
+/*
+ * Sets up the audio filters of a quality tier for a stereo mode. If the
+ * quality can be changed while running they are delayed to line up
+ * with the tier the encoder started with.
+ *
+ * DSB filters have no Hilbert transformer, but are delayed as long as
+ * one would take, so a stereo mode change fades between two copies of
+ * the audio that line up. It is only a delay line, DSB stays cheap.
+ */
+static int8_t init_audio_filters(struct fm_mpx_t *mpx, struct audio_filters_t *f,
+	uint8_t quality, uint8_t stereo_mode) {
+	const struct quality_tier_t *tier = &quality_tiers[quality];
+	struct low_pass_design_t *design = &low_pass_designs[quality];
+	int32_t pad = 0;
+
+	memset(f, 0, sizeof(struct audio_filters_t));
+	f->quality = quality;
+	f->stereo_mode = stereo_mode;
+
+	pthread_mutex_lock(&coeffs_mutex);
+	if (design->coeffs == NULL &&
+	    get_low_pass_design(design, MPX_SAMPLE_RATE, tier->low_pass) < 0) {
+		pthread_mutex_unlock(&coeffs_mutex);
+		return -1;
+	}
+	pthread_mutex_unlock(&coeffs_mutex);
+
+	if (stereo_mode != STEREO_DSB) {
+		if (init_hilbert_transformer(&f->ssb_ht, MPX_SAMPLE_RATE, tier->hilbert) < 0)
+			return -1;
+
+		// delays mono and the in-phase stereo to match the Hilbert transformer
+		init_delay_line(&f->left_delay, f->ssb_ht.delay + 1);
+		init_delay_line(&f->right_delay, f->ssb_ht.delay + 1);
+	}
+
+	init_fir_filter(&f->low_pass, MPX_SAMPLE_RATE, design->size, design->coeffs);
+
+	if (mpx->aligned_delay) {
+		pad = mpx->aligned_delay + mpx->aligned_ht_delay - audio_filters_delay(f);
+		if (pad < 0) {
+			fprintf(stderr, "Error: the %s quality is above the one the encoder started with.\n",
+				tier->name);
+			exit_audio_filters(f);
+			return -1;
+		}
+	} else if (stereo_mode == STEREO_DSB) {
+		pad = get_hilbert_delay(quality);
+		if (pad < 0) {
+			exit_audio_filters(f);
+			return -1;
+		}
+	}
+	init_delay_line(&f->pad[0], pad + 1);
+	init_delay_line(&f->pad[1], pad + 1);
+
+	return 0;
+}
+
+/*
+ * Sets up the subcarrier oscillator with only the carriers of the
+ * streams in use
+ */
+static int8_t init_sub_osc(struct fm_mpx_t *mpx, uint8_t rds2_streams) {
+	float freqs[MAX_RDS2_STREAMS + 2] = {0};
+	struct osc_t osc;
+
+	memcpy(freqs, subcarrier_frequencies, (rds2_streams + 1) * sizeof(float));
+	if (init_osc(&osc, MPX_SAMPLE_RATE, freqs) < 0) return -1;
+
+	// the new one is set up first so the tables both have are kept
+	exit_osc(&mpx->sub_osc);
+	mpx->sub_osc = osc;
+	mpx->rds2_streams = rds2_streams;
+
+	return 0;
+}
+
+int8_t fm_mpx_init(struct fm_mpx_t *mpx) {
+	memset(mpx, 0, sizeof(struct fm_mpx_t));
+	memcpy(mpx->volumes, default_volumes, sizeof(default_volumes));
+
+	pthread_mutex_lock(&coeffs_mutex);
+	if (!encoder_count++) init_symbol_waveforms();
+	pthread_mutex_unlock(&coeffs_mutex);
+
+	mpx->stereo_mode = STEREO_SSB;
+	set_asym_dsb(mpx, DEFAULT_ASYMMETRY);
+	// the filters start out empty
+	mpx->mono_frames = UINT32_MAX;
+
+	if (init_osc(&mpx->mpx_osc, MPX_SAMPLE_RATE, carrier_frequencies) < 0 ||
+	    init_sub_osc(mpx, 0) < 0 ||
+	    init_audio_filters(mpx, &mpx->filters, QUALITY_STANDARD, mpx->stereo_mode) < 0) {
+		fm_mpx_exit(mpx);
+		return -1;
+	}
+
+	select_kernels(mpx);
+
+	return 0;
 }
 
 /*
@@ -205,13 +378,9 @@ void fm_mpx_init() {
  *
  * Might be removed in favor of the asymmetric DSB modulator below
  */
-static inline float get_ssb(float in, float in_delayed, float sin, float cos, uint8_t sideband) {
-	float ht;
+static inline float get_ssb(float in_delayed, float ht, float sin, float cos, uint8_t sideband) {
 	float inphase, quadrature;
 
-	// perform a 90 degree phase shift of all frequency components
-	ht = get_hilbert(&ssb_ht, in);
-
 	// I/Q components
 	inphase    = in_delayed * cos;
 	quadrature = ht * sin;
@@ -221,140 +390,672 @@ static inline float get_ssb(float in, float in_delayed, float sin, float cos, ui
 		inphase - quadrature;  // usb
 }
 
-/*
- * Asymmetric DSB configuration
- */
-struct {
-	float lsb_power;
-	float usb_power;
-} asym_dsb_config;
-
 /*
  * Asymmetric DSB modulator
  *
  * LSB/USB range: [-1,1]
- * 0 is symmetric
+ * 0 is symmetric, -1 is LSB only
  */
-static inline float get_asym_dsb(float in, float in_delayed, float sin, float cos) {
-	float ht;
+static inline float get_asym_dsb(struct fm_mpx_t *mpx, float in_delayed, float ht, float sin, float cos) {
 	float inphase, quadrature;
 
-	// perform a 90 degree phase shift of all frequency components
-	ht = get_hilbert(&ssb_ht, in);
-
 	// I/Q components
 	inphase    = in_delayed * cos;
 	quadrature = ht * sin;
 
-	return	(inphase + quadrature) * asym_dsb_config.lsb_power + // lsb
-		(inphase - quadrature) * asym_dsb_config.usb_power;  // usb
+	return	(inphase + quadrature) * mpx->asym_dsb_config.lsb_power + // lsb
+		(inphase - quadrature) * mpx->asym_dsb_config.usb_power;  // usb
 }
 
-void set_asym_dsb(float asymmetry) {
-	asym_dsb_config.lsb_power = fabsf(1.0 - asymmetry) / 2.0;
-	asym_dsb_config.usb_power = fabsf(1.0 + asymmetry) / 2.0;
+void set_asym_dsb(struct fm_mpx_t *mpx, float asymmetry) {
+	if (asymmetry < -1.0f) asymmetry = -1.0f;
+	if (asymmetry > 1.0f) asymmetry = 1.0f;
+	mpx->asym_dsb_config.lsb_power = (1.0f - asymmetry) / 2.0f;
+	mpx->asym_dsb_config.usb_power = (1.0f + asymmetry) / 2.0f;
 }
 
-void fm_mpx_get_samples(float *in, float *out) {
-	uint16_t j = 0;
+/*
+ * Share of the Hilbert transform in the stereo subcarrier of a stereo
+ * mode. The in-phase part always has a share of 1, as the two sideband
+ * powers add up to 1.
+ */
+static inline float quadrature_weight(struct fm_mpx_t *mpx, uint8_t stereo_mode) {
+	switch (stereo_mode) {
+	case STEREO_SSB:
+		return 1.0f;
+	case STEREO_ASYM_DSB:
+		return mpx->asym_dsb_config.lsb_power - mpx->asym_dsb_config.usb_power;
+	default:
+		return 0.0f;
+	}
+}
 
+/*
+ * MPX kernels
+ *
+ * The loops below are written once and inlined into a kernel for every
+ * configuration with the configuration as a constant, so the compiler
+ * drops the work (and the branches) a configuration does not need.
+ */
+#define KERNEL static inline __attribute__((always_inline))
+
+/*
+ * Runs a stereo sample through a set of audio filters
+ *
+ * Gives the sum and difference signals and, for SSB and asymmetric DSB,
+ * the Hilbert transform of the difference. The sum and difference are delayed to
+ * line up with it.
+ *
+ * For mono only the left channel is filtered. The rest of the filters
+ * still take their samples so they are ready when stereo comes back.
+ */
+KERNEL void filter_audio(struct audio_filters_t *f, float *in,
+	float *mono, float *stereo, float *quadrature,
+	const uint8_t stereo_mode, const uint8_t mono_only) {
 	float lowpass_filter_in[2];
 	float lowpass_filter_out[2];
 	float out_left, out_right;
-	float out_mono, out_stereo;
-	// delayed versions of the above for SSB filter
-	float out_left_delayed, out_right_delayed;
-	float out_mono_delayed, out_stereo_delayed;
-
-	for (int i = 0; i < NUM_MPX_FRAMES_IN; i++) {
-		lowpass_filter_in[0] = in[j+0];
-		lowpass_filter_in[1] = in[j+1];
-
-		// First store the current sample(s) into the FIR filter's ring buffer
-		fir_filter_add(&fir_low_pass, lowpass_filter_in);
-
-		// Now apply the FIR low-pass filter
-		fir_filter_apply(&fir_low_pass);
-
-		fir_filter_get(&fir_low_pass, lowpass_filter_out);
-
-		// L/R signals
-		out_left  = lowpass_filter_out[0];
-		out_right = lowpass_filter_out[1];
-		out_left_delayed  = delay_line(&left_delay, out_left);
-		out_right_delayed = delay_line(&right_delay, out_right);
-
-		// Create sum and difference signals
-		out_mono   = out_left + out_right;
-		out_stereo = out_left - out_right;
-		out_mono_delayed   = out_left_delayed + out_right_delayed;
-		out_stereo_delayed = out_left_delayed - out_right_delayed;
-
-		// clear old buffer
-		out[j] = 0.0f;
-
-		if (1) { // SSB mode
-			// delay mono so it is in sync with stereo
-			out[j] += out_mono_delayed * 0.45 +
-				get_wave(&mpx_osc, CARRIER_19K, 1) * volumes[0];
-
-			out[j] +=
-				get_ssb(out_stereo,
-					out_stereo_delayed,
-					get_wave(&mpx_osc, CARRIER_38K, 0),
-					get_wave(&mpx_osc, CARRIER_38K, 1),
+
+	if (f->pad[0].delay > 1) {
+		lowpass_filter_in[0] = delay_line(&f->pad[0], in[0]);
+		lowpass_filter_in[1] = delay_line(&f->pad[1], in[1]);
+	} else {
+		lowpass_filter_in[0] = in[0];
+		lowpass_filter_in[1] = in[1];
+	}
+
+	// First store the current sample(s) into the FIR filter's ring buffer
+	fir_filter_add(&f->low_pass, lowpass_filter_in);
+
+	// Now apply the FIR low-pass filter
+	if (mono_only) {
+		fir_filter_apply_mono(&f->low_pass);
+	} else {
+		fir_filter_apply(&f->low_pass);
+	}
+
+	fir_filter_get(&f->low_pass, lowpass_filter_out);
+
+	// L/R signals
+	out_left  = lowpass_filter_out[0];
+	out_right = lowpass_filter_out[1];
+
+	if (stereo_mode != STEREO_DSB) {
+		// perform a 90 degree phase shift of all frequency components
+		if (mono_only) {
+			put_hilbert(&f->ssb_ht, 0.0f);
+		} else {
+			*quadrature = get_hilbert(&f->ssb_ht, out_left - out_right);
+		}
+
+		out_left  = delay_line(&f->left_delay, out_left);
+		out_right = delay_line(&f->right_delay, out_right);
+	}
+
+	// Create sum and difference signals
+	*mono   = out_left + out_right;
+	*stereo = out_left - out_right;
+}
+
+// share of the new filters in the output during a change
+static inline float get_change_fade(struct fm_mpx_t *mpx, size_t i) {
+	uint32_t pos = mpx->change_pos + i;
+
+	if (pos < mpx->change_warmup) return 0.0f;
+	pos -= mpx->change_warmup;
+	return pos < QUALITY_FADE_FRAMES ? (float)pos / QUALITY_FADE_FRAMES : 1.0f;
+}
+
+/*
+ * Generates the audio part of a block of MPX (mono, pilot and stereo)
+ * from stereo audio, or only mono and pilot from mono audio
+ *
+ * During a change the new filters may be for another stereo mode. The
+ * Hilbert transforms are then weighted for their mode and the faded
+ * signals are put on the subcarrier as for SSB.
+ */
+KERNEL void get_audio(struct fm_mpx_t *mpx, float *in, float *out, size_t frames,
+	const uint8_t stereo_mode, const uint8_t changing, const uint8_t mono_only) {
+	struct osc_t *mpx_osc = &mpx->mpx_osc;
+	float *volumes = mpx->volumes;
+	size_t j = 0;
+
+	float mono, stereo, quadrature = 0.0f;
+	// from the new filters during a change
+	float next_mono, next_stereo, next_quadrature = 0.0f;
+	uint8_t next_stereo_mode = mpx->next_filters.stereo_mode;
+	float weight = quadrature_weight(mpx, stereo_mode);
+	float next_weight = quadrature_weight(mpx, next_stereo_mode);
+	float fade;
+
+	for (size_t i = 0; i < frames; i++) {
+		filter_audio(&mpx->filters, in + j, &mono, &stereo, &quadrature,
+			stereo_mode, mono_only);
+
+		if (changing) {
+			filter_audio(&mpx->next_filters, in + j,
+				&next_mono, &next_stereo, &next_quadrature, next_stereo_mode, 0);
+			fade = get_change_fade(mpx, i);
+			mono += (next_mono - mono) * fade;
+			stereo += (next_stereo - stereo) * fade;
+			quadrature *= weight;
+			quadrature += (next_quadrature * next_weight - quadrature) * fade;
+
+			out[i] = mono * 0.45 +
+				get_wave(mpx_osc, CARRIER_19K, 1) * volumes[0];
+
+			out[i] +=
+				get_ssb(stereo, quadrature,
+					get_wave(mpx_osc, CARRIER_38K, 0),
+					get_wave(mpx_osc, CARRIER_38K, 1),
 					0 /* LSB */) * 0.45;
+		} else if (mono_only) {
+			out[i] = mono * 0.45 +
+				get_wave(mpx_osc, CARRIER_19K, 1) * volumes[0];
+		} else if (stereo_mode == STEREO_SSB) {
+			// mono is delayed so it is in sync with stereo
+			out[i] = mono * 0.45 +
+				get_wave(mpx_osc, CARRIER_19K, 1) * volumes[0];
 
+			out[i] +=
+				get_ssb(stereo, quadrature,
+					get_wave(mpx_osc, CARRIER_38K, 0),
+					get_wave(mpx_osc, CARRIER_38K, 1),
+					0 /* LSB */) * 0.45;
+		} else if (stereo_mode == STEREO_ASYM_DSB) {
+			out[i] = mono * 0.45 +
+				get_wave(mpx_osc, CARRIER_19K, 1) * volumes[0];
+
+			out[i] +=
+				get_asym_dsb(mpx, stereo, quadrature,
+					get_wave(mpx_osc, CARRIER_38K, 0),
+					get_wave(mpx_osc, CARRIER_38K, 1)) * 0.45;
 		} else {
 			// audio signals need to be limited to 45% to remain within modulation limits
-			out[j] += out_mono * 0.45 +
-				get_wave(&mpx_osc, CARRIER_19K, 1) * volumes[0] +
-				get_wave(&mpx_osc, CARRIER_38K, 1) * out_stereo * 0.45;
+			out[i] = mono * 0.45 +
+				get_wave(mpx_osc, CARRIER_19K, 1) * volumes[0] +
+				get_wave(mpx_osc, CARRIER_38K, 1) * stereo * 0.45;
 		}
 
-		out[j] += get_wave(&mpx_osc, CARRIER_57K, 1) * get_rds_sample(0) * volumes[1];
-#ifdef RDS2
-		out[j] += get_wave(&mpx_osc, CARRIER_67K, 1) * get_rds_sample(1) * volumes[2];
-		out[j] += get_wave(&mpx_osc, CARRIER_71K, 1) * get_rds_sample(2) * volumes[3];
-		out[j] += get_wave(&mpx_osc, CARRIER_76K, 1) * get_rds_sample(3) * volumes[4];
-#endif
-
-		update_osc_phase(&mpx_osc);
+		update_osc_phase(mpx_osc);
 
-		out[j] *= mpx_vol;
-		out[j+1] = out[j];
 		j += 2;
 	}
 }
 
-void fm_rds_get_samples(float *out) {
-	uint16_t j = 0;
+/*
+ * Switches to the new filters once the fade is over. The old ones are
+ * left for finish_change to free.
+ */
+static void update_change(struct fm_mpx_t *mpx, size_t frames) {
+	mpx->change_pos += frames;
+	if (mpx->change_pos < mpx->change_warmup + QUALITY_FADE_FRAMES) return;
 
-	for (int i = 0; i < NUM_MPX_FRAMES_IN; i++) {
-		out[j] = 0.0f;
+	mpx->old_filters = mpx->filters;
+	mpx->filters = mpx->next_filters;
+	memset(&mpx->next_filters, 0, sizeof(struct audio_filters_t));
+	mpx->stereo_mode = mpx->filters.stereo_mode;
+	mpx->changing = 0;
+	select_audio_kernel(mpx);
+	__atomic_store_n(&mpx->change_state, CHANGE_DONE, __ATOMIC_RELEASE);
+}
 
-		// Pilot tone for calibration
-		out[j] += get_wave(&mpx_osc, CARRIER_19K, 1) * volumes[0];
+/*
+ * Tells if the stereo part of the encoder can be skipped for a block:
+ * there is no stereo difference in it and none left in the filters.
+ * The fixed-point kernels use it too.
+ */
+uint8_t is_mono_block(struct fm_mpx_t *mpx, float *in, size_t frames) {
+	uint32_t mono_frames = mpx->mono_frames;
+	size_t i = frames;
 
-		//out[j] += get_wave(&mpx_osc, CARRIER_57K, 1) * get_rds_sample(0) * volumes[1];
-#ifdef RDS2
-		out[j] += get_wave(&mpx_osc, CARRIER_67K, 1) * get_rds_sample(1) * volumes[2];
-		out[j] += get_wave(&mpx_osc, CARRIER_71K, 1) * get_rds_sample(2) * volumes[3];
-		out[j] += get_wave(&mpx_osc, CARRIER_76K, 1) * get_rds_sample(3) * volumes[4];
-#endif
+	// from the end, as stereo is usually found right away
+	while (i && fabsf(in[2*i-2] - in[2*i-1]) <= MONO_THRESHOLD) i--;
 
-		update_osc_phase(&mpx_osc);
+	if (i) {
+		mpx->mono_frames = frames - i;
+		return 0;
+	}
 
-		out[j] *= mpx_vol;
-		out[j+1] = out[j];
-		j += 2;
+	if (mono_frames < UINT32_MAX - frames) mpx->mono_frames += frames;
+	return mono_frames >= audio_filters_span(&mpx->filters);
+}
+
+static void audio_ssb(struct fm_mpx_t *mpx, float *in, float *out, size_t frames) {
+	if (is_mono_block(mpx, in, frames)) {
+		get_audio(mpx, in, out, frames, STEREO_SSB, 0, 1);
+	} else {
+		get_audio(mpx, in, out, frames, STEREO_SSB, 0, 0);
 	}
 }
 
-void fm_mpx_exit() {
-	exit_hilbert_transformer(&ssb_ht);
-	exit_osc(&mpx_osc);
-	exit_fir_filter(&fir_low_pass);
-	exit_delay_line(&left_delay);
-	exit_delay_line(&right_delay);
+static void audio_dsb(struct fm_mpx_t *mpx, float *in, float *out, size_t frames) {
+	if (is_mono_block(mpx, in, frames)) {
+		get_audio(mpx, in, out, frames, STEREO_DSB, 0, 1);
+	} else {
+		get_audio(mpx, in, out, frames, STEREO_DSB, 0, 0);
+	}
+}
+
+static void audio_asym(struct fm_mpx_t *mpx, float *in, float *out, size_t frames) {
+	if (is_mono_block(mpx, in, frames)) {
+		get_audio(mpx, in, out, frames, STEREO_ASYM_DSB, 0, 1);
+	} else {
+		get_audio(mpx, in, out, frames, STEREO_ASYM_DSB, 0, 0);
+	}
+}
+
+// both sets of filters run in full during a change
+static void audio_ssb_change(struct fm_mpx_t *mpx, float *in, float *out, size_t frames) {
+	is_mono_block(mpx, in, frames);
+	get_audio(mpx, in, out, frames, STEREO_SSB, 1, 0);
+	update_change(mpx, frames);
+}
+
+static void audio_dsb_change(struct fm_mpx_t *mpx, float *in, float *out, size_t frames) {
+	is_mono_block(mpx, in, frames);
+	get_audio(mpx, in, out, frames, STEREO_DSB, 1, 0);
+	update_change(mpx, frames);
+}
+
+static void audio_asym_change(struct fm_mpx_t *mpx, float *in, float *out, size_t frames) {
+	is_mono_block(mpx, in, frames);
+	get_audio(mpx, in, out, frames, STEREO_ASYM_DSB, 1, 0);
+	update_change(mpx, frames);
+}
+
+/*
+ * Adds the RDS subcarrier and the first rds2_streams RDS2 subcarriers
+ * to a block
+ */
+KERNEL void add_subcarriers(struct fm_mpx_t *mpx, float *out, size_t frames,
+	const uint8_t rds2_streams) {
+	struct osc_t *sub_osc = &mpx->sub_osc;
+	struct rds_encoder_t *rds = &mpx->rds;
+	float *volumes = mpx->volumes;
+	float sub;
+
+	for (size_t i = 0; i < frames; i++) {
+		sub = get_wave(sub_osc, CARRIER_57K, 1) * get_rds_sample(rds, 0) * volumes[1];
+		if (rds2_streams > 0)
+			sub += get_wave(sub_osc, CARRIER_67K, 1) * get_rds_sample(rds, 1) * volumes[2];
+		if (rds2_streams > 1)
+			sub += get_wave(sub_osc, CARRIER_71K, 1) * get_rds_sample(rds, 2) * volumes[3];
+		if (rds2_streams > 2)
+			sub += get_wave(sub_osc, CARRIER_76K, 1) * get_rds_sample(rds, 3) * volumes[4];
+
+		update_osc_phase(sub_osc);
+
+		out[i] += sub;
+	}
+}
+
+// RDS switched off and no RDS2
+static void sub_none(struct fm_mpx_t *mpx, float *out, size_t frames) {
+	(void)mpx;
+	(void)out;
+	(void)frames;
+}
+
+static void sub_rds(struct fm_mpx_t *mpx, float *out, size_t frames) {
+	add_subcarriers(mpx, out, frames, 0);
+}
+
+static void sub_rds2_1(struct fm_mpx_t *mpx, float *out, size_t frames) {
+	add_subcarriers(mpx, out, frames, 1);
+}
+
+static void sub_rds2_2(struct fm_mpx_t *mpx, float *out, size_t frames) {
+	add_subcarriers(mpx, out, frames, 2);
+}
+
+static void sub_rds2_3(struct fm_mpx_t *mpx, float *out, size_t frames) {
+	add_subcarriers(mpx, out, frames, 3);
+}
+
+static void select_audio_kernel(struct fm_mpx_t *mpx) {
+	// in stereo mode order
+	static void (*const audio_kernels[])(struct fm_mpx_t *, float *, float *, size_t) = {
+		audio_ssb, audio_dsb, audio_asym
+	};
+	static void (*const change_kernels[])(struct fm_mpx_t *, float *, float *, size_t) = {
+		audio_ssb_change, audio_dsb_change, audio_asym_change
+	};
+
+	if (mpx->q15 != NULL) {
+		select_q15_audio_kernel(mpx);
+	} else if (mpx->changing) {
+		mpx->audio_kernel = change_kernels[mpx->stereo_mode];
+	} else {
+		mpx->audio_kernel = audio_kernels[mpx->stereo_mode];
+	}
+}
+
+static void select_sub_kernel(struct fm_mpx_t *mpx) {
+	static void (*const sub_kernels[])(struct fm_mpx_t *, float *, size_t) = {
+		sub_rds, sub_rds2_1, sub_rds2_2, sub_rds2_3
+	};
+
+	if (!mpx->rds2_streams && mpx->volumes[1] == 0.0f) {
+		mpx->sub_kernel = sub_none;
+	} else if (mpx->q15 != NULL) {
+		select_q15_sub_kernel(mpx);
+	} else {
+		mpx->sub_kernel = sub_kernels[mpx->rds2_streams];
+	}
+}
+
+static void select_kernels(struct fm_mpx_t *mpx) {
+	select_audio_kernel(mpx);
+	select_sub_kernel(mpx);
+}
+
+/*
+ * Sets the number of RDS2 streams to generate. Must be called before
+ * the first block so the subcarriers stay aligned with the pilot.
+ */
+int8_t set_rds2_streams(struct fm_mpx_t *mpx, uint8_t streams) {
+	if (streams > MAX_RDS2_STREAMS) {
+		fprintf(stderr, "Error: there can be at most %u RDS2 streams.\n",
+			MAX_RDS2_STREAMS);
+		return -1;
+	}
+
+	if (init_sub_osc(mpx, streams) < 0) return -1;
+	if (mpx->q15 != NULL) init_mpx_q15_subcarriers(mpx);
+	select_kernels(mpx);
+
+	return 0;
+}
+
+/*
+ * Switches the encoder between the float and the fixed-point (Q15)
+ * kernels. Must be called before the first block, as the RDS sample
+ * buffers are cleared.
+ */
+int8_t set_fixed_point(struct fm_mpx_t *mpx, uint8_t fixed_point) {
+	if (fixed_point && mpx->q15 == NULL) {
+		if (init_mpx_q15(mpx) < 0) return -1;
+	} else if (!fixed_point) {
+		exit_mpx_q15(mpx);
+	}
+
+	for (uint8_t s = 0; s <= MAX_RDS2_STREAMS; s++) {
+		memset(&mpx->rds.streams[s].sample_buffer, 0,
+			sizeof(mpx->rds.streams[s].sample_buffer));
+	}
+	select_kernels(mpx);
+
+	return 0;
+}
+
+int8_t parse_quality(char *name) {
+	for (uint8_t i = 0; i < NUM_QUALITY_TIERS; i++) {
+		if (!strcasecmp(name, quality_tiers[i].name)) return i;
+	}
+	return -1;
+}
+
+char *get_quality_name(uint8_t quality) {
+	return quality_tiers[quality].name;
+}
+
+// sets up new filters in place of the current ones
+static int8_t replace_audio_filters(struct fm_mpx_t *mpx, uint8_t quality, uint8_t stereo_mode) {
+	struct audio_filters_t filters;
+
+	if (init_audio_filters(mpx, &filters, quality, stereo_mode) < 0) return -1;
+
+	exit_audio_filters(&mpx->filters);
+	mpx->filters = filters;
+	mpx->stereo_mode = stereo_mode;
+
+	// the fixed-point filters are made from the float ones
+	if (mpx->q15 != NULL) {
+		exit_mpx_q15(mpx);
+		return set_fixed_point(mpx, 1);
+	}
+	select_kernels(mpx);
+
+	return 0;
+}
+
+/*
+ * Sets the quality tier of the filters. Must be called before the
+ * first block, as the new filters start out empty.
+ */
+int8_t set_quality(struct fm_mpx_t *mpx, uint8_t quality) {
+	if (quality == mpx->filters.quality) return 0;
+	return replace_audio_filters(mpx, quality, mpx->stereo_mode);
+}
+
+int8_t parse_stereo_mode(char *name) {
+	for (uint8_t i = 0; i < NUM_STEREO_MODES; i++) {
+		if (!strcasecmp(name, stereo_mode_names[i])) return i;
+	}
+	return -1;
+}
+
+/*
+ * Sets the stereo mode. Must be called before the first block (and
+ * before allow_quality_changes), use change_stereo_mode after that.
+ */
+int8_t set_stereo_mode(struct fm_mpx_t *mpx, uint8_t stereo_mode) {
+	if (stereo_mode == mpx->stereo_mode) return 0;
+	return replace_audio_filters(mpx, mpx->filters.quality, stereo_mode);
+}
+
+/*
+ * Lets the quality be changed while the encoder runs. The lower tiers
+ * get an extra delay to line up with the current one, so a change is
+ * a short fade between two copies of the same audio. The current tier
+ * is the highest one that can be changed to.
+ */
+int8_t allow_quality_changes(struct fm_mpx_t *mpx) {
+	int32_t ht_delay;
+
+	if (mpx->q15 != NULL) {
+		fprintf(stderr, "Error: the quality of the fixed-point encoder can not be changed.\n");
+		return -1;
+	}
+
+	// as DSB filters have no transformer
+	ht_delay = get_hilbert_delay(mpx->filters.quality);
+	if (ht_delay < 0) return -1;
+	mpx->aligned_delay = (mpx->filters.low_pass.size - 1) / 2;
+	mpx->aligned_ht_delay = ht_delay;
+
+	return 0;
+}
+
+// frees the old filters once a change is over, change_mutex held
+static void collect_change(struct fm_mpx_t *mpx) {
+	if (__atomic_load_n(&mpx->change_state, __ATOMIC_ACQUIRE) != CHANGE_DONE) return;
+
+	exit_audio_filters(&mpx->old_filters);
+	memset(&mpx->old_filters, 0, sizeof(struct audio_filters_t));
+	__atomic_store_n(&mpx->change_state, CHANGE_IDLE, __ATOMIC_RELAXED);
+}
+
+/*
+ * Sets up a change to other filters and hands it to the thread
+ * generating the MPX, which starts it at its next block
+ *
+ * The new filters are allocated here, on the thread asking for the
+ * change. Returns -1 if they can not be set up or another change is
+ * still going on.
+ */
+static int8_t start_change(struct fm_mpx_t *mpx, int8_t quality, int8_t stereo_mode) {
+	struct audio_filters_t *f = &mpx->next_filters;
+	int8_t r = -1;
+
+	pthread_mutex_lock(&change_mutex);
+	collect_change(mpx);
+	if (__atomic_load_n(&mpx->change_state, __ATOMIC_RELAXED) != CHANGE_IDLE) goto exit;
+
+	// the current filters are not swapped while no change is going on
+	if (quality < 0) quality = mpx->filters.quality;
+	if (stereo_mode < 0) stereo_mode = mpx->filters.stereo_mode;
+	if (quality == mpx->filters.quality && stereo_mode == mpx->filters.stereo_mode) {
+		r = 0;
+		goto exit;
+	}
+
+	if (init_audio_filters(mpx, f, quality, stereo_mode) < 0) goto exit;
+
+	// until every delay and filter history is full of new audio
+	mpx->change_warmup = audio_filters_span(f);
+	__atomic_store_n(&mpx->change_state, CHANGE_READY, __ATOMIC_RELEASE);
+	r = 0;
+
+exit:
+	pthread_mutex_unlock(&change_mutex);
+	return r;
+}
+
+/*
+ * Frees what is left of the last change once it is over. Called now and
+ * then by a thread other than the one generating the MPX, as that one
+ * does not free anything. It is done by the next change otherwise.
+ */
+void finish_change(struct fm_mpx_t *mpx) {
+	if (__atomic_load_n(&mpx->change_state, __ATOMIC_ACQUIRE) != CHANGE_DONE) return;
+
+	pthread_mutex_lock(&change_mutex);
+	collect_change(mpx);
+	pthread_mutex_unlock(&change_mutex);
+}
+
+/*
+ * Starts a change to another quality tier. Returns -1 if the change
+ * can not be made (or another one is still going on).
+ */
+int8_t change_quality(struct fm_mpx_t *mpx, uint8_t quality) {
+	if (!mpx->aligned_delay || quality >= NUM_QUALITY_TIERS) return -1;
+
+	return start_change(mpx, quality, -1);
+}
+
+/*
+ * Changes the stereo mode while the encoder runs, with a fade like a
+ * quality change. Safe to call from other threads. Returns -1 if
+ * another change is still going on.
+ *
+ * The fixed-point encoder can only have its stereo mode set before it
+ * starts.
+ */
+int8_t change_stereo_mode(struct fm_mpx_t *mpx, uint8_t stereo_mode) {
+	if (stereo_mode >= NUM_STEREO_MODES || mpx->q15 != NULL) return -1;
+
+	return start_change(mpx, -1, stereo_mode);
+}
+
+// picks up a change set up by another thread
+static inline void update_change_state(struct fm_mpx_t *mpx) {
+	if (mpx->changing ||
+	    __atomic_load_n(&mpx->change_state, __ATOMIC_ACQUIRE) != CHANGE_READY) return;
+
+	mpx->change_pos = 0;
+	mpx->changing = 1;
+	__atomic_store_n(&mpx->change_state, CHANGE_FADING, __ATOMIC_RELAXED);
+	select_audio_kernel(mpx);
+}
+
+// picks the subcarrier kernel again after a carrier volume change
+static inline void update_sub_kernel(struct fm_mpx_t *mpx) {
+	if (!__atomic_exchange_n(&mpx->volumes_changed, 0, __ATOMIC_ACQUIRE)) return;
+	select_sub_kernel(mpx);
+}
+
+/*
+ * Generates the audio part of a block of MPX (mono, pilot and stereo)
+ * from stereo audio. The output is mono and has not been scaled by
+ * the output volume yet.
+ */
+void fm_mpx_get_audio(struct fm_mpx_t *mpx, float *in, float *out, size_t frames) {
+	update_change_state(mpx);
+	mpx->audio_kernel(mpx, in, out, frames);
+}
+
+/*
+ * Generates the RDS (and RDS2) subcarriers for a block of MPX
+ */
+void fm_mpx_get_subcarriers(struct fm_mpx_t *mpx, float *out, size_t frames) {
+	update_sub_kernel(mpx);
+	memset(out, 0, frames * sizeof(float));
+	mpx->sub_kernel(mpx, out, frames);
+}
+
+/*
+ * Adds separately generated subcarriers to the audio part of a block
+ */
+void fm_mpx_mix(float *out, float *sub, size_t frames) {
+	for (size_t i = 0; i < frames; i++) {
+		out[i] += sub[i];
+	}
+}
+
+/*
+ * Generates a block of MPX from stereo audio. The output is mono and
+ * has not been scaled by the output volume yet.
+ */
+void fm_mpx_get_samples(struct fm_mpx_t *mpx, float *in, float *out, size_t frames) {
+	update_change_state(mpx);
+	update_sub_kernel(mpx);
+	mpx->audio_kernel(mpx, in, out, frames);
+	mpx->sub_kernel(mpx, out, frames);
+}
+
+void fm_rds_get_samples(struct fm_mpx_t *mpx, float *out, size_t frames) {
+	struct osc_t *mpx_osc = &mpx->mpx_osc;
+	struct osc_t *sub_osc = &mpx->sub_osc;
+	float *volumes = mpx->volumes;
+
+	if (mpx->q15 != NULL) {
+		get_rds_samples_q15(mpx, out, frames);
+		return;
+	}
+
+	for (size_t i = 0; i < frames; i++) {
+		out[i] = 0.0f;
+
+		// Pilot tone for calibration
+		out[i] += get_wave(mpx_osc, CARRIER_19K, 1) * volumes[0];
+
+		//out[i] += get_wave(sub_osc, CARRIER_57K, 1) * get_rds_sample(&mpx->rds, 0) * volumes[1];
+		for (uint8_t s = 1; s <= mpx->rds2_streams; s++) {
+			out[i] += get_wave(sub_osc, s, 1) * get_rds_sample(&mpx->rds, s) * volumes[s+1];
+		}
+
+		update_osc_phase(mpx_osc);
+		update_osc_phase(sub_osc);
+	}
+}
+
+void fm_mpx_exit(struct fm_mpx_t *mpx) {
+	exit_mpx_q15(mpx);
+	exit_audio_filters(&mpx->filters);
+	switch (mpx->change_state) {
+	case CHANGE_READY:
+	case CHANGE_FADING:
+		exit_audio_filters(&mpx->next_filters);
+		break;
+	case CHANGE_DONE:
+		exit_audio_filters(&mpx->old_filters);
+		break;
+	}
+	mpx->change_state = CHANGE_IDLE;
+	mpx->changing = 0;
+	exit_osc(&mpx->mpx_osc);
+	exit_osc(&mpx->sub_osc);
+
+	pthread_mutex_lock(&coeffs_mutex);
+	if (encoder_count && --encoder_count == 0) {
+		for (uint8_t i = 0; i < NUM_QUALITY_TIERS; i++) {
+			if (!low_pass_designs[i].shared) free(low_pass_designs[i].coeffs);
+			low_pass_designs[i].coeffs = NULL;
+		}
+		exit_symbol_waveforms();
+	}
+	pthread_mutex_unlock(&coeffs_mutex);
 }
@@ -16,19 +16,53 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-// Audio in
-#define NUM_AUDIO_FRAMES_IN	512
-#define NUM_AUDIO_FRAMES_OUT	(NUM_AUDIO_FRAMES_IN * 8)
+// Block size (frames at the MPX sample rate)
+#define DEFAULT_BLOCK_SIZE	4096
+#define MIN_BLOCK_SIZE		128
+#define MAX_BLOCK_SIZE		65536
 
-// MPX
-#define NUM_MPX_FRAMES_IN	NUM_AUDIO_FRAMES_OUT
-#define NUM_MPX_FRAMES_OUT	(NUM_MPX_FRAMES_IN * 2)
+// audio is read from the input in blocks of this fraction of a block
+#define INPUT_BLOCK_DIVIDER	8
 
 // The sample rate at which the MPX generation runs at
 #define MPX_SAMPLE_RATE		190000
 
 #define OUTPUT_SAMPLE_RATE	192000
 
+#include "rds.h"
+#include "mpx_carriers.h"
+#include "ssb.h"
+
+// how the stereo difference signal is put on the 38 kHz carrier
+enum stereo_modes {
+	STEREO_SSB, // lower sideband only
+	STEREO_DSB,
+	STEREO_ASYM_DSB // both sidebands, the lower one louder
+};
+#define NUM_STEREO_MODES	3
+
+// asymmetric DSB: lower sideband at 75%, upper at 25%
+#define DEFAULT_ASYMMETRY	-0.5f
+
+// RDS2 data streams on top of the main RDS stream
+#define MAX_RDS2_STREAMS	3
+
+// filter quality tiers, cheapest first
+enum quality_tiers {
+	QUALITY_LOW,
+	QUALITY_STANDARD,
+	QUALITY_REFERENCE
+};
+#define NUM_QUALITY_TIERS	3
+
+// where a quality or stereo mode change is at
+enum change_states {
+	CHANGE_IDLE,
+	CHANGE_READY, // new filters set up, not picked up yet
+	CHANGE_FADING,
+	CHANGE_DONE // old filters left to be freed
+};
+
 /*
  * 2-channel FIR filter struct
  *
@@ -37,10 +71,10 @@ typedef struct filter_t {
 	uint32_t sample_rate;
 	uint16_t index;
 	uint16_t size;
-	uint16_t half_size;
+	// the last size samples, twice over
 	float *in[2];
 
-	// coefficients of the low-pass FIR filter
+	// coefficients of the low-pass FIR filter (all of them)
 	float *filter;
 
 	float out[2];
@@ -56,9 +90,135 @@ typedef struct delay_line_t {
 	uint32_t idx;
 } delay_line_t;
 
-extern void fm_mpx_init();
-extern void fm_mpx_get_samples(float *in, float *out);
-extern void fm_rds_get_samples(float *out);
-extern void fm_mpx_exit();
-extern void set_output_volume(uint8_t vol);
-extern void set_carrier_volume(uint8_t carrier, uint8_t new_volume);
+/*
+ * Audio filters
+ *
+ * Everything whose length depends on the quality tier. A tier change
+ * builds a second set and fades over to it.
+ */
+typedef struct audio_filters_t {
+	uint8_t quality;
+	// DSB sets have no Hilbert transformer
+	uint8_t stereo_mode;
+
+	// input delay that lines the tier up with the others, if needed
+	struct delay_line_t pad[2];
+
+	// audio low-pass filter
+	struct filter_t low_pass;
+
+	// Hilbert transformer for SSB
+	struct hilbert_fir_t ssb_ht;
+
+	// delay buffers for hilbert transform
+	struct delay_line_t left_delay;
+	struct delay_line_t right_delay;
+} audio_filters_t;
+
+/*
+ * MPX encoder state
+ *
+ * One of these is kept for every station. The carrier tables, filter
+ * coefficients and RDS symbol waveforms are shared by all of them.
+ */
+typedef struct fm_mpx_t {
+	struct audio_filters_t filters;
+
+	/*
+	 * Quality or stereo mode change in progress
+	 *
+	 * The thread asking for the change sets up the new filters and
+	 * hands them over through change_state. They run alongside the
+	 * old ones until they have filled up, then the output fades over
+	 * to them and the old ones are handed back to be freed, so the
+	 * thread generating the MPX never allocates or frees.
+	 */
+	struct audio_filters_t next_filters;
+	struct audio_filters_t old_filters;
+	uint8_t change_state;
+	// fading, only looked at by the thread generating the MPX
+	uint8_t changing;
+	uint32_t change_pos;
+	uint32_t change_warmup;
+	/*
+	 * Low-pass and Hilbert transformer delays every tier is padded
+	 * to, 0 if the quality is fixed
+	 */
+	uint32_t aligned_delay;
+	uint32_t aligned_ht_delay;
+
+	/*
+	 * Input frames since the last one with a stereo difference
+	 *
+	 * Once the filters hold nothing else the stereo part of the
+	 * encoder is skipped until the difference comes back.
+	 */
+	uint32_t mono_frames;
+
+	// pilot and stereo carriers
+	struct osc_t mpx_osc;
+
+	/*
+	 * Subcarrier oscillator
+	 *
+	 * Kept apart from the one above so the subcarriers can be
+	 * generated on another thread. Both start at phase 0 on the
+	 * first sample, so they stay sample aligned as long as they are
+	 * run for the same number of frames.
+	 */
+	struct osc_t sub_osc;
+
+	// subcarrier volumes
+	float volumes[5];
+	// set by set_carrier_volume (from any thread), the subcarrier kernel is picked again
+	uint8_t volumes_changed;
+	float mpx_vol;
+
+	// asymmetric DSB configuration
+	struct {
+		float lsb_power;
+		float usb_power;
+	} asym_dsb_config;
+
+	uint8_t stereo_mode;
+	uint8_t rds2_streams;
+
+	/*
+	 * Kernels for the current configuration
+	 *
+	 * Each one is a copy of the MPX loop with only the work one
+	 * configuration needs. They are picked again whenever the
+	 * configuration changes.
+	 */
+	void (*audio_kernel)(struct fm_mpx_t *mpx, float *in, float *out, size_t frames);
+	void (*sub_kernel)(struct fm_mpx_t *mpx, float *out, size_t frames);
+
+	// fixed-point state, NULL on the float path
+	struct mpx_q15_t *q15;
+
+	struct rds_encoder_t rds;
+} fm_mpx_t;
+
+extern int8_t fm_mpx_init(struct fm_mpx_t *mpx);
+extern void fm_mpx_get_audio(struct fm_mpx_t *mpx, float *in, float *out, size_t frames);
+extern void fm_mpx_get_subcarriers(struct fm_mpx_t *mpx, float *out, size_t frames);
+extern void fm_mpx_mix(float *out, float *sub, size_t frames);
+extern void fm_mpx_get_samples(struct fm_mpx_t *mpx, float *in, float *out, size_t frames);
+extern void fm_rds_get_samples(struct fm_mpx_t *mpx, float *out, size_t frames);
+extern void fm_mpx_exit(struct fm_mpx_t *mpx);
+extern uint8_t is_mono_block(struct fm_mpx_t *mpx, float *in, size_t frames);
+extern void set_output_volume(struct fm_mpx_t *mpx, uint8_t vol);
+extern float get_output_volume(struct fm_mpx_t *mpx);
+extern void set_carrier_volume(struct fm_mpx_t *mpx, uint8_t carrier, uint8_t new_volume);
+extern int8_t set_rds2_streams(struct fm_mpx_t *mpx, uint8_t streams);
+extern void set_asym_dsb(struct fm_mpx_t *mpx, float asymmetry);
+extern int8_t parse_stereo_mode(char *name);
+extern int8_t set_stereo_mode(struct fm_mpx_t *mpx, uint8_t stereo_mode);
+extern int8_t change_stereo_mode(struct fm_mpx_t *mpx, uint8_t stereo_mode);
+extern int8_t set_fixed_point(struct fm_mpx_t *mpx, uint8_t fixed_point);
+extern int8_t parse_quality(char *name);
+extern char *get_quality_name(uint8_t quality);
+extern int8_t set_quality(struct fm_mpx_t *mpx, uint8_t quality);
+extern int8_t allow_quality_changes(struct fm_mpx_t *mpx);
+extern int8_t change_quality(struct fm_mpx_t *mpx, uint8_t quality);
+extern void finish_change(struct fm_mpx_t *mpx);
@@ -0,0 +1,398 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+
+#include "fm_mpx.h"
+#include "fm_mpx_q15.h"
+#include "dsp_kernels.h"
+#include "rds_modulator.h"
+
+/*
+ * Fixed-point MPX kernels
+ *
+ * The same MPX as the float kernels in fm_mpx.c, worked out with Q15
+ * samples and 32-bit sums for CPUs with a slow FPU. Only the encoder
+ * core is fixed-point: audio is converted to Q15 on the way in and the
+ * MPX back to float on the way out, as the resamplers and the sample
+ * conversion around the encoder are float.
+ *
+ * The stereo difference is halved so it fits in 16 bits and the gain
+ * it is mixed in at is doubled to make up for it.
+ */
+
+// 0.45 and 0.9 in Q15
+#define MONO_GAIN	14746
+#define STEREO_GAIN	29491
+
+static inline int16_t sat_q15(int32_t x) {
+	if (x > INT16_MAX) return INT16_MAX;
+	if (x < INT16_MIN) return INT16_MIN;
+	return x;
+}
+
+static inline int16_t float_to_q15(float x) {
+	if (x >= 1.0f) return INT16_MAX;
+	if (x <= -1.0f) return INT16_MIN;
+	x *= 32768.0f;
+	return (int16_t)(x < 0.0f ? x - 0.5f : x + 0.5f);
+}
+
+// rounded product of two Q15 values, either of which may be above 1.0
+static inline int32_t mul_q15(int32_t a, int32_t b) {
+	return (int32_t)(((int64_t)a * b + 0x4000) >> 15);
+}
+
+static inline int32_t round_shift(int32_t x, uint8_t shift) {
+	return (x + (1 << shift >> 1)) >> shift;
+}
+
+static inline int32_t volume_q15(float volume) {
+	return (int32_t)(volume * 32768.0f + 0.5f);
+}
+
+/*
+ * Scales a float design to Q15 taps, with the largest shift at which
+ * no tap and no sum of a full scale input can overflow
+ */
+static uint8_t design_q15_taps(const float *coeffs, float scale, uint16_t size, int16_t *taps) {
+	double peak = 0.0, sum = 0.0, c;
+	uint8_t shift = 0;
+
+	for (uint16_t i = 0; i < size; i++) {
+		c = fabs(coeffs[i] * (double)scale);
+		if (c > peak) peak = c;
+		sum += c;
+	}
+
+	// leave room for the rounding of every tap
+	while (shift < 30 &&
+	       peak * (double)(1 << (shift + 1)) < 32767.0 &&
+	       sum * (double)(1 << (shift + 1)) + size < 65536.0) shift++;
+
+	for (uint16_t i = 0; i < size; i++) {
+		taps[i] = lrint(coeffs[i] * (double)scale * (double)(1 << shift));
+	}
+
+	return shift;
+}
+
+static void init_fir_q15(struct fir_q15_t *flt, int16_t *taps, uint8_t shift, uint16_t size) {
+	flt->taps = taps;
+	flt->shift = shift;
+	flt->size = size;
+	flt->index = 0;
+	flt->in = calloc(2 * size, sizeof(int16_t));
+}
+
+// takes a sample without filtering it
+static inline void fir_q15_add(struct fir_q15_t *flt, int16_t in) {
+	flt->in[flt->index] = flt->in[flt->index + flt->size] = in;
+	if (++flt->index == flt->size) flt->index = 0;
+}
+
+// takes a sample and returns the filtered one
+static inline int16_t fir_q15(struct fir_q15_t *flt, int16_t in) {
+	fir_q15_add(flt, in);
+
+	return sat_q15(round_shift(dsp.dot_q15(flt->in + flt->index, flt->taps, flt->size), flt->shift));
+}
+
+static inline int16_t delay_line_q15(struct delay_line_q15_t *delay_line, int16_t in) {
+	delay_line->buffer[delay_line->idx++] = in;
+	if (delay_line->idx >= delay_line->delay) delay_line->idx = 0;
+	return delay_line->buffer[delay_line->idx];
+}
+
+// one period of a float carrier in Q15, kept off -1.0 so products fit
+static int16_t *q15_wave(const float *wave, uint16_t len) {
+	int16_t *q15 = malloc(len * sizeof(int16_t));
+	int32_t x;
+
+	for (uint16_t i = 0; i < len; i++) {
+		x = lrintf(wave[i] * 32768.0f);
+		if (x > INT16_MAX) x = INT16_MAX;
+		if (x < -INT16_MAX) x = -INT16_MAX;
+		q15[i] = x;
+	}
+
+	return q15;
+}
+
+int8_t init_mpx_q15(struct fm_mpx_t *mpx) {
+	struct mpx_q15_t *q;
+	struct osc_t *osc = &mpx->mpx_osc;
+	int16_t *taps;
+	uint8_t shift;
+
+	q = calloc(1, sizeof(struct mpx_q15_t));
+	if (q == NULL) {
+		fprintf(stderr, "Error: could not allocate the fixed-point encoder.\n");
+		return -1;
+	}
+	mpx->q15 = q;
+
+	taps = malloc(mpx->filters.low_pass.size * sizeof(int16_t));
+	shift = design_q15_taps(mpx->filters.low_pass.filter, 1.0f, mpx->filters.low_pass.size, taps);
+	// both channels use the same taps
+	init_fir_q15(&q->low_pass[0], taps, shift, mpx->filters.low_pass.size);
+	init_fir_q15(&q->low_pass[1], taps, shift, mpx->filters.low_pass.size);
+
+	taps = malloc(mpx->filters.ssb_ht.num_coeffs * sizeof(int16_t));
+	shift = design_q15_taps(mpx->filters.ssb_ht.coeffs, 1.0f, mpx->filters.ssb_ht.num_coeffs, taps);
+	init_fir_q15(&q->hilbert[0], taps, shift, mpx->filters.ssb_ht.num_coeffs);
+	init_fir_q15(&q->hilbert[1], taps, shift, mpx->filters.ssb_ht.num_coeffs);
+
+	q->left_delay.delay = mpx->filters.left_delay.delay;
+	q->left_delay.buffer = calloc(q->left_delay.delay, sizeof(int16_t));
+	q->right_delay.delay = mpx->filters.right_delay.delay;
+	q->right_delay.buffer = calloc(q->right_delay.delay, sizeof(int16_t));
+
+	for (uint8_t i = 0; i < 2; i++) {
+		q->mpx_waves[i][0] = q15_wave(osc->sine_waves[i], osc->phases[i][MAX]);
+		q->mpx_waves[i][1] = q15_wave(osc->cosine_waves[i], osc->phases[i][MAX]);
+	}
+
+	init_mpx_q15_subcarriers(mpx);
+
+	return 0;
+}
+
+/*
+ * Builds the Q15 subcarrier tables again after the subcarrier
+ * oscillator has changed
+ */
+void init_mpx_q15_subcarriers(struct fm_mpx_t *mpx) {
+	struct mpx_q15_t *q = mpx->q15;
+	struct osc_t *osc = &mpx->sub_osc;
+
+	for (uint8_t i = 0; i < q->num_sub_waves; i++) {
+		free(q->sub_waves[i]);
+	}
+
+	for (uint8_t i = 0; i < osc->num_freqs; i++) {
+		q->sub_waves[i] = q15_wave(osc->cosine_waves[i], osc->phases[i][MAX]);
+	}
+	q->num_sub_waves = osc->num_freqs;
+}
+
+#define KERNEL static inline __attribute__((always_inline))
+
+/*
+ * For mono only the left channel is filtered and the stereo part is
+ * left out, but the other filters still take their samples
+ */
+KERNEL void get_audio_q15(struct fm_mpx_t *mpx, float *in, float *out, size_t frames,
+	const uint8_t stereo_mode, const uint8_t mono_only) {
+	struct mpx_q15_t *q = mpx->q15;
+	uint16_t **phases = mpx->mpx_osc.phases;
+	int32_t pilot_volume = volume_q15(mpx->volumes[0]);
+	// share of the Hilbert transform in asymmetric DSB (-1 to 1)
+	int32_t weight = lrintf((mpx->asym_dsb_config.lsb_power -
+		mpx->asym_dsb_config.usb_power) * 32768.0f);
+	size_t j = 0;
+
+	int16_t left, right;
+	int16_t left_delayed, right_delayed;
+	int16_t ht, pilot, sin38, cos38;
+	int32_t ssb, sample;
+
+	for (size_t i = 0; i < frames; i++) {
+		left  = fir_q15(&q->low_pass[0], float_to_q15(in[j+0]));
+		if (mono_only) {
+			fir_q15_add(&q->low_pass[1], float_to_q15(in[j+1]));
+			right = left;
+		} else {
+			right = fir_q15(&q->low_pass[1], float_to_q15(in[j+1]));
+		}
+
+		pilot = q->mpx_waves[0][1][phases[0][CURRENT]];
+		sin38 = q->mpx_waves[1][0][phases[1][CURRENT]];
+		cos38 = q->mpx_waves[1][1][phases[1][CURRENT]];
+
+		if (mono_only && stereo_mode != STEREO_DSB) {
+			left_delayed  = delay_line_q15(&q->left_delay, left);
+			right_delayed = delay_line_q15(&q->right_delay, right);
+
+			fir_q15_add(&q->hilbert[q->hilbert_phase], 0);
+			q->hilbert_phase ^= 1;
+
+			sample = mul_q15(left_delayed + right_delayed, MONO_GAIN);
+		} else if (mono_only) {
+			sample = mul_q15(left + right, MONO_GAIN);
+		} else if (stereo_mode != STEREO_DSB) {
+			left_delayed  = delay_line_q15(&q->left_delay, left);
+			right_delayed = delay_line_q15(&q->right_delay, right);
+
+			ht = fir_q15(&q->hilbert[q->hilbert_phase], (left - right) >> 1);
+			q->hilbert_phase ^= 1;
+			if (stereo_mode == STEREO_ASYM_DSB) ht = mul_q15(ht, weight);
+
+			// LSB (or mostly LSB), in Q30 before the shift
+			ssb = round_shift(((left_delayed - right_delayed) >> 1) * cos38 + ht * sin38, 15);
+
+			sample = mul_q15(left_delayed + right_delayed, MONO_GAIN) +
+				mul_q15(ssb, STEREO_GAIN);
+		} else {
+			sample = mul_q15(left + right, MONO_GAIN) +
+				mul_q15(mul_q15((left - right) >> 1, cos38), STEREO_GAIN);
+		}
+
+		sample += mul_q15(pilot, pilot_volume);
+		out[i] = sample * (1.0f / 32768.0f);
+
+		update_osc_phase(&mpx->mpx_osc);
+
+		j += 2;
+	}
+}
+
+static void audio_ssb_q15(struct fm_mpx_t *mpx, float *in, float *out, size_t frames) {
+	if (is_mono_block(mpx, in, frames)) {
+		get_audio_q15(mpx, in, out, frames, STEREO_SSB, 1);
+	} else {
+		get_audio_q15(mpx, in, out, frames, STEREO_SSB, 0);
+	}
+}
+
+static void audio_dsb_q15(struct fm_mpx_t *mpx, float *in, float *out, size_t frames) {
+	if (is_mono_block(mpx, in, frames)) {
+		get_audio_q15(mpx, in, out, frames, STEREO_DSB, 1);
+	} else {
+		get_audio_q15(mpx, in, out, frames, STEREO_DSB, 0);
+	}
+}
+
+static void audio_asym_q15(struct fm_mpx_t *mpx, float *in, float *out, size_t frames) {
+	if (is_mono_block(mpx, in, frames)) {
+		get_audio_q15(mpx, in, out, frames, STEREO_ASYM_DSB, 1);
+	} else {
+		get_audio_q15(mpx, in, out, frames, STEREO_ASYM_DSB, 0);
+	}
+}
+
+KERNEL void add_subcarriers_q15(struct fm_mpx_t *mpx, float *out, size_t frames,
+	const uint8_t rds2_streams) {
+	struct mpx_q15_t *q = mpx->q15;
+	struct rds_encoder_t *rds = &mpx->rds;
+	uint16_t **phases = mpx->sub_osc.phases;
+	int32_t volumes[MAX_RDS2_STREAMS + 1];
+	int32_t sub;
+
+	for (uint8_t s = 0; s <= rds2_streams; s++) {
+		volumes[s] = volume_q15(mpx->volumes[s+1]);
+	}
+
+	for (size_t i = 0; i < frames; i++) {
+		sub = 0;
+		for (uint8_t s = 0; s <= rds2_streams; s++) {
+			sub += mul_q15(mul_q15(q->sub_waves[s][phases[s][CURRENT]],
+				get_rds_sample_q15(rds, s)), volumes[s]);
+		}
+
+		update_osc_phase(&mpx->sub_osc);
+
+		out[i] += sub * (1.0f / 32768.0f);
+	}
+}
+
+static void sub_rds_q15(struct fm_mpx_t *mpx, float *out, size_t frames) {
+	add_subcarriers_q15(mpx, out, frames, 0);
+}
+
+static void sub_rds2_1_q15(struct fm_mpx_t *mpx, float *out, size_t frames) {
+	add_subcarriers_q15(mpx, out, frames, 1);
+}
+
+static void sub_rds2_2_q15(struct fm_mpx_t *mpx, float *out, size_t frames) {
+	add_subcarriers_q15(mpx, out, frames, 2);
+}
+
+static void sub_rds2_3_q15(struct fm_mpx_t *mpx, float *out, size_t frames) {
+	add_subcarriers_q15(mpx, out, frames, 3);
+}
+
+// fixed-point version of fm_rds_get_samples
+void get_rds_samples_q15(struct fm_mpx_t *mpx, float *out, size_t frames) {
+	struct mpx_q15_t *q = mpx->q15;
+	uint16_t **mpx_phases = mpx->mpx_osc.phases;
+	uint16_t **sub_phases = mpx->sub_osc.phases;
+	int32_t volumes[MAX_RDS2_STREAMS + 2];
+	int32_t sample;
+
+	for (uint8_t s = 0; s <= mpx->rds2_streams + 1; s++) {
+		volumes[s] = volume_q15(mpx->volumes[s]);
+	}
+
+	for (size_t i = 0; i < frames; i++) {
+		// Pilot tone for calibration
+		sample = mul_q15(q->mpx_waves[0][1][mpx_phases[0][CURRENT]], volumes[0]);
+
+		for (uint8_t s = 1; s <= mpx->rds2_streams; s++) {
+			sample += mul_q15(mul_q15(q->sub_waves[s][sub_phases[s][CURRENT]],
+				get_rds_sample_q15(&mpx->rds, s)), volumes[s+1]);
+		}
+
+		update_osc_phase(&mpx->mpx_osc);
+		update_osc_phase(&mpx->sub_osc);
+
+		out[i] = sample * (1.0f / 32768.0f);
+	}
+}
+
+void select_q15_audio_kernel(struct fm_mpx_t *mpx) {
+	// in stereo mode order
+	static void (*const audio_kernels[])(struct fm_mpx_t *, float *, float *, size_t) = {
+		audio_ssb_q15, audio_dsb_q15, audio_asym_q15
+	};
+
+	mpx->audio_kernel = audio_kernels[mpx->stereo_mode];
+}
+
+void select_q15_sub_kernel(struct fm_mpx_t *mpx) {
+	static void (*const sub_kernels[])(struct fm_mpx_t *, float *, size_t) = {
+		sub_rds_q15, sub_rds2_1_q15, sub_rds2_2_q15, sub_rds2_3_q15
+	};
+
+	mpx->sub_kernel = sub_kernels[mpx->rds2_streams];
+}
+
+void exit_mpx_q15(struct fm_mpx_t *mpx) {
+	struct mpx_q15_t *q = mpx->q15;
+
+	if (q == NULL) return;
+
+	free(q->low_pass[0].taps);
+	free(q->low_pass[0].in);
+	free(q->low_pass[1].in);
+	free(q->hilbert[0].taps);
+	free(q->hilbert[0].in);
+	free(q->hilbert[1].in);
+	free(q->left_delay.buffer);
+	free(q->right_delay.buffer);
+	for (uint8_t i = 0; i < 2; i++) {
+		free(q->mpx_waves[i][0]);
+		free(q->mpx_waves[i][1]);
+	}
+	for (uint8_t i = 0; i < q->num_sub_waves; i++) {
+		free(q->sub_waves[i]);
+	}
+
+	free(q);
+	mpx->q15 = NULL;
+}
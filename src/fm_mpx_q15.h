@@ -0,0 +1,67 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Fixed-point (Q15) filter
+ *
+ * The taps are the float design scaled up by 2^shift, with shift as
+ * large as the taps and the 32-bit sum allow.
+ */
+typedef struct fir_q15_t {
+	int16_t *taps;
+	uint8_t shift;
+	uint16_t size;
+	uint16_t index;
+	// the last size samples, twice over
+	int16_t *in;
+} fir_q15_t;
+
+typedef struct delay_line_q15_t {
+	int16_t *buffer;
+	uint16_t delay;
+	uint16_t idx;
+} delay_line_q15_t;
+
+/*
+ * Fixed-point encoder state
+ *
+ * Only allocated for encoders switched to the fixed-point path. The
+ * carrier tables are Q15 copies of the ones of the float oscillators,
+ * whose phases are used as they are.
+ */
+typedef struct mpx_q15_t {
+	struct fir_q15_t low_pass[2];
+	// even and odd samples, as in the float transformer
+	struct fir_q15_t hilbert[2];
+	uint8_t hilbert_phase;
+	struct delay_line_q15_t left_delay;
+	struct delay_line_q15_t right_delay;
+
+	// pilot and stereo carriers: sine and cosine of each
+	int16_t *mpx_waves[2][2];
+	// subcarriers (cosine only)
+	int16_t *sub_waves[MAX_RDS2_STREAMS + 1];
+	uint8_t num_sub_waves;
+} mpx_q15_t;
+
+extern int8_t init_mpx_q15(struct fm_mpx_t *mpx);
+extern void init_mpx_q15_subcarriers(struct fm_mpx_t *mpx);
+extern void select_q15_audio_kernel(struct fm_mpx_t *mpx);
+extern void select_q15_sub_kernel(struct fm_mpx_t *mpx);
+extern void get_rds_samples_q15(struct fm_mpx_t *mpx, float *out, size_t frames);
+extern void exit_mpx_q15(struct fm_mpx_t *mpx);
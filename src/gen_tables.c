@@ -0,0 +1,89 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "shared_tables.h"
+
+/*
+ * DSP table generator
+ *
+ * Run by the Makefile to write dsp_tables.c. The tables are built by
+ * the same code that builds them at run time, so they come out exactly
+ * the same. They are written with enough digits to read back to the
+ * same floats.
+ */
+
+// the generator itself is built without any tables
+const struct dsp_table_t builtin_tables[1];
+const uint8_t num_builtin_tables = 0;
+
+int main(int argc, char **argv) {
+	struct dsp_table_t tables[MAX_SHARED_TABLES];
+	uint8_t num_tables;
+	FILE *f;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s output.c\n", argv[0]);
+		return 1;
+	}
+
+	num_tables = collect_tables(tables);
+	if (!num_tables) {
+		fprintf(stderr, "Error: no tables were built.\n");
+		return 1;
+	}
+
+	f = fopen(argv[1], "w");
+	if (f == NULL) {
+		fprintf(stderr, "Error: could not open %s.\n", argv[1]);
+		free_tables(tables, num_tables);
+		return 1;
+	}
+
+	fprintf(f,
+		"/* This file was automatically generated by gen_tables. Do not edit. */\n"
+		"\n"
+		"#include \"common.h\"\n"
+		"#include \"shared_tables.h\"\n");
+
+	for (uint8_t i = 0; i < num_tables; i++) {
+		fprintf(f, "\n// %s\nstatic const float table_%u[%u] = {",
+			tables[i].key, i, tables[i].len);
+		for (uint32_t j = 0; j < tables[i].len; j++) {
+			fprintf(f, "%s%.8ef%s", j % 4 ? " " : "\n\t", tables[i].data[j],
+				j + 1 < tables[i].len ? "," : "\n");
+		}
+		fprintf(f, "};\n");
+	}
+
+	fprintf(f, "\nconst struct dsp_table_t builtin_tables[] = {\n");
+	for (uint8_t i = 0; i < num_tables; i++) {
+		fprintf(f, "\t{\"%s\", table_%u, %u},\n", tables[i].key, i, tables[i].len);
+	}
+	fprintf(f, "};\n\nconst uint8_t num_builtin_tables = %u;\n", num_tables);
+
+	free_tables(tables, num_tables);
+
+	if (fclose(f)) {
+		fprintf(stderr, "Error: could not write %s.\n", argv[1]);
+		remove(argv[1]);
+		return 1;
+	}
+
+	return 0;
+}
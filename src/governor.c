@@ -0,0 +1,133 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <time.h>
+#include "fm_mpx.h"
+#include "governor.h"
+
+/*
+ * Quality governor
+ *
+ * A block that takes more than GOVERNOR_MISS_LOAD of its own play time
+ * to generate is a miss, as the rest of the chain (input resampler,
+ * output stage and the RDS thread) needs the remainder. When a quarter
+ * of the blocks in a window of about a second miss, the quality goes
+ * down a tier.
+ *
+ * It goes back up once the load, scaled by what the tier above cost
+ * the last time it was left, has stayed under GOVERNOR_UP_LOAD for the
+ * calm time. Each time going up does not last, the calm time doubles.
+ */
+
+#define GOVERNOR_MISS_LOAD	0.6
+#define GOVERNOR_UP_LOAD	0.3
+#define GOVERNOR_CALM_TIME	10.0
+#define GOVERNOR_MAX_CALM_TIME	320.0
+#define GOVERNOR_SETTLE_TIME	0.5
+// assumed cost of a tier over the one below until it has been measured
+#define GOVERNOR_STEP_COST	2.0
+
+void init_governor(struct governor_t *gov, uint8_t max_quality, size_t block_size) {
+	memset(gov, 0, sizeof(struct governor_t));
+	gov->max_quality = max_quality;
+	gov->block_time = (double)block_size / MPX_SAMPLE_RATE;
+
+	// at least 4 blocks, so a quarter of them is one block
+	gov->window_blocks = 1.0 / gov->block_time + 0.5;
+	if (gov->window_blocks < 4) gov->window_blocks = 4;
+
+	gov->calm_time = GOVERNOR_CALM_TIME;
+	gov->blocks_since_up = UINT32_MAX;
+	for (uint8_t i = 0; i < NUM_QUALITY_TIERS; i++) gov->step_cost[i] = GOVERNOR_STEP_COST;
+}
+
+// call right before the encoder generates a block
+void start_governor_block(struct governor_t *gov) {
+	clock_gettime(CLOCK_MONOTONIC, &gov->start);
+}
+
+static void start_settling(struct governor_t *gov) {
+	gov->settle_blocks = GOVERNOR_SETTLE_TIME / gov->block_time + 1;
+	gov->misses = 0;
+	gov->window_pos = 0;
+	gov->calm_blocks = 0;
+}
+
+/*
+ * Call right after the encoder has generated a block, with the tier it
+ * is at. Returns the tier to change to or -1 to stay.
+ */
+int8_t end_governor_block(struct governor_t *gov, uint8_t quality) {
+	struct timespec end;
+	double load;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	load = (end.tv_sec - gov->start.tv_sec) +
+		(end.tv_nsec - gov->start.tv_nsec) / 1e9;
+	load /= gov->block_time;
+
+	if (gov->blocks_since_up < UINT32_MAX) gov->blocks_since_up++;
+
+	if (gov->settle_blocks) {
+		// the average starts over at the new tier
+		gov->settle_blocks--;
+		gov->load = load;
+		return -1;
+	}
+
+	// smoothed over about a second
+	gov->load += (load - gov->load) / gov->window_blocks;
+
+	if (gov->measure_blocks && --gov->measure_blocks == 0 &&
+	    quality + 1 < NUM_QUALITY_TIERS) {
+		gov->step_cost[quality + 1] = gov->load_before / gov->load;
+		if (gov->step_cost[quality + 1] < 1.0) gov->step_cost[quality + 1] = 1.0;
+	}
+
+	if (load > GOVERNOR_MISS_LOAD) gov->misses++;
+	if (++gov->window_pos == gov->window_blocks) {
+		gov->window_pos = 0;
+		gov->misses = 0;
+	}
+
+	if (quality > QUALITY_LOW && gov->misses * 4 >= gov->window_blocks) {
+		// going up did not last
+		if (gov->blocks_since_up * gov->block_time < gov->calm_time &&
+		    gov->calm_time < GOVERNOR_MAX_CALM_TIME) gov->calm_time *= 2.0;
+
+		gov->load_before = gov->load;
+		gov->measure_blocks = gov->window_blocks;
+		start_settling(gov);
+		return quality - 1;
+	}
+
+	if (quality < gov->max_quality &&
+	    gov->load * gov->step_cost[quality + 1] < GOVERNOR_UP_LOAD) {
+		if (++gov->calm_blocks * gov->block_time >= gov->calm_time) {
+			gov->blocks_since_up = 0;
+			gov->measure_blocks = 0;
+			start_settling(gov);
+			return quality + 1;
+		}
+	} else {
+		gov->calm_blocks = 0;
+	}
+
+	return -1;
+}
@@ -0,0 +1,58 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Quality governor
+ *
+ * Decides when the encoder should go down or back up a quality tier,
+ * from how long it takes to generate each block.
+ */
+typedef struct governor_t {
+	// the tier the encoder started with, the highest one to go back to
+	uint8_t max_quality;
+	// seconds of MPX in a block
+	double block_time;
+	uint32_t window_blocks;
+	struct timespec start;
+
+	// smoothed share of the block time the encoder takes
+	double load;
+	// slow blocks in the current window
+	uint32_t misses;
+	uint32_t window_pos;
+
+	// blocks in a row with room for the tier above, and how many it takes
+	uint32_t calm_blocks;
+	double calm_time;
+	uint32_t blocks_since_up;
+
+	// blocks left out after a change, while both sets of filters run
+	uint32_t settle_blocks;
+
+	/*
+	 * Load of each tier over the one below, measured on the way down
+	 * so the two loads are taken under the same conditions
+	 */
+	double step_cost[NUM_QUALITY_TIERS];
+	double load_before;
+	uint32_t measure_blocks;
+} governor_t;
+
+extern void init_governor(struct governor_t *gov, uint8_t max_quality, size_t block_size);
+extern void start_governor_block(struct governor_t *gov);
+extern int8_t end_governor_block(struct governor_t *gov, uint8_t quality);
@@ -20,22 +20,33 @@
 #include "input.h"
 
 static uint8_t input_type;
+static size_t input_frames;
+static struct file_input_t file_in;
 
 int8_t open_input(char *input_name, uint8_t wait, uint32_t *sample_rate, size_t num_frames) {
 	// TODO: better detect live capture cards
 	if (input_name[0] == 'a' && input_name[1] == 'l' &&
 	    input_name[2] == 's' && input_name[3] == 'a' &&
 	    input_name[4] == ':') { // check if name is prefixed with "alsa:"
+		// preferred rate, the card may pick another one
 		*sample_rate = 48000;
 		input_name = input_name+5; // don't pass prefix
-		if (open_alsa_input(input_name, *sample_rate, num_frames) < 0) {
+		if (open_alsa_input(input_name, sample_rate, num_frames) < 0) {
 			fprintf(stderr, "Could not open ALSA source.\n");
-			return 0;
+			return -1;
 		}
 		input_type = 2;
+	} else if (is_playlist(input_name)) {
+		if (open_playlist_input(input_name, sample_rate, num_frames) < 0) {
+			return -1;
+		}
+		input_type = 4;
+	} else if (open_mmap_input(input_name, sample_rate, num_frames) == 0) {
+		// uncompressed WAV files are mapped into memory
+		input_type = 3;
 	} else {
-		if (open_file_input(input_name, sample_rate, wait, num_frames) < 0) {
-			return 0;
+		if (open_file_input(&file_in, input_name, sample_rate, wait, num_frames) < 0) {
+			return -1;
 		}
 		input_type = 1;
 	}
@@ -45,24 +56,78 @@ int8_t open_input(char *input_name, uint8_t wait, uint32_t *sample_rate, size_t
 		return -1;
         }
 
+	input_frames = num_frames;
+
 	return 1;
 }
 
-int8_t read_input(short *audio) {
+/*
+ * Returns the number of frames read. Only live capture can come back
+ * with less than a full block.
+ */
+int read_input(float *audio) {
+	int frames;
+
 	if (input_type == 1) {
-		if (read_file_input(audio) < 0) return -1;
+		if (read_file_input(&file_in, audio) < 0) return -1;
 	}
 	if (input_type == 2) {
-		if (read_alsa_input(audio) < 0) return -1;
+		if ((frames = read_alsa_input(audio)) < 0) return -1;
+		return frames;
+	}
+	if (input_type == 3) {
+		if (read_mmap_input(audio) < 0) return -1;
+	}
+	if (input_type == 4) {
+		if (read_playlist_input(audio) < 0) return -1;
 	}
+	return input_frames;
+}
+
+/*
+ * Whether the input runs on its own clock (a sound card) rather than
+ * being read as fast as the output takes it
+ */
+uint8_t is_live_input() {
+	return input_type == 2;
+}
+
+/*
+ * Poll descriptors to wait on before reading (none unless the input
+ * is live)
+ */
+int get_input_fds(struct pollfd *fds, unsigned int space) {
+	if (input_type == 2) return get_alsa_input_fds(fds, space);
+	return 0;
+}
+
+/*
+ * Whether a block can be read without waiting
+ */
+uint8_t input_ready() {
+	if (input_type == 2) return alsa_input_ready();
+	return 1;
+}
+
+/*
+ * Frames the input has captured that have not been read yet
+ */
+long get_input_delay() {
+	if (input_type == 2) return get_alsa_input_delay();
 	return 0;
 }
 
 void close_input() {
 	if (input_type == 1) {
-		close_file_input();
+		close_file_input(&file_in);
 	}
 	if (input_type == 2) {
 		close_alsa_input();
 	}
+	if (input_type == 3) {
+		close_mmap_input();
+	}
+	if (input_type == 4) {
+		close_playlist_input();
+	}
 }
@@ -17,8 +17,14 @@
  */
 
 #include "file_input.h"
+#include "mmap_input.h"
+#include "playlist_input.h"
 #include "alsa_input.h"
 
 int8_t open_input(char *input_name, uint8_t wait, uint32_t *sample_rate, size_t num_frames);
-int8_t read_input(short *audio);
+int read_input(float *audio);
+uint8_t is_live_input();
+int get_input_fds(struct pollfd *fds, unsigned int space);
+uint8_t input_ready();
+long get_input_delay();
 void close_input();
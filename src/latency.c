@@ -0,0 +1,158 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <pthread.h>
+#include "latency.h"
+
+/*
+ * Latency measurement
+ *
+ * Blocks are stamped with the time their first sample was captured
+ * (or read from a file) and the output works out when the last one
+ * will be played, which gives the latency due to buffering. The
+ * resampler and filter delays do not show up there, so there is also
+ * a loopback test which replaces the input with a pulse every few seconds
+ * and looks for it in the output.
+ */
+
+void get_stamp_time(struct timespec *t) {
+	clock_gettime(CLOCK_MONOTONIC, t);
+}
+
+void offset_stamp_time(struct timespec *t, double seconds) {
+	int64_t ns = t->tv_nsec + (int64_t)(seconds * 1e9);
+
+	t->tv_sec += ns / 1000000000;
+	ns %= 1000000000;
+	if (ns < 0) {
+		t->tv_sec--;
+		ns += 1000000000;
+	}
+	t->tv_nsec = ns;
+}
+
+/*
+ * Returns a - b in ms
+ */
+double stamp_time_diff(struct timespec *a, struct timespec *b) {
+	return (a->tv_sec - b->tv_sec) * 1e3 + (a->tv_nsec - b->tv_nsec) / 1e6;
+}
+
+/*
+ * Gets the capture time of the sample at pos from a reference stamp
+ * on the same clock
+ */
+void get_stamp_at(struct sample_stamp_t *ref, uint64_t pos, uint32_t rate, struct timespec *t) {
+	*t = ref->time;
+	offset_stamp_time(t, ((double)pos - (double)ref->pos) / rate);
+}
+
+void add_latency(struct latency_stats_t *stats, double latency) {
+	if (!stats->count || latency < stats->min) stats->min = latency;
+	if (!stats->count || latency > stats->max) stats->max = latency;
+	stats->sum += latency;
+	stats->count++;
+}
+
+void print_latency_stats(struct latency_stats_t *stats) {
+	if (!stats->count) return;
+
+	fprintf(stderr, "Latency: %.1f ms (min %.1f, max %.1f)\n",
+		stats->sum / stats->count, stats->min, stats->max);
+	memset(stats, 0, sizeof(struct latency_stats_t));
+}
+
+/*
+ * Loopback test
+ *
+ * The pulse goes in on the input thread and is picked out of the
+ * output on the MPX thread. The pulse comes out of the low-pass filter
+ * at only around 0.08, below the pilot and RDS, so those are turned off
+ * for the test and the input is silenced: the pulse is then the only
+ * thing in the output. Each result is printed when the next pulse
+ * goes in, so the latency has to be under TEST_PULSE_INTERVAL.
+ */
+#define TEST_PULSE_LEVEL	0.5
+
+static pthread_mutex_t test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t test_rate;
+static uint64_t test_pos;
+static uint64_t next_pulse;
+
+// the pulse on its way through
+static uint8_t pulse_pending;
+static struct timespec pulse_captured;
+static struct timespec pulse_played;
+static float pulse_peak;
+static double pulse_stamp_latency;
+
+void init_latency_test(uint32_t sample_rate) {
+	test_rate = sample_rate;
+	test_pos = 0;
+	// give the chain some time to settle
+	next_pulse = sample_rate * TEST_PULSE_INTERVAL;
+	pulse_pending = 0;
+}
+
+/*
+ * Replaces a block of input with silence and puts a pulse in it when
+ * one is due. newest is the capture time of the last frame.
+ */
+void insert_test_pulse(float *audio, size_t frames, struct timespec *newest) {
+	size_t i;
+
+	memset(audio, 0, frames * 2 * sizeof(float));
+
+	if (next_pulse < test_pos + frames) {
+		i = next_pulse - test_pos;
+		audio[i * 2 + 0] = TEST_PULSE_LEVEL;
+		audio[i * 2 + 1] = TEST_PULSE_LEVEL;
+
+		pthread_mutex_lock(&test_mutex);
+		// the last pulse has made it through by now
+		if (pulse_pending) {
+			fprintf(stderr, "Loopback latency: %.2f ms (timestamps: %.2f ms)\n",
+				stamp_time_diff(&pulse_played, &pulse_captured),
+				pulse_stamp_latency);
+		}
+		pulse_captured = *newest;
+		offset_stamp_time(&pulse_captured, -(double)(frames - 1 - i) / test_rate);
+		pulse_peak = 0;
+		pulse_pending = 1;
+		pthread_mutex_unlock(&test_mutex);
+
+		next_pulse += test_rate * TEST_PULSE_INTERVAL;
+	}
+
+	test_pos += frames;
+}
+
+/*
+ * Takes the peak of an output block and when it will be played. The
+ * loudest one since the pulse went in is taken to be the pulse.
+ */
+void find_test_pulse(float peak, struct timespec *played, double stamp_latency) {
+	pthread_mutex_lock(&test_mutex);
+	if (pulse_pending && peak > pulse_peak) {
+		pulse_peak = peak;
+		pulse_played = *played;
+		pulse_stamp_latency = stamp_latency;
+	}
+	pthread_mutex_unlock(&test_mutex);
+}
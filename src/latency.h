@@ -0,0 +1,54 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+// how often to report the measured latency (in seconds)
+#define LATENCY_REPORT_INTERVAL	10
+
+// time between test pulses (in seconds)
+#define TEST_PULSE_INTERVAL	2.0
+
+/*
+ * A position on a sample clock and the time (CLOCK_MONOTONIC) the
+ * sample at that position was captured
+ */
+typedef struct sample_stamp_t {
+	uint64_t pos;
+	struct timespec time;
+} sample_stamp_t;
+
+/*
+ * Capture to output latency statistics
+ */
+typedef struct latency_stats_t {
+	double min;
+	double max;
+	double sum;
+	uint32_t count;
+} latency_stats_t;
+
+extern void get_stamp_time(struct timespec *t);
+extern void offset_stamp_time(struct timespec *t, double seconds);
+extern double stamp_time_diff(struct timespec *a, struct timespec *b);
+extern void get_stamp_at(struct sample_stamp_t *ref, uint64_t pos, uint32_t rate, struct timespec *t);
+extern void add_latency(struct latency_stats_t *stats, double latency);
+extern void print_latency_stats(struct latency_stats_t *stats);
+extern void init_latency_test(uint32_t sample_rate);
+extern void insert_test_pulse(float *audio, size_t frames, struct timespec *newest);
+extern void find_test_pulse(float peak, struct timespec *played, double stamp_latency);
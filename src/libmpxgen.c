@@ -0,0 +1,93 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <pthread.h>
+#include "fm_mpx.h"
+#include "dsp_kernels.h"
+#include "control_pipe.h"
+#include "shared_tables.h"
+#include "mpxgen.h"
+
+// only the mpx_encoder_* functions are exported from the shared library
+#define MPXGEN_API __attribute__((visibility("default")))
+
+struct mpx_encoder_t {
+	struct fm_mpx_t mpx;
+};
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void pick_kernels() {
+	init_dsp_kernels(NULL);
+}
+
+MPXGEN_API int mpx_encoder_share_tables() {
+	return open_shared_tables();
+}
+
+MPXGEN_API mpx_encoder_t *mpx_encoder_open() {
+	struct rds_params_t rds_params = {
+		.ps = "Mpxgen",
+		.rt = "Mpxgen: FM Stereo and RDS encoder",
+		.pi = 0x1000
+	};
+	// no callsign, but init_rds_encoder looks at all 4 characters
+	char callsign[5] = {0};
+	struct mpx_encoder_t *enc;
+
+	pthread_once(&kernels_once, pick_kernels);
+
+	enc = malloc(sizeof(struct mpx_encoder_t));
+	if (enc == NULL) return NULL;
+
+	if (fm_mpx_init(&enc->mpx) < 0) {
+		free(enc);
+		return NULL;
+	}
+	set_output_volume(&enc->mpx, 50);
+	init_rds_encoder(&enc->mpx.rds, rds_params, callsign);
+
+	return enc;
+}
+
+MPXGEN_API int mpx_encoder_command(mpx_encoder_t *enc, const char *cmd) {
+	// the command parser works in place
+	char buf[CTL_BUFFER_SIZE] = {0};
+
+	if (strlen(cmd) >= CTL_BUFFER_SIZE) return -1;
+	strcpy(buf, cmd);
+
+	return process_ascii_cmd(&enc->mpx, buf) > 0 ? 1 : -1;
+}
+
+MPXGEN_API void mpx_encoder_process(mpx_encoder_t *enc, const float *in, float *out, size_t frames) {
+	float vol = get_output_volume(&enc->mpx);
+
+	fm_mpx_get_samples(&enc->mpx, (float *)in, out, frames);
+
+	for (size_t i = 0; i < frames; i++) {
+		out[i] *= vol;
+	}
+}
+
+MPXGEN_API void mpx_encoder_close(mpx_encoder_t *enc) {
+	if (enc == NULL) return;
+	fm_mpx_exit(&enc->mpx);
+	free(enc);
+}
@@ -0,0 +1,309 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "audio_conversion.h"
+
+/*
+ * Memory-mapped WAV input
+ *
+ * Uncompressed WAV files are mapped into memory and the samples are
+ * converted straight from the mapping into the audio buffer. Looping
+ * is done by wrapping the read index, so once the file is in the page
+ * cache no system calls are made at all.
+ *
+ * Reading past the end of a file that has been cut short since it was
+ * mapped raises SIGBUS. That is caught and the read fails, so files
+ * should not be truncated or rewritten while they are in use.
+ */
+
+// WAVE format tags
+#define WAVE_FORMAT_PCM		0x0001
+#define WAVE_FORMAT_IEEE_FLOAT	0x0003
+#define WAVE_FORMAT_EXTENSIBLE	0xFFFE
+
+// samples copied out at a time when the data chunk is not aligned
+#define BOUNCE_SAMPLES	1024
+
+enum mmap_sample_format {
+	MMAP_S16,
+	MMAP_S24,
+	MMAP_S32,
+	MMAP_FLOAT
+};
+
+static uint8_t *map;
+static size_t map_len;
+static uint8_t *data;
+static size_t total_frames;
+static size_t frame_pos;
+static size_t frame_size;
+static uint8_t channels;
+static enum mmap_sample_format format;
+// what the samples need to be aligned to for the conversions
+static size_t sample_align;
+static size_t target_len;
+
+// where a SIGBUS on the mapping goes, set while reading it
+static __thread sigjmp_buf bus_jump;
+static __thread volatile sig_atomic_t reading_map;
+static struct sigaction old_bus_action;
+
+static inline uint16_t get_le16(uint8_t *p) {
+	return p[0] | p[1] << 8;
+}
+
+static inline uint32_t get_le32(uint8_t *p) {
+	return (uint32_t)p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/*
+ * Looks for the fmt and data chunks
+ *
+ * Returns 0 if the file is an uncompressed mono or stereo WAV file
+ */
+static int8_t parse_wav_header(uint32_t *sample_rate) {
+	uint8_t *chunk = map + 12;
+	uint8_t *end = map + map_len;
+	uint8_t *fmt = NULL;
+	uint32_t chunk_len, fmt_len = 0;
+	uint16_t fmt_tag, bits;
+
+	data = NULL;
+
+	if (map_len < 12 ||
+	    memcmp(map, "RIFF", 4) || memcmp(map + 8, "WAVE", 4)) return -1;
+
+	while (chunk + 8 <= end) {
+		chunk_len = get_le32(chunk + 4);
+
+		if (!memcmp(chunk, "fmt ", 4)) {
+			if (chunk_len < 16 || chunk_len > (size_t)(end - chunk - 8)) return -1;
+			fmt = chunk + 8;
+			fmt_len = chunk_len;
+		} else if (!memcmp(chunk, "data", 4)) {
+			data = chunk + 8;
+			// streamed files may not have the right length
+			if (chunk_len > (size_t)(end - data)) chunk_len = end - data;
+			break;
+		}
+
+		// a bogus length would take the pointer past the end of the map
+		if (chunk_len > (size_t)(end - chunk - 8)) return -1;
+		chunk += 8 + chunk_len;
+
+		// chunks are word aligned
+		if ((chunk_len & 1) && chunk < end) chunk++;
+	}
+
+	if (fmt == NULL || data == NULL) return -1;
+
+	fmt_tag = get_le16(fmt);
+	channels = get_le16(fmt + 2);
+	*sample_rate = get_le32(fmt + 4);
+	bits = get_le16(fmt + 14);
+
+	if (fmt_tag == WAVE_FORMAT_EXTENSIBLE) {
+		// the extension ends with the 16 byte sub-format GUID
+		if (fmt_len < 40 || get_le16(fmt + 16) < 22) return -1;
+		// first two bytes of the sub-format GUID
+		fmt_tag = get_le16(fmt + 24);
+	}
+
+	if (channels < 1 || channels > 2) return -1;
+
+	// floats are copied out with memcpy
+	if (fmt_tag == WAVE_FORMAT_PCM && bits == 16) {
+		format = MMAP_S16;
+		sample_align = sizeof(int16_t);
+	} else if (fmt_tag == WAVE_FORMAT_PCM && bits == 24) {
+		format = MMAP_S24;
+		sample_align = 1;
+	} else if (fmt_tag == WAVE_FORMAT_PCM && bits == 32) {
+		format = MMAP_S32;
+		sample_align = sizeof(int32_t);
+	} else if (fmt_tag == WAVE_FORMAT_IEEE_FLOAT && bits == 32) {
+		format = MMAP_FLOAT;
+		sample_align = 1;
+	} else {
+		return -1;
+	}
+
+	frame_size = channels * bits / 8;
+	total_frames = chunk_len / frame_size;
+	if (total_frames == 0) return -1;
+
+	return 0;
+}
+
+static void bus_handler(int sig) {
+	if (reading_map) siglongjmp(bus_jump, 1);
+
+	// not a read of the mapping
+	sigaction(SIGBUS, &old_bus_action, NULL);
+	raise(sig);
+}
+
+/*
+ * Maps a WAV file into memory
+ *
+ * Returns -1 without printing anything if the file cannot be handled
+ * here so the caller can fall back to libsndfile.
+ */
+int8_t open_mmap_input(char *filename, uint32_t *sample_rate, size_t num_frames) {
+	struct stat st;
+	struct sigaction bus_action;
+	int fd;
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+	// samples are used in place
+	return -1;
+#endif
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1) return -1;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return -1;
+	}
+
+	map_len = st.st_size;
+	map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+	// the mapping stays valid after the file is closed
+	close(fd);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		return -1;
+	}
+
+	data = NULL;
+	if (parse_wav_header(sample_rate) < 0) {
+		munmap(map, map_len);
+		map = NULL;
+		return -1;
+	}
+
+	madvise(map, map_len, MADV_SEQUENTIAL);
+
+	// not blocked in the handler, so jumping out needs no system call
+	memset(&bus_action, 0, sizeof(struct sigaction));
+	bus_action.sa_handler = bus_handler;
+	bus_action.sa_flags = SA_NODEFER;
+	sigemptyset(&bus_action.sa_mask);
+	sigaction(SIGBUS, &bus_action, &old_bus_action);
+
+	target_len = num_frames;
+	frame_pos = 0;
+
+	fprintf(stderr, "Using audio file: %s (memory-mapped)\n", filename);
+
+	return 0;
+}
+
+static void convert_samples(uint8_t *in, float *out, size_t samples) {
+	switch (format) {
+	case MMAP_S16:
+		short2float((int16_t *)in, out, samples);
+		break;
+	case MMAP_S24:
+		s24_3le2float(in, out, samples);
+		break;
+	case MMAP_S32:
+		int2float((int32_t *)in, out, samples);
+		break;
+	case MMAP_FLOAT:
+		memcpy(out, in, samples * sizeof(float));
+		break;
+	}
+}
+
+/*
+ * Converts frames from the mapping to stereo floats
+ *
+ * The data chunk only has to start on an even byte, so 32-bit samples
+ * may be misaligned. Those are copied to an aligned buffer first.
+ */
+static void convert_frames(uint8_t *in, float *out, size_t frames) {
+	int32_t bounce[BOUNCE_SAMPLES];
+	size_t samples = frames * channels;
+	size_t sample_size = frame_size / channels;
+	size_t n;
+	// mono is converted into the back half of the buffer first
+	float *dest = (channels == 2) ? out : out + frames;
+
+	if (((uintptr_t)in & (sample_align - 1)) == 0) {
+		convert_samples(in, dest, samples);
+	} else {
+		while (samples) {
+			n = samples < BOUNCE_SAMPLES ? samples : BOUNCE_SAMPLES;
+			memcpy(bounce, in, n * sample_size);
+			convert_samples((uint8_t *)bounce, dest, n);
+			in += n * sample_size;
+			dest += n;
+			samples -= n;
+		}
+	}
+
+	if (channels == 1) stereoizef(out + frames, out, frames);
+}
+
+static void read_frames(float *audio) {
+	size_t frames_left = target_len;
+	size_t frames;
+
+	while (frames_left) {
+		frames = total_frames - frame_pos;
+		if (frames > frames_left) frames = frames_left;
+
+		convert_frames(data + frame_pos * frame_size, audio, frames);
+
+		audio += frames * 2;
+		frames_left -= frames;
+		frame_pos += frames;
+
+		// loop back to the start of the file
+		if (frame_pos == total_frames) frame_pos = 0;
+	}
+}
+
+int16_t read_mmap_input(float *audio) {
+	if (sigsetjmp(bus_jump, 0)) {
+		reading_map = 0;
+		fprintf(stderr, "Error: the audio file was cut short while in use.\n");
+		return -1;
+	}
+
+	reading_map = 1;
+	read_frames(audio);
+	reading_map = 0;
+
+	return 1;
+}
+
+void close_mmap_input() {
+	if (map == NULL) return;
+	sigaction(SIGBUS, &old_bus_action, NULL);
+	munmap(map, map_len);
+	map = NULL;
+}
@@ -17,7 +17,9 @@
  */
 
 #include "common.h"
+#include <pthread.h>
 #include "mpx_carriers.h"
+#include "shared_tables.h"
 
 /*
  * Code for MPX oscillator
@@ -60,10 +62,110 @@ static void create_wave(uint32_t rate, float freq, float *sin_wave, float *cos_w
 }
 
 /*
- * Create waveform lookup tables for frequencies in the array
+ * Waveform tables
  *
+ * A table only depends on the sample rate and the frequency so all
+ * oscillators running the same carrier share one. It is built by the
+ * first oscillator that needs it (or taken from the shared or built-in
+ * tables) and freed with the last one.
  */
-void init_osc(struct osc_t *osc_ctx, uint32_t sample_rate, const float *c_freqs) {
+#define MAX_WAVE_TABLES	16
+
+static struct wave_table_t {
+	uint32_t rate;
+	float freq;
+	float *sin_wave;
+	float *cos_wave;
+	uint16_t max_phase;
+	uint16_t users;
+	// points into the shared or built-in tables
+	uint8_t shared;
+} wave_tables[MAX_WAVE_TABLES];
+static pthread_mutex_t wave_table_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void build_wave_table(struct wave_table_t *table, uint32_t rate, float freq) {
+	char sin_key[SHARED_TABLE_KEY_LENGTH];
+	char cos_key[SHARED_TABLE_KEY_LENGTH];
+	const float *sin_wave, *cos_wave;
+	uint32_t sin_len, cos_len;
+
+	table->rate = rate;
+	table->freq = freq;
+
+	snprintf(sin_key, SHARED_TABLE_KEY_LENGTH, "sin %u %.2f", rate, freq);
+	snprintf(cos_key, SHARED_TABLE_KEY_LENGTH, "cos %u %.2f", rate, freq);
+
+	sin_wave = find_shared_table(sin_key, &sin_len);
+	cos_wave = find_shared_table(cos_key, &cos_len);
+	if (sin_wave != NULL && cos_wave != NULL && sin_len == cos_len) {
+		table->sin_wave = (float *)sin_wave;
+		table->cos_wave = (float *)cos_wave;
+		table->max_phase = sin_len;
+		table->shared = 1;
+		return;
+	}
+
+	table->sin_wave = malloc(rate * sizeof(float));
+	table->cos_wave = malloc(rate * sizeof(float));
+	create_wave(rate, freq, table->sin_wave, table->cos_wave, &table->max_phase);
+
+	// only one period is used
+	table->sin_wave = realloc(table->sin_wave, table->max_phase * sizeof(float));
+	table->cos_wave = realloc(table->cos_wave, table->max_phase * sizeof(float));
+	table->shared = 0;
+
+	share_table(sin_key, table->sin_wave, table->max_phase);
+	share_table(cos_key, table->cos_wave, table->max_phase);
+}
+
+static struct wave_table_t *get_wave_table(uint32_t rate, float freq) {
+	struct wave_table_t *table = NULL;
+
+	pthread_mutex_lock(&wave_table_mutex);
+
+	for (uint8_t i = 0; i < MAX_WAVE_TABLES; i++) {
+		if (wave_tables[i].users &&
+		    wave_tables[i].rate == rate && wave_tables[i].freq == freq) {
+			table = &wave_tables[i];
+			break;
+		}
+		if (table == NULL && !wave_tables[i].users) table = &wave_tables[i];
+	}
+
+	if (table == NULL) {
+		pthread_mutex_unlock(&wave_table_mutex);
+		return NULL;
+	}
+
+	if (!table->users) build_wave_table(table, rate, freq);
+	table->users++;
+
+	pthread_mutex_unlock(&wave_table_mutex);
+
+	return table;
+}
+
+static void put_wave_table(float *sin_wave) {
+	pthread_mutex_lock(&wave_table_mutex);
+
+	for (uint8_t i = 0; i < MAX_WAVE_TABLES; i++) {
+		if (!wave_tables[i].users || wave_tables[i].sin_wave != sin_wave) continue;
+		if (--wave_tables[i].users == 0 && !wave_tables[i].shared) {
+			free(wave_tables[i].sin_wave);
+			free(wave_tables[i].cos_wave);
+		}
+		break;
+	}
+
+	pthread_mutex_unlock(&wave_table_mutex);
+}
+
+/*
+ * Set up an oscillator for the frequencies in the array
+ *
+ */
+int8_t init_osc(struct osc_t *osc_ctx, uint32_t sample_rate, const float *c_freqs) {
+	struct wave_table_t *table;
 	uint8_t num_freqs = 0;
 	// look for the 0 terminator
 	for (;;) {
@@ -71,7 +173,7 @@ void init_osc(struct osc_t *osc_ctx, uint32_t sample_rate, const float *c_freqs)
 		num_freqs++;
 	}
 
-	osc_ctx->num_freqs = num_freqs;
+	osc_ctx->num_freqs = 0;
 
 	/*
 	 * waveform tables
@@ -79,28 +181,32 @@ void init_osc(struct osc_t *osc_ctx, uint32_t sample_rate, const float *c_freqs)
 	 * first index is wave frequency
 	 * second index is wave data
 	 */
-	osc_ctx->sine_waves = malloc(num_freqs * sizeof(float));
-	osc_ctx->cosine_waves = malloc(num_freqs * sizeof(float));
+	osc_ctx->sine_waves = malloc(num_freqs * sizeof(float *));
+	osc_ctx->cosine_waves = malloc(num_freqs * sizeof(float *));
 	/*
 	 * phase table
 	 *
 	 * current and max
 	 */
-	osc_ctx->phases = malloc(num_freqs * 2 * sizeof(uint16_t));
+	osc_ctx->phases = malloc(num_freqs * sizeof(uint16_t *));
 
 	for (uint8_t i = 0; i < num_freqs; i++) {
-		osc_ctx->sine_waves[i] = malloc(sample_rate * sizeof(float));
-		osc_ctx->cosine_waves[i] = malloc(sample_rate * sizeof(float));
+		table = get_wave_table(sample_rate, c_freqs[i]);
+		if (table == NULL) {
+			fprintf(stderr, "Error: too many carrier frequencies.\n");
+			exit_osc(osc_ctx);
+			return -1;
+		}
+
+		osc_ctx->sine_waves[i] = table->sin_wave;
+		osc_ctx->cosine_waves[i] = table->cos_wave;
 		osc_ctx->phases[i] = malloc(2 * sizeof(uint16_t));
 		osc_ctx->phases[i][CURRENT] = 0;
-
-		// create waveform data and load into lookup tables
-		create_wave(sample_rate, c_freqs[i],
-			osc_ctx->sine_waves[i],
-			osc_ctx->cosine_waves[i],
-			&osc_ctx->phases[i][MAX]
-		);
+		osc_ctx->phases[i][MAX] = table->max_phase;
+		osc_ctx->num_freqs++;
 	}
+
+	return 0;
 }
 
 /*
@@ -130,16 +236,16 @@ void update_osc_phase(struct osc_t *osc_ctx) {
 }
 
 /*
- * Unload all waveform and phase tables
+ * Release the waveform tables and free the phase tables
  *
  */
 void exit_osc(struct osc_t *osc_ctx) {
 	for (uint8_t i = 0; i < osc_ctx->num_freqs; i++) {
-		free(osc_ctx->sine_waves[i]);
-		free(osc_ctx->cosine_waves[i]);
+		put_wave_table(osc_ctx->sine_waves[i]);
 		free(osc_ctx->phases[i]);
 	}
 	free(osc_ctx->sine_waves);
 	free(osc_ctx->cosine_waves);
 	free(osc_ctx->phases);
+	osc_ctx->num_freqs = 0;
 }
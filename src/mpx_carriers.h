@@ -25,7 +25,7 @@ typedef struct osc_t {
 	uint8_t num_freqs;
 
 	/*
-	 * Arrays of carrier wave constants
+	 * Arrays of carrier wave constants (shared, do not write)
 	 *
 	 */
 	float **sine_waves;
@@ -44,7 +44,7 @@ enum osc_phase_index {
 	MAX
 };
 
-extern void init_osc(struct osc_t *osc_ctx, uint32_t sample_rate, const float *c_freqs);
+extern int8_t init_osc(struct osc_t *osc_ctx, uint32_t sample_rate, const float *c_freqs);
 extern float get_wave(struct osc_t *osc_ctx, uint8_t num, uint8_t cosine);
 extern void update_osc_phase(struct osc_t *osc_ctx);
 extern void exit_osc(struct osc_t *osc_ctx);
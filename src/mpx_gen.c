@@ -20,45 +20,95 @@
 #include <signal.h>
 #include <getopt.h>
 #include <pthread.h>
+#include <errno.h>
+#include <sys/epoll.h>
 
-#include "rds.h"
 #include "fm_mpx.h"
 #include "control_pipe.h"
-#include "audio_conversion.h"
+#include "control_socket.h"
 #include "resampler.h"
+#include "ring_buffer.h"
+#include "clock_drift.h"
+#include "latency.h"
 #include "input.h"
 #include "output.h"
+#include "station.h"
+#include "shared_tables.h"
+#include "dsp_kernels.h"
+#include "governor.h"
+
+// the encoder
+static struct fm_mpx_t encoder;
 
 // buffers
 static float *audio_in_buffer;
 static float *resampled_audio_in_buffer;
+static float *mpx_in_buffer;
 static float *mpx_buffer;
-static float *out_buffer;
+
+// frames of MPX generated at a time
+static size_t block_size = DEFAULT_BLOCK_SIZE;
+
+/*
+ * Resampled audio waiting to go through the MPX generator
+ *
+ * This is where the input and output clock domains meet. With live
+ * input the fill level is held at MPX_IN_TARGET_BLOCKS by the drift
+ * controller.
+ */
+#define MPX_IN_RING_BLOCKS	4
+#define MPX_IN_TARGET_BLOCKS	2
+static struct ring_buffer_t mpx_in_ring;
+static struct drift_ctl_t drift_ctl;
+
+// frames queued in the ring so far and when the last one was captured
+static struct sample_stamp_t mpx_in_stamp;
+// frames taken out of the ring so far
+static uint64_t mpx_in_pos;
+// set while live input is being (re)started
+static uint8_t prefill = 1;
+
+/*
+ * Subcarriers generated on their own thread
+ *
+ * The RDS encoders and modulators run alongside the audio chain and
+ * their blocks are summed into the MPX in the MPX thread. Both sides
+ * start on the same sample and go a block at a time, so they stay
+ * sample aligned.
+ */
+#define SUB_RING_BLOCKS	2
+static struct ring_buffer_t sub_ring;
+static float *sub_buffer;
+static float *sub_mix_buffer;
+
+// how often to report the clock drift (in seconds)
+#define DRIFT_REPORT_INTERVAL	10
+
+// descriptors the single thread loop can wait on
+#define MAX_POLL_FDS	16
 
 // pthread
 static pthread_t control_pipe_thread;
 static pthread_t input_thread;
-static pthread_t in_resampler_thread;
 static pthread_t mpx_thread;
-static pthread_t rds_thread;
-static pthread_t out_resampler_thread;
-static pthread_t output_thread;
-
-static pthread_mutex_t control_pipe_mutex	= PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t input_mutex		= PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t in_resampler_mutex	= PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t mpx_mutex		= PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t rds_mutex		= PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t out_resampler_mutex	= PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t output_mutex		= PTHREAD_MUTEX_INITIALIZER;
-
-static pthread_cond_t control_pipe_cond;
-static pthread_cond_t input_cond;
-static pthread_cond_t in_resampler_cond;
-static pthread_cond_t mpx_cond;
-static pthread_cond_t rds_cond;
-static pthread_cond_t out_resampler_cond;
-static pthread_cond_t output_cond;
+static pthread_t subcarrier_thread;
+static pthread_t governor_thread;
+
+/*
+ * Tier the governor asks for (-1 for none) and the load it saw. Set on
+ * the MPX thread and changed to on the governor thread, as setting up
+ * the filters allocates.
+ */
+static int8_t wanted_quality = -1;
+static uint16_t wanted_load;
+
+// used for waiting on the ring buffer
+static pthread_mutex_t ring_mutex	= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond		= PTHREAD_COND_INITIALIZER;
+
+// used for waiting on the subcarrier ring buffer
+static pthread_mutex_t sub_mutex	= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sub_cond		= PTHREAD_COND_INITIALIZER;
 
 static uint8_t stop_mpx;
 
@@ -74,219 +124,483 @@ static void shutdown() {
 static void free_and_shutdown() {
 	fprintf(stderr, "Freeing buffers...\n");
 	if (mpx_buffer != NULL) free(mpx_buffer);
-	if (out_buffer != NULL) free(out_buffer);
 	if (audio_in_buffer != NULL) free(audio_in_buffer);
 	if (resampled_audio_in_buffer != NULL) free(resampled_audio_in_buffer);
+	if (mpx_in_buffer != NULL) free(mpx_in_buffer);
+	if (sub_buffer != NULL) free(sub_buffer);
+	if (sub_mix_buffer != NULL) free(sub_mix_buffer);
 	shutdown();
 }
 
+// wakes up any thread waiting on the ring buffer
+static void ring_broadcast() {
+	pthread_mutex_lock(&ring_mutex);
+	pthread_cond_broadcast(&ring_cond);
+	pthread_mutex_unlock(&ring_mutex);
+}
+
+// wakes up any thread waiting on the subcarrier ring buffer
+static void sub_broadcast() {
+	pthread_mutex_lock(&sub_mutex);
+	pthread_cond_broadcast(&sub_cond);
+	pthread_mutex_unlock(&sub_mutex);
+}
+
 // structs for the threads
-typedef struct resample_thread_args_t {
-	SRC_STATE **state;
-	SRC_DATA data;
+typedef struct input_thread_args_t {
+	struct resampler_t *resampler;
 	float *in;
 	float *out;
-	size_t frames_in;
-	size_t frames_out;
+	// nominal resampling ratio
 	double ratio;
-} resample_thread_args_t;
-
-typedef struct audio_io_thread_args_t {
-	float *data;
-	size_t frames;
-} audio_io_thread_args_t;
+	uint32_t sample_rate;
+	// capture time of the last frame read
+	struct timespec captured;
+	uint8_t latency_test;
+	// frames since the last drift report
+	uint64_t report_frames;
+} input_thread_args_t;
 
 typedef struct mpx_thread_args_t {
 	float *in;
-	float *out;
-	size_t frames;
+	float *mpx;
+	uint8_t audio;
+	uint8_t latency;
+	uint8_t latency_test;
+	// subcarriers are generated on their own thread
+	uint8_t split;
+	// the block being generated
+	struct sample_stamp_t block;
+	struct latency_stats_t stats;
+	// steps the quality down when the encoder falls behind
+	uint8_t governor;
+	struct governor_t gov;
+	// changes are set up on the governor thread, if there is one
+	uint8_t governor_thread;
 } mpx_thread_args_t;
 
+typedef struct control_thread_args_t {
+	uint8_t pipe;
+	uint8_t socket;
+	struct control_pipe_t ctl_pipe;
+	struct control_socket_t ctl_socket;
+} control_thread_args_t;
+
 // threads
-static void *control_pipe_worker() {
+static void *control_pipe_worker(void *arg) {
+	struct control_thread_args_t *args = (struct control_thread_args_t *)arg;
+
 	while (!stop_mpx) {
-		poll_control_pipe();
-		usleep(10000);
+		if (args->pipe) poll_control_pipe(&args->ctl_pipe);
+		if (args->socket) {
+			// waits up to 10 ms for commands
+			poll_control_socket(&args->ctl_socket, 10);
+		} else {
+			usleep(10000);
+		}
+		finish_change(&encoder);
 	}
 
-	close_control_pipe();
+	if (args->pipe) close_control_pipe(&args->ctl_pipe);
+	if (args->socket) close_control_socket(&args->ctl_socket);
 	pthread_exit(NULL);
 }
 
+/*
+ * Queues resampled frames for the MPX generator
+ *
+ * Files and pipes are only read as fast as the output needs them, so
+ * this waits for space. A live source cannot be held up, so whatever
+ * does not fit is dropped.
+ */
+static void push_mpx_in(float *in, size_t frames, uint8_t live) {
+	size_t written;
+
+	while (frames && !stop_mpx) {
+		written = ring_buffer_write(&mpx_in_ring, in, frames);
+		in += written * 2;
+		frames -= written;
+
+		pthread_mutex_lock(&ring_mutex);
+		if (written) pthread_cond_broadcast(&ring_cond);
+		if (frames && live) {
+			pthread_mutex_unlock(&ring_mutex);
+			fprintf(stderr, "Warning: MPX input overrun, dropped %zu frames.\n", frames);
+			return;
+		}
+		if (frames && !stop_mpx && !ring_buffer_space(&mpx_in_ring))
+			pthread_cond_wait(&ring_cond, &ring_mutex);
+		pthread_mutex_unlock(&ring_mutex);
+	}
+}
+
+/*
+ * Input callback of the input resampler
+ */
+static long read_input_frames(void *data, float **audio) {
+	struct input_thread_args_t *args = (struct input_thread_args_t *)data;
+	int frames;
+
+	*audio = args->in;
+
+	// live input can come back empty, that is not the end of it
+	do {
+		frames = read_input(args->in);
+		if (frames < 0) {
+			stop_mpx = 1;
+			return 0;
+		}
+	} while (frames == 0 && !stop_mpx);
+
+	// the rest of the capture buffer came in after this block
+	get_stamp_time(&args->captured);
+	offset_stamp_time(&args->captured, -(double)get_input_delay() / args->sample_rate);
+
+	if (args->latency_test) insert_test_pulse(args->in, frames, &args->captured);
+
+	return frames;
+}
+
+/*
+ * Reads audio and brings it up to the MPX sample rate
+ *
+ * With live input the resampling ratio is corrected by the drift
+ * controller so the capture and playback clocks can differ.
+ */
+static int8_t pull_input(struct input_thread_args_t *args, size_t frames_wanted, uint8_t live) {
+	struct resampler_t *rs = args->resampler;
+	int32_t frames;
+
+	if (live) {
+		rs->ratio = args->ratio *
+			update_drift_ctl(&drift_ctl, ring_buffer_fill(&mpx_in_ring));
+	}
+
+	frames = resample(rs, args->out, frames_wanted);
+	if (frames < 0) return -1;
+
+	/*
+	 * The last frame out of the resampler is taken to be the last
+	 * one captured. This is off by the resampler delay, which is
+	 * what the loopback test is for.
+	 */
+	pthread_mutex_lock(&ring_mutex);
+	mpx_in_stamp.pos += frames;
+	mpx_in_stamp.time = args->captured;
+	pthread_mutex_unlock(&ring_mutex);
+
+	push_mpx_in(args->out, frames, live);
+
+	args->report_frames += frames;
+	if (live && args->report_frames >= MPX_SAMPLE_RATE * DRIFT_REPORT_INTERVAL) {
+		fprintf(stderr, "Clock drift: %+.1f ppm\n", get_drift_ppm(&drift_ctl));
+		args->report_frames = 0;
+	}
+
+	return 0;
+}
+
 static void *input_worker(void *arg) {
-	int8_t r;
-	short buf[NUM_AUDIO_FRAMES_IN*2];
-	audio_io_thread_args_t *args = (audio_io_thread_args_t *)arg;
-	float *audio = args->data;
-	size_t frames = args->frames;
+	struct input_thread_args_t *args = (struct input_thread_args_t *)arg;
+	uint8_t live = is_live_input();
 
 	while (!stop_mpx) {
-		r = read_input(buf);
-		if (r < 0) break;
-		short2float(buf, audio, frames*2);
-		pthread_cond_signal(&in_resampler_cond);
+		// half a block at a time
+		if (pull_input(args, block_size / 2, live) < 0) {
+			stop_mpx = 1;
+			break;
+		}
 	}
 
+	ring_broadcast();
 	pthread_exit(NULL);
 }
 
-// memcpy for copying float frames
-#define floatf_memcpy(x, y, z) memcpy(x, y, z * 2 * sizeof(float))
-
-static void *in_resampler_worker(void *arg) {
-	int8_t r;
-	static float outbuf[NUM_AUDIO_FRAMES_OUT*2];
-	static float leftoverbuf[NUM_AUDIO_FRAMES_OUT*2];
-	static size_t outframes;
-	static size_t total_outframes;
-	static size_t extra_frames;
-
-	struct resample_thread_args_t *args = (struct resample_thread_args_t *)arg;
-
-	float *in = args->in;
-	float *out = args->out;
-	size_t frames_in = args->frames_in;
-	size_t frames_out = args->frames_out;
-	SRC_STATE *src_state = *args->state;
-	SRC_DATA src_data = args->data;
-	src_data.data_in = in;
-	src_data.data_out = outbuf;
-	src_data.input_frames = frames_in;
-	src_data.output_frames = frames_out;
-	src_data.src_ratio = args->ratio;
+/*
+ * Gets a block of audio for the MPX generator and the capture time of
+ * its first frame
+ *
+ * Live input is (re)started with the ring buffer at the target fill
+ * level. If it runs dry after that the rest of the block is silence
+ * instead of holding up the output.
+ */
+static void get_mpx_in(float *out, uint8_t live, struct timespec *captured) {
+	size_t wanted = live && prefill ? block_size * MPX_IN_TARGET_BLOCKS : block_size;
+	size_t frames;
 
-	while (!stop_mpx) {
-		pthread_cond_wait(&in_resampler_cond, &in_resampler_mutex);
-		if (extra_frames) {
-			floatf_memcpy(out, leftoverbuf, extra_frames);
-			total_outframes += extra_frames;
-			extra_frames = 0;
-		}
-		while (total_outframes < frames_out) {
-			r = resample(src_state, src_data, &outframes);
-			if (r < 0) break;
-			floatf_memcpy(src_data.data_out, outbuf + outframes, outframes);
-			src_data.data_out += outframes*2;
-			total_outframes += outframes;
-		}
-		// when there are excess frames
-		if (total_outframes > frames_out) {
-			extra_frames = total_outframes - frames_out;
-			floatf_memcpy(out, src_data.data_out, frames_out);
-			floatf_memcpy(leftoverbuf, src_data.data_out + extra_frames, extra_frames);
-		}
-		if (total_outframes == frames_out) {
-			floatf_memcpy(out, src_data.data_out, frames_out);
+	pthread_mutex_lock(&ring_mutex);
+	while (!stop_mpx && ring_buffer_fill(&mpx_in_ring) < wanted) {
+		if (live && !prefill) break;
+		pthread_cond_wait(&ring_cond, &ring_mutex);
+	}
+	get_stamp_at(&mpx_in_stamp, mpx_in_pos, MPX_SAMPLE_RATE, captured);
+	pthread_mutex_unlock(&ring_mutex);
+
+	frames = ring_buffer_read(&mpx_in_ring, out, block_size);
+	mpx_in_pos += frames;
+	prefill = 0;
+	if (frames < block_size) {
+		memset(out + frames * 2, 0, (block_size - frames) * 2 * sizeof(float));
+		if (live && !stop_mpx) {
+			fprintf(stderr, "Warning: MPX input underrun.\n");
+			prefill = 1;
 		}
-		src_data.data_out = out;
-		total_outframes = 0;
 	}
 
-	pthread_exit(NULL);
+	ring_broadcast();
 }
 
-static void *mpx_worker(void *arg) {
-	struct mpx_thread_args_t *args = (struct mpx_thread_args_t *)arg;
-	float *audio_in = args->in;
-	float *mpx_out = args->out;
+/*
+ * Works out when the block that was just written will be played and
+ * how long that is after it was captured
+ */
+static void measure_latency(struct mpx_thread_args_t *args,
+	struct sample_stamp_t *block, struct latency_stats_t *stats) {
+	long delay = get_output_delay();
+	struct timespec played;
+	struct timespec pulse_played;
+	size_t peak_frame, frames;
+	float peak;
+	double latency;
+
+	// last frame of the block
+	get_stamp_time(&played);
+	offset_stamp_time(&played, (double)delay / OUTPUT_SAMPLE_RATE);
+	latency = stamp_time_diff(&played, &block->time) -
+		block_size * 1000.0 / MPX_SAMPLE_RATE;
+	add_latency(stats, latency);
+
+	if (args->latency_test) {
+		peak = get_output_peak(&peak_frame, &frames);
+		pulse_played = played;
+		offset_stamp_time(&pulse_played,
+			-(double)(frames - 1 - peak_frame) / OUTPUT_SAMPLE_RATE);
+		find_test_pulse(peak, &pulse_played, latency);
+	}
+
+	if (block->pos % (MPX_SAMPLE_RATE * LATENCY_REPORT_INTERVAL) < block_size)
+		print_latency_stats(stats);
+}
 
+/*
+ * Generates the subcarriers ahead of the MPX thread
+ */
+static void *subcarrier_worker() {
 	while (!stop_mpx) {
-		pthread_cond_wait(&mpx_cond, &mpx_mutex);
-		fm_mpx_get_samples(audio_in, mpx_out);
-		pthread_cond_signal(&output_cond);
+		fm_mpx_get_subcarriers(&encoder, sub_buffer, block_size);
+
+		pthread_mutex_lock(&sub_mutex);
+		while (!stop_mpx && ring_buffer_space(&sub_ring) < block_size)
+			pthread_cond_wait(&sub_cond, &sub_mutex);
+		pthread_mutex_unlock(&sub_mutex);
+
+		ring_buffer_write(&sub_ring, sub_buffer, block_size);
+		sub_broadcast();
 	}
 
 	pthread_exit(NULL);
 }
 
-static void *rds_worker(void *arg) {
-	struct mpx_thread_args_t *args = (struct mpx_thread_args_t *)arg;
-	float *rds_out = args->out;
+/*
+ * Sums the subcarriers for this block into the MPX, waiting for the
+ * subcarrier thread if it is behind
+ */
+static void merge_subcarriers(float *mpx) {
+	pthread_mutex_lock(&sub_mutex);
+	while (!stop_mpx && ring_buffer_fill(&sub_ring) < block_size)
+		pthread_cond_wait(&sub_cond, &sub_mutex);
+	pthread_mutex_unlock(&sub_mutex);
 
-	while (!stop_mpx) {
-		//pthread_cond_wait(&rds_cond, &rds_mutex);
-		fm_rds_get_samples(rds_out);
-		//pthread_cond_signal(&output_cond);
-	}
+	if (ring_buffer_read(&sub_ring, sub_mix_buffer, block_size) < block_size) return;
+	sub_broadcast();
 
+	fm_mpx_mix(mpx, sub_mix_buffer, block_size);
+}
 
-	pthread_exit(NULL);
+static void change_governed_quality(int8_t quality, uint16_t load) {
+	if (change_quality(&encoder, quality) < 0) return;
+	fprintf(stderr, "Quality: %s (encoder load %u%%)\n",
+		get_quality_name(quality), load);
 }
 
-static void *out_resampler_worker(void *arg) {
-	int8_t r;
-	static float outbuf[NUM_MPX_FRAMES_OUT*2];
-	static float leftoverbuf[NUM_MPX_FRAMES_OUT*2];
-	static size_t outframes;
-	static size_t total_outframes;
-	static size_t extra_frames;
-
-	struct resample_thread_args_t *args = (struct resample_thread_args_t *)arg;
-
-	float *in = args->in;
-	float *out = args->out;
-	size_t frames_in = args->frames_in;
-	size_t frames_out = args->frames_out;
-	SRC_STATE *src_state = *args->state;
-	SRC_DATA src_data = args->data;
-	src_data.data_in = in;
-	src_data.data_out = outbuf;
-	src_data.input_frames = frames_in;
-	src_data.output_frames = frames_out;
-	src_data.src_ratio = args->ratio;
+/*
+ * Changes the quality tier if the governor asks for it. Only the
+ * request is made here, the change is set up on the governor thread.
+ */
+static void govern_quality(struct mpx_thread_args_t *args) {
+	int8_t quality = end_governor_block(&args->gov, encoder.filters.quality);
+	uint16_t load = args->gov.load * 100.0 + 0.5;
+
+	if (quality < 0) return;
+	if (!args->governor_thread) {
+		change_governed_quality(quality, load);
+		finish_change(&encoder);
+		return;
+	}
+	__atomic_store_n(&wanted_load, load, __ATOMIC_RELAXED);
+	__atomic_store_n(&wanted_quality, quality, __ATOMIC_RELEASE);
+}
+
+static void *governor_worker() {
+	int8_t quality;
 
 	while (!stop_mpx) {
-		pthread_cond_wait(&out_resampler_cond, &out_resampler_mutex);
-		if (extra_frames) {
-			floatf_memcpy(out, leftoverbuf, extra_frames);
-			total_outframes += extra_frames;
-			extra_frames = 0;
+		quality = __atomic_exchange_n(&wanted_quality, -1, __ATOMIC_ACQUIRE);
+		if (quality >= 0) {
+			change_governed_quality(quality,
+				__atomic_load_n(&wanted_load, __ATOMIC_RELAXED));
 		}
-		while (total_outframes < frames_out) {
-			r = resample(src_state, src_data, &outframes);
-			if (r < 0) break;
-			floatf_memcpy(src_data.data_out, outbuf + outframes, outframes);
-			src_data.data_out += outframes*2;
-			total_outframes += outframes;
-		}
-		// when there are excess frames
-		if (total_outframes > frames_out) {
-			extra_frames = total_outframes - frames_out;
-			floatf_memcpy(out, src_data.data_out, frames_out);
-			floatf_memcpy(leftoverbuf, src_data.data_out + extra_frames, extra_frames);
-		}
-		if (total_outframes == frames_out) {
-			floatf_memcpy(out, src_data.data_out, frames_out);
-		}
-		src_data.data_out = out;
-		total_outframes = 0;
+		finish_change(&encoder);
+		usleep(10000);
 	}
 
 	pthread_exit(NULL);
 }
 
-static void *output_worker(void *arg) {
-	int8_t r;
-	static short buf[NUM_MPX_FRAMES_IN*2];
-	struct audio_io_thread_args_t *args = (struct audio_io_thread_args_t *)arg;
-	size_t frames = args->frames;
-	float *audio = args->data;
+/*
+ * Generates a block of MPX and writes it out
+ *
+ * Every block carries its position on the MPX sample clock and the
+ * time it was captured.
+ */
+static int8_t put_mpx_block(struct mpx_thread_args_t *args, uint8_t live) {
+	if (args->audio) {
+		get_mpx_in(args->in, live, &args->block.time);
+		if (args->governor) start_governor_block(&args->gov);
+		if (args->split) {
+			fm_mpx_get_audio(&encoder, args->in, args->mpx, block_size);
+		} else {
+			fm_mpx_get_samples(&encoder, args->in, args->mpx, block_size);
+		}
+		if (args->governor) govern_quality(args);
+		if (args->split) merge_subcarriers(args->mpx);
+	} else {
+		// generated on the spot
+		get_stamp_time(&args->block.time);
+		fm_rds_get_samples(&encoder, args->mpx, block_size);
+	}
+
+	// resampled, scaled and converted in one pass
+	if (write_output(args->mpx, block_size, get_output_volume(&encoder)) < 0) return -1;
+
+	args->block.pos += block_size;
+	if (args->latency) measure_latency(args, &args->block, &args->stats);
+
+	return 0;
+}
+
+/*
+ * This thread runs at the pace of the output so it is what clocks
+ * the whole chain.
+ */
+static void *mpx_worker(void *arg) {
+	struct mpx_thread_args_t *args = (struct mpx_thread_args_t *)arg;
+	uint8_t live = is_live_input();
 
 	while (!stop_mpx) {
-		//pthread_cond_wait(&output_cond, &output_mutex);
-		float2short(audio, buf, frames*2);
-		r = write_output(buf, frames);
-		if (r < 0) {
+		if (put_mpx_block(args, live) < 0) {
 			stop_mpx = 1;
 			break;
 		}
-		pthread_cond_signal(&mpx_cond);
-		pthread_cond_signal(&rds_cond);
 	}
 
+	ring_broadcast();
 	pthread_exit(NULL);
 }
 
+/*
+ * Runs the whole chain on one thread
+ *
+ * On a single core the threads mostly hand blocks to each other and
+ * the context switches cost more than they are worth. Here the input,
+ * MPX and output stages are called one after the other from an epoll
+ * loop over the sound card descriptors. Files are always ready, so
+ * with file input and output this is a plain loop which gives the
+ * same output as the threads.
+ *
+ * The control pipe and socket are checked once a block rather than
+ * being in the epoll set, as a FIFO stays readable once its writer
+ * has gone away.
+ */
+static void run_single_thread(struct input_thread_args_t *in_args,
+	struct mpx_thread_args_t *mpx_args, struct control_thread_args_t *ctl_args) {
+	struct pollfd fds[MAX_POLL_FDS];
+	struct epoll_event ev;
+	struct epoll_event events[MAX_POLL_FDS];
+	uint8_t live = mpx_args->audio && is_live_input();
+	int in_fds = 0, out_fds;
+	size_t live_pull = 0;
+	size_t wanted;
+	int epfd;
+
+	epfd = epoll_create1(0);
+	if (epfd == -1) {
+		fprintf(stderr, "Error: could not create epoll instance.\n");
+		return;
+	}
+
+	if (live) {
+		in_fds = get_input_fds(fds, MAX_POLL_FDS);
+		// one input block's worth at a time so reads do not wait
+		live_pull = block_size / INPUT_BLOCK_DIVIDER * in_args->ratio;
+	}
+	out_fds = get_output_fds(fds + in_fds, MAX_POLL_FDS - in_fds);
+	if (in_fds < 0 || out_fds < 0) {
+		fprintf(stderr, "Error: too many poll descriptors.\n");
+		close(epfd);
+		return;
+	}
+
+	for (int i = 0; i < in_fds + out_fds; i++) {
+		// the poll and epoll event bits are the same
+		ev.events = fds[i].events;
+		ev.data.fd = fds[i].fd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i].fd, &ev);
+	}
+
+	while (!stop_mpx) {
+		if (ctl_args->pipe) poll_control_pipe(&ctl_args->ctl_pipe);
+		if (ctl_args->socket) poll_control_socket(&ctl_args->ctl_socket, 0);
+		finish_change(&encoder);
+
+		// signals interrupt the wait
+		if (in_fds + out_fds && epoll_wait(epfd, events, MAX_POLL_FDS, 100) < 0 &&
+		    errno != EINTR) {
+			fprintf(stderr, "Error: epoll_wait failed.\n");
+			break;
+		}
+
+		// take in all of the captured audio first
+		while (live && !stop_mpx && input_ready()) {
+			if (pull_input(in_args, live_pull, live) < 0) stop_mpx = 1;
+		}
+
+		if (stop_mpx || !output_ready()) continue;
+
+		// files are read as needed, live input only when (re)starting
+		if (mpx_args->audio) {
+			if (live) {
+				wanted = prefill ? block_size * MPX_IN_TARGET_BLOCKS : 0;
+			} else {
+				wanted = block_size;
+			}
+
+			while (!stop_mpx && ring_buffer_fill(&mpx_in_ring) < wanted) {
+				if (pull_input(in_args, live ? live_pull : block_size / 2, live) < 0)
+					stop_mpx = 1;
+			}
+			if (stop_mpx) break;
+		}
+
+		if (put_mpx_block(mpx_args, live) < 0) break;
+	}
+
+	stop_mpx = 1;
+	close(epfd);
+	if (ctl_args->pipe) close_control_pipe(&ctl_args->ctl_pipe);
+	if (ctl_args->socket) close_control_socket(&ctl_args->ctl_socket);
+}
+
 static void show_help(char *name, struct rds_params_t def_params) {
 	fprintf(stderr,
 		"This is Mpxgen, a lightweight Stereo and RDS encoder.\n"
@@ -297,15 +611,42 @@ static void show_help(char *name, struct rds_params_t def_params) {
 		"\n"
 		"    -a / --audio        Input file, pipe or ALSA capture\n"
 		"    -o / --output-file  PCM out\n"
+		"    -F / --format       Output sample format (s16, s24, s32 or float)\n"
 		"\n"
 		"[MPX controls]\n"
 		"\n"
 		"    -m / --mpx          MPX volume\n"
 		"    -W / --wait         Wait for new audio\n"
+		"    -e / --alsa-period  ALSA capture period size (frames)\n"
+		"    -b / --alsa-buffer  ALSA capture buffer size (frames)\n"
+		"    -B / --block-size   MPX block size (frames at 190 kHz)\n"
+		"    -L / --latency      Report the capture to output latency\n"
+		"    -l / --latency-test Measure the latency with a loopback test\n"
+		"    -t / --single-thread Run everything on one thread\n"
+		"    -j / --subcarrier-thread Generate RDS on its own thread\n"
+		"                        [default: 1 on multi-core systems]\n"
+		"    -g / --shared-tables Share the DSP tables with other instances\n"
+		"    -K / --kernels      DSP kernels (auto, bench, scalar, sse2, avx2,\n"
+		"                        avx512 or neon) [default: auto]\n"
+		"    -Q / --fixed-point  Run the MPX encoder core with fixed-point (Q15)\n"
+		"                        math, the resamplers stay float\n"
+		"    -q / --quality      Filter quality (low, standard or reference)\n"
+		"                        [default: standard]\n"
+		"    -G / --governor     Lower the quality when the encoder falls behind\n"
+		"    -x / --stereo-mode  Stereo subcarrier (ssb, dsb or asym) [default: ssb]\n"
+		"    -y / --asymmetry    Sideband balance of asym, from -1 (lower only)\n"
+		"                        to 1 (upper only) [default: -0.5]\n"
+		"\n"
+		"[Multiple stations]\n"
+		"\n"
+		"    -M / --stations     Run all stations in a station file\n"
+		"    -w / --workers      Number of worker threads\n"
+		"                        [default: 1 per CPU]\n"
 		"\n"
 		"[RDS encoder]\n"
 		"\n"
 		"    -R / --rds          RDS switch\n"
+		"    -D / --rds2         Number of RDS2 streams (0 - 3) [default: 0]\n"
 		"\n"
 		"    -i / --pi           Program Identification code [default: %04X]\n"
 		"    -s / --ps           Program Service name [default: \"%s\"]\n"
@@ -318,6 +659,7 @@ static void show_help(char *name, struct rds_params_t def_params) {
 		"    -S / --callsign     Callsign to calculate the PI code from\n"
 		"                        (overrides -i/--pi)\n"
 		"    -C / --ctl          Control pipe\n"
+		"    -u / --ctl-socket   Control socket (UNIX domain)\n"
 		"\n",
 		name,
 		def_params.pi, def_params.ps,
@@ -326,6 +668,34 @@ static void show_help(char *name, struct rds_params_t def_params) {
 	);
 }
 
+/*
+ * Adds up the buffering between the input and the output
+ *
+ * The typical figure assumes the drift controller is holding the input
+ * ring at its target. The worst case is every buffer being full.
+ */
+static void print_latency(uint32_t in_rate, size_t input_frames, uint8_t live) {
+	double block_ms = block_size * 1000.0 / MPX_SAMPLE_RATE;
+	double output_ms = get_output_buffer_frames() * 1000.0 / OUTPUT_SAMPLE_RATE;
+	double ring_ms = block_size * MPX_IN_RING_BLOCKS * 1000.0 / MPX_SAMPLE_RATE;
+	double target_ms = block_size * MPX_IN_TARGET_BLOCKS * 1000.0 / MPX_SAMPLE_RATE;
+	double fixed_ms;
+
+	fixed_ms = block_ms + output_ms;
+	if (in_rate) {
+		fixed_ms += input_frames * 1000.0 / in_rate;
+		fixed_ms += block_ms / 2; // resampler pull
+	}
+
+	fprintf(stderr, "Block size: %zu frames (%.2f ms)\n", block_size, block_ms);
+	if (in_rate) {
+		fprintf(stderr, "Pipeline latency: %.1f ms typical, %.1f ms worst case\n",
+			fixed_ms + (live ? target_ms : ring_ms), fixed_ms + ring_ms);
+	} else {
+		fprintf(stderr, "Pipeline latency: %.1f ms\n", fixed_ms);
+	}
+}
+
 // check MPX volume level
 static uint8_t check_mpx_vol(uint8_t volume) {
 	if (volume < 1 || volume > 100) {
@@ -340,7 +710,11 @@ int main(int argc, char **argv) {
 	char audio_file[51] = {0};
 	char output_file[51] = {0};
 	char control_pipe[51] = {0};
+	char control_socket[51] = {0};
+	char station_file[51] = {0};
+	uint16_t workers = 0;
 	uint8_t rds = 1;
+	uint8_t rds2_streams = 0;
 	struct rds_params_t rds_params = {
 		.ps = "Mpxgen",
 		.rt = "Mpxgen: FM Stereo and RDS encoder",
@@ -352,28 +726,70 @@ int main(int argc, char **argv) {
 	char tmp_ptyn[9] = {0};
 	uint8_t mpx = 50;
 	uint8_t wait = 1;
+	int8_t output_format = OUTPUT_FORMAT_S16;
+	size_t alsa_period = 0;
+	size_t alsa_buffer = 0;
+	size_t input_frames;
+	uint8_t latency = 0;
+	uint8_t latency_test = 0;
+	uint8_t single_thread = 0;
+	int8_t split = -1;
+	uint8_t shared_tables = 0;
+	char kernels[16] = "auto";
+	uint8_t fixed_point = 0;
+	int8_t quality = QUALITY_STANDARD;
+	uint8_t governor = 0;
+	int8_t stereo_mode = STEREO_SSB;
+	float asymmetry = DEFAULT_ASYMMETRY;
 
 	int8_t r;
 
 	// SRC
-	SRC_STATE *src_state[2];
-	SRC_DATA src_data[2];
+	struct resampler_t in_resampler = {NULL, 0.0};
+	uint32_t sample_rate = 0;
 
-	uint8_t output_open_success = 0;
+	uint8_t input_open_success = 0;
 
 	// pthread
 	pthread_attr_t attr;
-
-	const char	*short_opt = "a:o:m:W:R:i:s:r:p:T:A:P:S:C:h";
+	struct input_thread_args_t input_thread_args;
+	struct mpx_thread_args_t mpx_thread_args;
+	struct control_thread_args_t control_thread_args;
+	uint8_t input_thread_running = 0;
+	uint8_t mpx_thread_running = 0;
+	uint8_t subcarrier_thread_running = 0;
+	uint8_t control_thread_running = 0;
+	uint8_t governor_thread_running = 0;
+
+	const char	*short_opt = "a:o:F:m:W:e:b:B:Lltj:gK:Qq:Gx:y:M:w:R:D:i:s:r:p:T:A:P:S:C:u:h";
 	struct option	long_opt[] =
 	{
 		{"audio",	required_argument, NULL, 'a'},
 		{"output-file",	required_argument, NULL, 'o'},
+		{"format",	required_argument, NULL, 'F'},
 
 		{"mpx",		required_argument, NULL, 'm'},
 		{"wait",	required_argument, NULL, 'W'},
+		{"alsa-period",	required_argument, NULL, 'e'},
+		{"alsa-buffer",	required_argument, NULL, 'b'},
+		{"block-size",	required_argument, NULL, 'B'},
+		{"latency",	no_argument, NULL, 'L'},
+		{"latency-test",	no_argument, NULL, 'l'},
+		{"single-thread",	no_argument, NULL, 't'},
+		{"subcarrier-thread",	required_argument, NULL, 'j'},
+		{"shared-tables",	no_argument, NULL, 'g'},
+		{"kernels",	required_argument, NULL, 'K'},
+		{"fixed-point",	no_argument, NULL, 'Q'},
+		{"quality",	required_argument, NULL, 'q'},
+		{"governor",	no_argument, NULL, 'G'},
+		{"stereo-mode",	required_argument, NULL, 'x'},
+		{"asymmetry",	required_argument, NULL, 'y'},
+
+		{"stations",	required_argument, NULL, 'M'},
+		{"workers",	required_argument, NULL, 'w'},
 
 		{"rds",		required_argument, NULL, 'R'},
+		{"rds2",	required_argument, NULL, 'D'},
 		{"pi",		required_argument, NULL, 'i'},
 		{"ps",		required_argument, NULL, 's'},
 		{"rt",		required_argument, NULL, 'r'},
@@ -383,6 +799,7 @@ int main(int argc, char **argv) {
 		{"ptyn",	required_argument, NULL, 'P'},
 		{"callsign",	required_argument, NULL, 'S'},
 		{"ctl",		required_argument, NULL, 'C'},
+		{"ctl-socket",	required_argument, NULL, 'u'},
 
 		{"help",	no_argument, NULL, 'h'},
 		{ 0,		0,		0,	0 }
@@ -398,6 +815,14 @@ int main(int argc, char **argv) {
 				strncpy(output_file, optarg, 50);
 				break;
 
+			case 'F': //format
+				output_format = parse_output_format(optarg);
+				if (output_format < 0) {
+					fprintf(stderr, "Unknown output format: %s.\n", optarg);
+					return 1;
+				}
+				break;
+
 			case 'm': //mpx
 				mpx = strtoul(optarg, NULL, 10);
 				if (check_mpx_vol(mpx) > 0) return 1;
@@ -407,10 +832,96 @@ int main(int argc, char **argv) {
 				wait = strtoul(optarg, NULL, 10);
 				break;
 
+			case 'e': //alsa-period
+				alsa_period = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'b': //alsa-buffer
+				alsa_buffer = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'B': //block-size
+				block_size = strtoul(optarg, NULL, 10);
+				if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE) {
+					fprintf(stderr, "Block size must be between %d - %d.\n",
+						MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+					return 1;
+				}
+				break;
+
+			case 'L': //latency
+				latency = 1;
+				break;
+
+			case 'l': //latency-test
+				latency = 1;
+				latency_test = 1;
+				break;
+
+			case 't': //single-thread
+				single_thread = 1;
+				break;
+
+			case 'j': //subcarrier-thread
+				split = strtoul(optarg, NULL, 10) ? 1 : 0;
+				break;
+
+			case 'g': //shared-tables
+				shared_tables = 1;
+				break;
+
+			case 'K': //kernels
+				strncpy(kernels, optarg, 15);
+				break;
+
+			case 'Q': //fixed-point
+				fixed_point = 1;
+				break;
+
+			case 'q': //quality
+				quality = parse_quality(optarg);
+				if (quality < 0) {
+					fprintf(stderr, "Unknown quality: %s.\n", optarg);
+					return 1;
+				}
+				break;
+
+			case 'G': //governor
+				governor = 1;
+				break;
+
+			case 'x': //stereo-mode
+				stereo_mode = parse_stereo_mode(optarg);
+				if (stereo_mode < 0) {
+					fprintf(stderr, "Unknown stereo mode: %s.\n", optarg);
+					return 1;
+				}
+				break;
+
+			case 'y': //asymmetry
+				asymmetry = strtof(optarg, NULL);
+				if (asymmetry < -1.0f || asymmetry > 1.0f) {
+					fprintf(stderr, "Asymmetry must be between -1 and 1.\n");
+					return 1;
+				}
+				break;
+
+			case 'M': //stations
+				strncpy(station_file, optarg, 50);
+				break;
+
+			case 'w': //workers
+				workers = strtoul(optarg, NULL, 10);
+				break;
+
 			case 'R': //rds
 				rds = strtoul(optarg, NULL, 10);
 				break;
 
+			case 'D': //rds2
+				rds2_streams = strtoul(optarg, NULL, 10);
+				break;
+
 			case 'i': //pi
 				rds_params.pi = strtoul(optarg, NULL, 16);
 				break;
@@ -450,6 +961,10 @@ int main(int argc, char **argv) {
 				strncpy(control_pipe, optarg, 50);
 				break;
 
+			case 'u': //ctl-socket
+				strncpy(control_socket, optarg, 50);
+				break;
+
 			case 'h': //help
 			case '?':
 			default:
@@ -458,31 +973,50 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	if (init_dsp_kernels(kernels) < 0) return 1;
+	fprintf(stderr, "Using %s DSP kernels.\n", get_dsp_isa());
+
+	// private tables are used if this fails
+	if (shared_tables) open_shared_tables();
+
+	if (station_file[0]) {
+		// Gracefully stop the encoders on SIGINT or SIGTERM
+		signal(SIGINT, stop);
+		signal(SIGTERM, stop);
+
+		r = run_stations(station_file, block_size, output_format,
+			workers, &stop_mpx);
+		close_shared_tables();
+		return r < 0 ? 1 : 0;
+	}
+
 	if (!audio_file[0] && !rds) {
 		fprintf(stderr, "Nothing to do. Exiting.\n");
 		return 1;
 	}
 
+	if (latency_test && !audio_file[0]) {
+		fprintf(stderr, "The latency test needs an audio input.\n");
+		return 1;
+	}
+
+	input_frames = block_size / INPUT_BLOCK_DIVIDER;
+
+	// only worth it with another core to run on
+	if (split < 0) split = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+	if (single_thread || !audio_file[0] || !rds) split = 0;
+
+	memset(&input_thread_args, 0, sizeof(struct input_thread_args_t));
+	memset(&mpx_thread_args, 0, sizeof(struct mpx_thread_args_t));
+	memset(&control_thread_args, 0, sizeof(struct control_thread_args_t));
+
 	// Initialize pthread stuff
-	pthread_mutex_init(&control_pipe_mutex, NULL);
-	pthread_mutex_init(&input_mutex, NULL);
-	pthread_mutex_init(&in_resampler_mutex, NULL);
-	pthread_mutex_init(&mpx_mutex, NULL);
-	pthread_mutex_init(&rds_mutex, NULL);
-	pthread_mutex_init(&out_resampler_mutex, NULL);
-	pthread_mutex_init(&output_mutex, NULL);
-	pthread_cond_init(&control_pipe_cond, NULL);
-	pthread_cond_init(&input_cond, NULL);
-	pthread_cond_init(&in_resampler_cond, NULL);
-	pthread_cond_init(&mpx_cond, NULL);
-	pthread_cond_init(&rds_cond, NULL);
-	pthread_cond_init(&out_resampler_cond, NULL);
-	pthread_cond_init(&output_cond, NULL);
+	pthread_mutex_init(&ring_mutex, NULL);
+	pthread_cond_init(&ring_cond, NULL);
 	pthread_attr_init(&attr);
 
 	// Setup buffers
-	mpx_buffer = malloc(NUM_MPX_FRAMES_IN*2*sizeof(float));
-	out_buffer = malloc(NUM_MPX_FRAMES_OUT*2*sizeof(float));
+	mpx_buffer = malloc(block_size*sizeof(float));
 
 	// Gracefully stop the encoder on SIGINT or SIGTERM
 	signal(SIGINT, stop);
@@ -492,163 +1026,175 @@ int main(int argc, char **argv) {
 	signal(SIGKILL, free_and_shutdown);
 
 	// Initialize the baseband generator
-	fm_mpx_init();
-	set_output_volume(mpx);
+	if (fm_mpx_init(&encoder) < 0) goto free;
+	set_output_volume(&encoder, mpx);
 
 	// Initialize the RDS modulator
-	if (!rds) set_carrier_volume(1, 0);
-	init_rds_encoder(rds_params, callsign);
+	if (!rds) set_carrier_volume(&encoder, 1, 0);
+	if (latency_test) {
+		// the test pulses would be lost under the carriers
+		for (uint8_t c = 0; c < 5; c++) set_carrier_volume(&encoder, c, 0);
+	}
+	if (set_rds2_streams(&encoder, rds2_streams) < 0) goto exit_mpx;
+	set_asym_dsb(&encoder, asymmetry);
+	if (set_stereo_mode(&encoder, stereo_mode) < 0) goto exit_mpx;
+	if (set_quality(&encoder, quality) < 0) goto exit_mpx;
+	if (set_fixed_point(&encoder, fixed_point) < 0) goto exit_mpx;
+	if (governor && audio_file[0] && allow_quality_changes(&encoder) < 0) goto exit_mpx;
+	init_rds_encoder(&encoder.rds, rds_params, callsign);
 
 	if (output_file[0] == 0) {
-		r = open_output("alsa:default", OUTPUT_SAMPLE_RATE, 2);
-		if (r < 0) {
-			goto free;
-		}
-		output_open_success = 1;
+		r = open_output("alsa:default", OUTPUT_SAMPLE_RATE, 2, output_format, block_size);
 	} else {
-		r = open_output(output_file, OUTPUT_SAMPLE_RATE, 2);
-		if (r < 0) {
-			goto free;
-		}
-		output_open_success = 1;
+		r = open_output(output_file, OUTPUT_SAMPLE_RATE, 2, output_format, block_size);
 	}
+	if (r < 0) goto exit_mpx;
 
-	if (output_open_success) {
-		struct audio_io_thread_args_t output_thread_args;
-		output_thread_args.data = out_buffer;
-		output_thread_args.frames = NUM_MPX_FRAMES_OUT;
-		// start output thread
-		r = pthread_create(&output_thread, &attr, output_worker, (void *)&output_thread_args);
-		if (r < 0) {
-			fprintf(stderr, "Could not create audio output thread.\n");
+	if (audio_file[0]) {
+		audio_in_buffer = malloc(input_frames*2*sizeof(float));
+		resampled_audio_in_buffer = malloc(block_size/2*2*sizeof(float));
+		mpx_in_buffer = malloc(block_size*2*sizeof(float));
+
+		if (init_ring_buffer(&mpx_in_ring, block_size * MPX_IN_RING_BLOCKS, 2) < 0) {
+			fprintf(stderr, "Could not allocate MPX input buffer.\n");
 			goto exit;
-		} else {
-			fprintf(stderr, "Created output thread.\n");
 		}
-	}
 
-	if (audio_file[0]) {
-		audio_in_buffer = malloc(NUM_AUDIO_FRAMES_IN*2*sizeof(float));
-		resampled_audio_in_buffer = malloc(NUM_AUDIO_FRAMES_OUT*2*sizeof(float));
+		set_alsa_capture_size(alsa_period, alsa_buffer);
+		r = open_input(audio_file, wait, &sample_rate, input_frames);
+		if (r < 0) goto exit;
+		input_open_success = 1;
 
-		uint32_t sample_rate;
-		r = open_input(audio_file, wait, &sample_rate, NUM_AUDIO_FRAMES_IN);
-		if (r < 0) goto free;
 
-		// SRC in (input -> MPX)
-		r = resampler_init(&src_state[0], 2);
-		if (r < 0) {
-			fprintf(stderr, "Could not create input resampler.\n");
-			goto exit;
+		if (is_live_input()) {
+			// the capture and playback clocks are independent
+			init_drift_ctl(&drift_ctl, block_size * MPX_IN_TARGET_BLOCKS);
 		}
 
-		memset(&src_data[0], 0, sizeof(src_data[0]));
-
-		struct resample_thread_args_t in_resampler_args;
-		memset(&in_resampler_args, 0, sizeof(struct resample_thread_args_t));
-		in_resampler_args.state = &src_state[0];
-		in_resampler_args.data = src_data[0];
-		in_resampler_args.in = audio_in_buffer;
-		in_resampler_args.out = resampled_audio_in_buffer;
-		in_resampler_args.frames_in = NUM_AUDIO_FRAMES_IN;
-		in_resampler_args.frames_out = NUM_AUDIO_FRAMES_OUT;
-		in_resampler_args.ratio = (double)MPX_SAMPLE_RATE / (double)sample_rate;
+		input_thread_args.resampler = &in_resampler;
+		input_thread_args.in = audio_in_buffer;
+		input_thread_args.out = resampled_audio_in_buffer;
+		input_thread_args.ratio = (double)MPX_SAMPLE_RATE / (double)sample_rate;
+		input_thread_args.sample_rate = sample_rate;
+		input_thread_args.latency_test = latency_test;
+
+		if (latency_test) {
+			fprintf(stderr, "Replacing the input with test pulses. "
+				"The pilot and RDS are off.\n");
+			init_latency_test(sample_rate);
+		}
 
-		// start input resampler thread
-		r = pthread_create(&in_resampler_thread, &attr, in_resampler_worker, (void *)&in_resampler_args);
+		// SRC in (input -> MPX)
+		r = resampler_init(&in_resampler, 2, input_thread_args.ratio,
+			quality, read_input_frames, &input_thread_args);
 		if (r < 0) {
-			fprintf(stderr, "Could not create input resampler thread.\n");
+			fprintf(stderr, "Could not create input resampler.\n");
 			goto exit;
-		} else {
-			fprintf(stderr, "Created input resampler thread.\n");
 		}
 
-		struct audio_io_thread_args_t input_thread_args;
-		input_thread_args.data = audio_in_buffer;
-		input_thread_args.frames = NUM_AUDIO_FRAMES_IN;
-
 		// start audio input thread
-		r = pthread_create(&input_thread, &attr, input_worker, (void *)&input_thread_args);
-		if (r < 0) {
-			fprintf(stderr, "Could not create file input thread.\n");
-			goto exit;
-		} else {
-			fprintf(stderr, "Created file input thread.\n");
+		if (!single_thread) {
+			r = pthread_create(&input_thread, &attr, input_worker, (void *)&input_thread_args);
+			if (r != 0) {
+				fprintf(stderr, "Could not create input thread.\n");
+				goto exit;
+			} else {
+				fprintf(stderr, "Created input thread.\n");
+				input_thread_running = 1;
+			}
 		}
 	}
 
 	// Initialize the control pipe reader
 	if(control_pipe[0]) {
-		if(open_control_pipe(control_pipe) == 0) {
+		if(open_control_pipe(&control_thread_args.ctl_pipe, control_pipe, &encoder) == 0) {
 			fprintf(stderr, "Reading control commands on %s.\n", control_pipe);
-			// Create control pipe polling worker
-			r = pthread_create(&control_pipe_thread, &attr, control_pipe_worker, NULL);
-			if (r < 0) {
-				fprintf(stderr, "Could not create control pipe thread.\n");
-				goto exit;
-			} else {
-				fprintf(stderr, "Created control pipe thread.\n");
-			}
+			control_thread_args.pipe = 1;
 		} else {
 			fprintf(stderr, "Failed to open control pipe: %s.\n", control_pipe);
 		}
 	}
 
-	// start MPX resampler thread
-	// SRC in (input -> MPX)
-	r = resampler_init(&src_state[2], 2);
-	if (r < 0) {
-		fprintf(stderr, "Could not create ouput resampler.\n");
-		goto exit;
+	// Initialize the control socket server
+	if(control_socket[0]) {
+		if(open_control_socket(&control_thread_args.ctl_socket, control_socket, &encoder) == 0) {
+			fprintf(stderr, "Accepting control connections on %s.\n", control_socket);
+			control_thread_args.socket = 1;
+		} else {
+			fprintf(stderr, "Failed to open control socket: %s.\n", control_socket);
+		}
 	}
 
-	memset(&src_data[1], 0, sizeof(src_data[1]));
-
-	struct resample_thread_args_t out_resampler_args;
-	memset(&out_resampler_args, 0, sizeof(struct resample_thread_args_t));
-	out_resampler_args.state = &src_state[1];
-	out_resampler_args.data = src_data[1];
-	out_resampler_args.in = mpx_buffer;
-	out_resampler_args.out = out_buffer;
-	out_resampler_args.frames_in = NUM_MPX_FRAMES_IN;
-	out_resampler_args.frames_out = NUM_MPX_FRAMES_OUT;
-	out_resampler_args.ratio = (double)OUTPUT_SAMPLE_RATE / (double)MPX_SAMPLE_RATE;
-
-	// start output resampler thread
-	r = pthread_create(&in_resampler_thread, &attr, out_resampler_worker, (void *)&out_resampler_args);
-	if (r < 0) {
-		fprintf(stderr, "Could not create output resampler thread.\n");
-		goto exit;
-	} else {
-		fprintf(stderr, "Created output resampler thread.\n");
+	if (!single_thread && (control_thread_args.pipe || control_thread_args.socket)) {
+		// Create control polling worker
+		r = pthread_create(&control_pipe_thread, &attr, control_pipe_worker, (void *)&control_thread_args);
+		if (r != 0) {
+			fprintf(stderr, "Could not create control pipe thread.\n");
+			goto exit;
+		} else {
+			fprintf(stderr, "Created control pipe thread.\n");
+			control_thread_running = 1;
+		}
 	}
 
 	// start MPX thread
-	struct mpx_thread_args_t mpx_thread_args;
-	mpx_thread_args.out = out_buffer;
-	mpx_thread_args.frames = NUM_MPX_FRAMES_OUT;
-	if (audio_file[0]) {
-		mpx_thread_args.in = resampled_audio_in_buffer;
-		r = pthread_create(&mpx_thread, &attr, mpx_worker, (void *)&mpx_thread_args);
-		if (r < 0) {
-			fprintf(stderr, "Could not create MPX thread.\n");
+	mpx_thread_args.in = mpx_in_buffer;
+	mpx_thread_args.mpx = mpx_buffer;
+	mpx_thread_args.audio = audio_file[0] ? 1 : 0;
+	mpx_thread_args.latency = latency;
+	mpx_thread_args.latency_test = latency_test;
+	mpx_thread_args.split = split;
+	mpx_thread_args.governor = governor && audio_file[0];
+	if (mpx_thread_args.governor) init_governor(&mpx_thread_args.gov, quality, block_size);
+
+	if (split) {
+		sub_buffer = malloc(block_size*sizeof(float));
+		sub_mix_buffer = malloc(block_size*sizeof(float));
+
+		if (init_ring_buffer(&sub_ring, block_size * SUB_RING_BLOCKS, 1) < 0) {
+			fprintf(stderr, "Could not allocate subcarrier buffer.\n");
+			goto exit;
+		}
+
+		r = pthread_create(&subcarrier_thread, &attr, subcarrier_worker, NULL);
+		if (r != 0) {
+			fprintf(stderr, "Could not create subcarrier thread.\n");
 			goto exit;
 		} else {
-			fprintf(stderr, "Created MPX thread.\n");
+			fprintf(stderr, "Created subcarrier thread.\n");
+			subcarrier_thread_running = 1;
 		}
-		pthread_cond_signal(&mpx_cond);
-	} else {
-		r = pthread_create(&rds_thread, &attr, rds_worker, (void *)&mpx_thread_args);
-		if (r < 0) {
-			fprintf(stderr, "Could not create RDS thread.\n");
+	}
+
+	if (mpx_thread_args.governor && !single_thread) {
+		r = pthread_create(&governor_thread, &attr, governor_worker, NULL);
+		if (r != 0) {
+			fprintf(stderr, "Could not create governor thread.\n");
 			goto exit;
 		} else {
-			fprintf(stderr, "Created RDS thread.\n");
+			fprintf(stderr, "Created governor thread.\n");
+			governor_thread_running = 1;
+			mpx_thread_args.governor_thread = 1;
 		}
-		pthread_cond_signal(&rds_cond);
 	}
 
-	pthread_attr_destroy(&attr);
+	if (single_thread) {
+		fprintf(stderr, "Running on a single thread.\n");
+		print_latency(sample_rate, input_frames, is_live_input());
+		run_single_thread(&input_thread_args, &mpx_thread_args, &control_thread_args);
+		goto exit;
+	}
+
+	r = pthread_create(&mpx_thread, &attr, mpx_worker, (void *)&mpx_thread_args);
+	if (r != 0) {
+		fprintf(stderr, "Could not create MPX thread.\n");
+		goto exit;
+	} else {
+		fprintf(stderr, "Created MPX thread.\n");
+		mpx_thread_running = 1;
+	}
+
+	print_latency(sample_rate, input_frames, is_live_input());
 
 	for (;;) {
 		if (stop_mpx) {
@@ -661,33 +1207,35 @@ int main(int argc, char **argv) {
 exit:
 	// shut down threads
 	fprintf(stderr, "Waiting for threads to shut down.\n");
-	pthread_cond_signal(&input_cond);
-	pthread_cond_signal(&in_resampler_cond);
-	pthread_cond_signal(&mpx_cond);
-	pthread_cond_signal(&rds_cond);
-	pthread_cond_signal(&output_cond);
-	pthread_join(control_pipe_thread, NULL);
-	pthread_join(input_thread, NULL);
-	pthread_join(in_resampler_thread, NULL);
-	pthread_join(mpx_thread, NULL);
-	pthread_join(rds_thread, NULL);
-	pthread_join(out_resampler_thread, NULL);
-	pthread_join(output_thread, NULL);
-
-	if (audio_file[0]) close_input();
+	stop_mpx = 1;
+	ring_broadcast();
+	sub_broadcast();
+	if (control_thread_running) pthread_join(control_pipe_thread, NULL);
+	if (input_thread_running) pthread_join(input_thread, NULL);
+	if (mpx_thread_running) pthread_join(mpx_thread, NULL);
+	if (subcarrier_thread_running) pthread_join(subcarrier_thread, NULL);
+	if (governor_thread_running) pthread_join(governor_thread, NULL);
+	pthread_attr_destroy(&attr);
+
+	if (input_open_success) close_input();
 	close_output();
-	if (audio_file[0]) resampler_exit(src_state[0]);
-	resampler_exit(src_state[1]);
+	resampler_exit(&in_resampler);
+	if (mpx_in_ring.buffer != NULL) exit_ring_buffer(&mpx_in_ring);
+	if (sub_ring.buffer != NULL) exit_ring_buffer(&sub_ring);
 
-	fm_mpx_exit();
+exit_mpx:
+	fm_mpx_exit(&encoder);
+	close_shared_tables();
 
 free:
 	if (audio_file[0]) {
 		if (audio_in_buffer != NULL) free(audio_in_buffer);
 		if (resampled_audio_in_buffer != NULL) free(resampled_audio_in_buffer);
+		if (mpx_in_buffer != NULL) free(mpx_in_buffer);
 	}
 	if (mpx_buffer != NULL) free(mpx_buffer);
-	if (out_buffer != NULL) free(out_buffer);
+	if (sub_buffer != NULL) free(sub_buffer);
+	if (sub_mix_buffer != NULL) free(sub_mix_buffer);
 
 	return 0;
 }
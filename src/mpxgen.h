@@ -0,0 +1,84 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * libmpxgen - the Mpxgen encoder as a library
+ *
+ * Every encoder handle has its own audio chain and RDS data, so any
+ * number of them can be used in one program. A handle must not be used
+ * from more than one thread at a time, except for mpx_encoder_command,
+ * which may be called while another thread is processing.
+ */
+
+#ifndef MPXGEN_H
+#define MPXGEN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// sample rate of the audio going in and the MPX coming out
+#define MPXGEN_SAMPLE_RATE	190000
+
+typedef struct mpx_encoder_t mpx_encoder_t;
+
+/*
+ * Maps the DSP tables shared by all Mpxgen instances on the host,
+ * building them if they do not exist yet. Must be called before any
+ * encoder is created. Encoders build private tables if this is not
+ * called or fails.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+extern int mpx_encoder_share_tables();
+
+/*
+ * Creates an encoder with the same defaults as the mpxgen program
+ * (PI 1000, PS "Mpxgen", 50% output volume)
+ *
+ * Returns NULL if the encoder could not be allocated.
+ */
+extern mpx_encoder_t *mpx_encoder_open();
+
+/*
+ * Runs a command from the control command list (doc/command_list.md),
+ * for example "PS MyText" or "RT Now playing: ..."
+ *
+ * Returns 1 if the command was accepted, -1 otherwise.
+ */
+extern int mpx_encoder_command(mpx_encoder_t *enc, const char *cmd);
+
+/*
+ * Encodes a block of audio
+ *
+ * in holds frames of interleaved stereo audio at MPXGEN_SAMPLE_RATE
+ * (full scale is +/-1.0). out receives the same number of MPX samples
+ * with the output volume applied. Blocks can be of any size.
+ */
+extern void mpx_encoder_process(mpx_encoder_t *enc, const float *in, float *out, size_t frames);
+
+extern void mpx_encoder_close(mpx_encoder_t *enc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MPXGEN_H */
@@ -17,48 +17,188 @@
  */
 
 #include "common.h"
+#include <strings.h>
+#include "fm_mpx.h"
+#include "polyphase.h"
 #include "output.h"
 
 static int output_type;
+static struct file_output_t file_out;
+static uint8_t output_format;
+static unsigned int output_channels;
 
-int open_output(char *output_name, unsigned int sample_rate, unsigned int channels) {
+static struct polyphase_t output_kernel;
+// output block in the output format
+static void *buf;
+static uint8_t buf_format;
+static size_t buf_frames;
+
+/*
+ * Gets the output format from its name (s16, s24, s32 or float)
+ */
+int8_t parse_output_format(char *name) {
+	if (!strcasecmp(name, "s16")) return OUTPUT_FORMAT_S16;
+	if (!strcasecmp(name, "s24")) return OUTPUT_FORMAT_S24;
+	if (!strcasecmp(name, "s32")) return OUTPUT_FORMAT_S32;
+	if (!strcasecmp(name, "float")) return OUTPUT_FORMAT_FLOAT;
+	return -1;
+}
+
+/*
+ * Opens the output for blocks of up to max_frames of MPX
+ */
+int open_output(char *output_name, unsigned int sample_rate, unsigned int channels, uint8_t format, size_t max_frames) {
 	// TODO: better detect live capture cards
 	if (output_name[0] == 'a' && output_name[1] == 'l' &&
 	    output_name[2] == 's' && output_name[3] == 'a' &&
 	    output_name[4] == ':') { // check if name is prefixed with "alsa:"
 		output_name = output_name+5; // don't pass prefix
 		fprintf(stderr, "Using ALSA device \"%s\" for output.\n", output_name);
-		if (open_alsa_output(output_name, sample_rate, channels) < 0) {
+		if (open_alsa_output(output_name, sample_rate, channels, format) < 0) {
 			fprintf(stderr, "Could not open ALSA sink.\n");
 			return -1;
 		}
 		output_type = 2;
 	} else {
 		fprintf(stderr, "Writing MPX output to \"%s\".\n", output_name);
-		if (open_file_output(output_name, sample_rate, channels) < 0) {
+		if (open_file_output(&file_out, output_name, sample_rate, channels, format) < 0) {
 			return -1;
 		}
 		output_type = 1;
 	}
+
+	output_format = format;
+	output_channels = channels;
+
+	if (init_polyphase(&output_kernel, MPX_SAMPLE_RATE, sample_rate, max_frames) < 0) {
+		fprintf(stderr, "Error: could not create the output resampler.\n");
+		close_output();
+		return -1;
+	}
+
+	// all formats fit in 4 bytes per sample
+	buf = malloc(polyphase_max_output(&output_kernel, max_frames) *
+		channels * sizeof(int32_t));
+
+	if (output_type == 2) {
+		set_alsa_output_block(polyphase_max_output(&output_kernel, max_frames));
+	}
+
 	return 1;
 }
 
-int write_output(short *audio, size_t frames) {
+/*
+ * Takes a block of mono MPX at MPX_SAMPLE_RATE to the output
+ *
+ * Rate conversion, volume and the conversion to the output format are
+ * all done by the output kernel in one go.
+ */
+int write_output(float *mpx, size_t frames, float gain) {
+	size_t out_frames;
+	// libsndfile takes 24-bit samples as left-justified ints
+	uint8_t format = (output_format == OUTPUT_FORMAT_S24 && output_type == 1) ?
+		OUTPUT_FORMAT_S32 : output_format;
+
+	out_frames = polyphase_output(&output_kernel, mpx, frames,
+		gain, format, output_channels, buf);
+	buf_format = format;
+	buf_frames = out_frames;
+
 	if (output_type == 1) {
-		if (write_file_output(audio, frames) < 0) return -1;
+		if (write_file_output(&file_out, buf, out_frames) < 0) return -1;
 	}
 	if (output_type == 2) {
-		if (write_alsa_output(audio, frames) < 0) return -1;
+		if (write_alsa_output(buf, out_frames) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Finds the largest sample of the last block written
+ *
+ * Returns its magnitude (full scale is 1.0). The position of the
+ * sample and the length of the block are put in frame and frames.
+ */
+float get_output_peak(size_t *frame, size_t *frames) {
+	float peak = 0;
+	float sample;
+	uint8_t *s24;
+
+	*frame = 0;
+	*frames = buf_frames;
+
+	for (size_t i = 0; i < buf_frames; i++) {
+		// all channels carry the same signal
+		size_t j = i * output_channels;
+
+		switch (buf_format) {
+		case OUTPUT_FORMAT_S24:
+			s24 = (uint8_t *)buf + j * 3;
+			sample = (int32_t)((uint32_t)s24[0] << 8 |
+				(uint32_t)s24[1] << 16 | (uint32_t)s24[2] << 24) / 2147483648.0f;
+			break;
+		case OUTPUT_FORMAT_S32:
+			sample = ((int32_t *)buf)[j] / 2147483648.0f;
+			break;
+		case OUTPUT_FORMAT_FLOAT:
+			sample = ((float *)buf)[j];
+			break;
+		default:
+			sample = ((int16_t *)buf)[j] / 32768.0f;
+			break;
+		}
+
+		if (fabsf(sample) > peak) {
+			peak = fabsf(sample);
+			*frame = i;
+		}
 	}
 
+	return peak;
+}
+
+/*
+ * Poll descriptors to wait on before writing (none for files)
+ */
+int get_output_fds(struct pollfd *fds, unsigned int space) {
+	if (output_type == 2) return get_alsa_output_fds(fds, space);
+	return 0;
+}
+
+/*
+ * Whether a block can be written without waiting
+ */
+uint8_t output_ready() {
+	if (output_type == 2) return alsa_output_ready();
+	return 1;
+}
+
+/*
+ * Frames written but not played yet (0 for files)
+ */
+long get_output_delay() {
+	if (output_type == 2) return get_alsa_output_delay();
+	return 0;
+}
+
+/*
+ * Frames that can be queued up in the output (0 for files)
+ */
+size_t get_output_buffer_frames() {
+	if (output_type == 2) return get_alsa_output_buffer();
 	return 0;
 }
 
 void close_output() {
 	if (output_type == 1) {
-		close_file_output();
+		close_file_output(&file_out);
 	}
 	if (output_type == 2) {
 		close_alsa_output();
 	}
+
+	exit_polyphase(&output_kernel);
+	if (buf != NULL) free(buf);
+	buf = NULL;
 }
@@ -16,9 +16,21 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+// output sample formats
+#define OUTPUT_FORMAT_S16	0
+#define OUTPUT_FORMAT_S24	1 // packed 24-bit for ALSA
+#define OUTPUT_FORMAT_S32	2
+#define OUTPUT_FORMAT_FLOAT	3
+
 #include "file_output.h"
 #include "alsa_output.h"
 
-int open_output(char *output_name, unsigned int sample_rate, unsigned int channels);
-int write_output(short *audio, size_t frames);
+int8_t parse_output_format(char *name);
+int open_output(char *output_name, unsigned int sample_rate, unsigned int channels, uint8_t format, size_t max_frames);
+int write_output(float *mpx, size_t frames, float gain);
+float get_output_peak(size_t *frame, size_t *frames);
+int get_output_fds(struct pollfd *fds, unsigned int space);
+uint8_t output_ready();
+long get_output_delay();
+size_t get_output_buffer_frames();
 void close_output();
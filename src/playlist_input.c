@@ -0,0 +1,339 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <strings.h>
+#include <pthread.h>
+#include <time.h>
+#include <sndfile.h>
+#include "audio_conversion.h"
+#include "fm_mpx.h"
+#include "resampler.h"
+#include "ring_buffer.h"
+#include "playlist_input.h"
+
+/*
+ * Gapless playlist input
+ *
+ * The items of an M3U playlist are decoded on a background thread into
+ * a large ring buffer, so the realtime chain never waits on a decoder or
+ * sees a gap between two files. Every item is converted to stereo at
+ * PLAYLIST_SAMPLE_RATE so sample rate changes between items do not
+ * affect the rest of the pipeline.
+ *
+ * The playlist file is read again every time it has been played through
+ * so it can be updated while mpxgen is running.
+ */
+
+static char playlist_file[PLAYLIST_ITEM_LENGTH];
+static char **items;
+static size_t num_items;
+
+static struct ring_buffer_t decode_ring;
+static size_t target_len;
+
+static pthread_t decoder_thread;
+static pthread_mutex_t decoder_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t data_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t space_cond = PTHREAD_COND_INITIALIZER;
+static uint8_t stop_decoder;
+static uint8_t decoder_running;
+
+// decoder buffers
+static float *decode_buf;
+static float *stereo_buf;
+static float *resampled_buf;
+
+// the item being decoded
+typedef struct playlist_item_t {
+	SNDFILE *sf;
+	uint8_t channels;
+} playlist_item_t;
+
+static void free_items() {
+	for (size_t i = 0; i < num_items; i++) free(items[i]);
+	free(items);
+	items = NULL;
+	num_items = 0;
+}
+
+/*
+ * Loads all entries of the playlist. Relative paths are taken from the
+ * directory the playlist is in.
+ */
+static size_t load_playlist() {
+	char line[PLAYLIST_ITEM_LENGTH];
+	char dir[PLAYLIST_ITEM_LENGTH] = {0};
+	char *slash;
+	char *item;
+	char **new_items;
+	size_t len;
+	FILE *f;
+
+	slash = strrchr(playlist_file, '/');
+	if (slash != NULL) memcpy(dir, playlist_file, slash - playlist_file + 1);
+
+	f = fopen(playlist_file, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Error: could not open playlist %s.\n", playlist_file);
+		return 0;
+	}
+
+	while (fgets(line, PLAYLIST_ITEM_LENGTH, f) != NULL) {
+		len = strlen(line);
+		while (len && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len] = 0;
+
+		// skip blank lines and comments (#EXTM3U, #EXTINF, ...)
+		if (!len || line[0] == '#') continue;
+
+		item = malloc(strlen(dir) + len + 1);
+		if (item == NULL) goto nomem;
+		if (line[0] == '/') {
+			strcpy(item, line);
+		} else {
+			strcpy(item, dir);
+			strcat(item, line);
+		}
+
+		new_items = realloc(items, (num_items + 1) * sizeof(char *));
+		if (new_items == NULL) {
+			free(item);
+			goto nomem;
+		}
+		items = new_items;
+		items[num_items++] = item;
+	}
+
+	fclose(f);
+
+	return num_items;
+
+nomem:
+	fprintf(stderr, "Error: could not allocate playlist %s.\n", playlist_file);
+	fclose(f);
+	free_items();
+	return 0;
+}
+
+/*
+ * Queues frames for the reader, waiting for space if needed
+ */
+static void push_frames(float *in, size_t frames) {
+	size_t written;
+
+	while (frames && !stop_decoder) {
+		written = ring_buffer_write(&decode_ring, in, frames);
+		in += written * 2;
+		frames -= written;
+
+		pthread_mutex_lock(&decoder_mutex);
+		if (written) pthread_cond_signal(&data_cond);
+		if (frames && !stop_decoder && !ring_buffer_space(&decode_ring))
+			pthread_cond_wait(&space_cond, &decoder_mutex);
+		pthread_mutex_unlock(&decoder_mutex);
+	}
+}
+
+/*
+ * Reads the next block of the current item for the resampler
+ */
+static long read_item_frames(void *data, float **audio) {
+	struct playlist_item_t *item = (struct playlist_item_t *)data;
+	sf_count_t frames;
+
+	frames = sf_readf_float(item->sf, decode_buf, PLAYLIST_DECODE_FRAMES);
+	if (frames <= 0 || stop_decoder) return 0;
+
+	if (item->channels == 1) {
+		stereoizef(decode_buf, stereo_buf, frames);
+		*audio = stereo_buf;
+	} else {
+		*audio = decode_buf;
+	}
+
+	return frames;
+}
+
+static int8_t decode_item(char *filename) {
+	SF_INFO sfinfo;
+	struct playlist_item_t item;
+	struct resampler_t rs;
+	float *audio;
+	long frames;
+	int32_t frames_out;
+
+	memset(&sfinfo, 0, sizeof(SF_INFO));
+	if (!(item.sf = sf_open(filename, SFM_READ, &sfinfo))) {
+		fprintf(stderr, "Playlist: could not open %s, skipping.\n", filename);
+		return -1;
+	}
+
+	if (sfinfo.channels > 2) {
+		fprintf(stderr, "Playlist: %s has too many channels, skipping.\n", filename);
+		sf_close(item.sf);
+		return -1;
+	}
+	item.channels = sfinfo.channels;
+
+	fprintf(stderr, "Playlist: decoding %s\n", filename);
+
+	if (sfinfo.samplerate == PLAYLIST_SAMPLE_RATE) {
+		while (!stop_decoder && (frames = read_item_frames(&item, &audio)) > 0) {
+			push_frames(audio, frames);
+		}
+	} else if (resampler_init(&rs, 2,
+		(double)PLAYLIST_SAMPLE_RATE / (double)sfinfo.samplerate,
+		QUALITY_STANDARD, read_item_frames, &item) == 0) {
+		// a short read means the resampler has been drained
+		do {
+			frames_out = resample(&rs, resampled_buf, PLAYLIST_DECODE_FRAMES);
+			if (frames_out > 0) push_frames(resampled_buf, frames_out);
+		} while (frames_out == PLAYLIST_DECODE_FRAMES && !stop_decoder);
+		resampler_exit(&rs);
+	}
+
+	sf_close(item.sf);
+
+	return 0;
+}
+
+static void *decoder_worker() {
+	size_t decoded;
+
+	while (!stop_decoder) {
+		load_playlist();
+
+		decoded = 0;
+		for (size_t i = 0; i < num_items && !stop_decoder; i++) {
+			if (decode_item(items[i]) == 0) decoded++;
+		}
+
+		free_items();
+
+		if (!decoded && !stop_decoder) {
+			// nothing playable, don't spin
+			sleep(1);
+		}
+	}
+
+	pthread_exit(NULL);
+}
+
+int8_t open_playlist_input(char *filename, uint32_t *sample_rate, size_t num_frames) {
+
+	if (strlen(filename) >= PLAYLIST_ITEM_LENGTH) {
+		fprintf(stderr, "Error: playlist file name is too long.\n");
+		return -1;
+	}
+	strcpy(playlist_file, filename);
+
+	target_len = num_frames;
+
+	if (init_ring_buffer(&decode_ring,
+		PLAYLIST_SAMPLE_RATE * PLAYLIST_BUFFER_SECONDS, 2) < 0) {
+		fprintf(stderr, "Error: could not allocate playlist buffer.\n");
+		return -1;
+	}
+
+	decode_buf = malloc(PLAYLIST_DECODE_FRAMES * 2 * sizeof(float));
+	stereo_buf = malloc(PLAYLIST_DECODE_FRAMES * 2 * sizeof(float));
+	resampled_buf = malloc(PLAYLIST_DECODE_FRAMES * 2 * sizeof(float));
+	if (decode_buf == NULL || stereo_buf == NULL || resampled_buf == NULL) {
+		fprintf(stderr, "Error: could not allocate playlist decoder buffers.\n");
+		close_playlist_input();
+		return -1;
+	}
+
+	fprintf(stderr, "Using playlist: %s\n", filename);
+
+	stop_decoder = 0;
+	if (pthread_create(&decoder_thread, NULL, decoder_worker, NULL) != 0) {
+		fprintf(stderr, "Error: could not create playlist decoder thread.\n");
+		close_playlist_input();
+		return -1;
+	}
+	decoder_running = 1;
+
+	*sample_rate = PLAYLIST_SAMPLE_RATE;
+
+	return 0;
+}
+
+/*
+ * Gets decoded frames. If the decoder falls behind for more than
+ * 100 ms the missing part of the block is filled with silence so the
+ * input thread never stalls.
+ */
+int16_t read_playlist_input(float *audio) {
+	struct timespec deadline;
+	size_t frames_read;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += 100000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&decoder_mutex);
+	while (ring_buffer_fill(&decode_ring) < target_len) {
+		if (pthread_cond_timedwait(&data_cond, &decoder_mutex, &deadline) != 0)
+			break;
+	}
+	pthread_mutex_unlock(&decoder_mutex);
+
+	frames_read = ring_buffer_read(&decode_ring, audio, target_len);
+	if (frames_read < target_len) {
+		memset(audio + frames_read * 2, 0,
+			(target_len - frames_read) * 2 * sizeof(float));
+	}
+
+	pthread_mutex_lock(&decoder_mutex);
+	pthread_cond_signal(&space_cond);
+	pthread_mutex_unlock(&decoder_mutex);
+
+	return 1;
+}
+
+void close_playlist_input() {
+	pthread_mutex_lock(&decoder_mutex);
+	stop_decoder = 1;
+	pthread_cond_signal(&space_cond);
+	pthread_mutex_unlock(&decoder_mutex);
+
+	if (decoder_running) pthread_join(decoder_thread, NULL);
+	decoder_running = 0;
+
+	free_items();
+	free(decode_buf);
+	free(stereo_buf);
+	free(resampled_buf);
+	decode_buf = stereo_buf = resampled_buf = NULL;
+	exit_ring_buffer(&decode_ring);
+}
+
+/*
+ * Checks for a playlist file name (.m3u or .m3u8)
+ */
+uint8_t is_playlist(char *filename) {
+	char *ext = strrchr(filename, '.');
+
+	if (ext == NULL) return 0;
+
+	return !strcasecmp(ext, ".m3u") || !strcasecmp(ext, ".m3u8");
+}
@@ -0,0 +1,31 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// all playlist items are converted to this rate
+#define PLAYLIST_SAMPLE_RATE	48000
+// decode-ahead buffer length
+#define PLAYLIST_BUFFER_SECONDS	10
+// frames decoded at a time
+#define PLAYLIST_DECODE_FRAMES	4096
+// longest path in the playlist
+#define PLAYLIST_ITEM_LENGTH	1024
+
+extern uint8_t is_playlist(char *filename);
+extern int8_t open_playlist_input(char *filename, uint32_t *sample_rate, size_t num_frames);
+extern int16_t read_playlist_input(float *audio);
+extern void close_playlist_input();
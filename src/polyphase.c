@@ -0,0 +1,182 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2019 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+#include "audio_conversion.h"
+#include "output.h"
+#include "polyphase.h"
+#include "dsp_kernels.h"
+
+/*
+ * Output stage
+ *
+ * Takes the mono MPX signal to the output sample rate with a polyphase
+ * FIR filter. Every output sample is scaled and stored in the output
+ * format (to all channels) as soon as it is computed, so the MPX block
+ * is only walked once between the generator and the sound card or file.
+ */
+
+// stopband attenuation of the filter (Kaiser window)
+#define KAISER_BETA	8.0
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+	uint32_t t;
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// modified Bessel function of the first kind, order 0
+static double bessel_i0(double x) {
+	double sum = 1.0, term = 1.0;
+
+	for (uint8_t k = 1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+
+	return sum;
+}
+
+int8_t init_polyphase(struct polyphase_t *pp, uint32_t in_rate, uint32_t out_rate, size_t max_frames) {
+	uint32_t div = gcd(in_rate, out_rate);
+	size_t len;
+	double cutoff, center, x, w, sum = 0.0;
+	double *proto;
+
+	memset(pp, 0, sizeof(struct polyphase_t));
+	pp->up = out_rate / div;
+	pp->down = in_rate / div;
+	pp->max_frames = max_frames;
+
+	len = (size_t)pp->up * POLYPHASE_TAPS;
+	proto = malloc(len * sizeof(double));
+	pp->coeffs = malloc(len * sizeof(float));
+	pp->in = calloc(POLYPHASE_TAPS - 1 + max_frames, sizeof(float));
+	if (proto == NULL || pp->coeffs == NULL || pp->in == NULL) {
+		free(proto);
+		exit_polyphase(pp);
+		return -1;
+	}
+
+	/*
+	 * Low-pass prototype at up times the input rate. The cutoff is a
+	 * bit below the lower Nyquist frequency, which still leaves the
+	 * RDS2 subcarriers well inside the passband at 190 kHz.
+	 */
+	cutoff = 0.46 * (in_rate < out_rate ? in_rate : out_rate) / ((double)in_rate * pp->up);
+	center = (len - 1) / 2.0;
+	for (size_t i = 0; i < len; i++) {
+		x = i - center;
+		proto[i] = (x == 0.0) ? 2.0 * cutoff : sin(M_2PI * cutoff * x) / (M_PI * x);
+		w = 2.0 * x / (len - 1);
+		proto[i] *= bessel_i0(KAISER_BETA * sqrt(1.0 - w * w)) / bessel_i0(KAISER_BETA);
+		sum += proto[i];
+	}
+
+	/*
+	 * Split into phases. Taps are stored oldest sample first so each
+	 * output is a straight dot product with the input.
+	 */
+	for (uint16_t p = 0; p < pp->up; p++) {
+		for (uint16_t j = 0; j < POLYPHASE_TAPS; j++) {
+			pp->coeffs[p * POLYPHASE_TAPS + (POLYPHASE_TAPS - 1 - j)] =
+				(float)(proto[p + j * pp->up] * pp->up / sum);
+		}
+	}
+
+	free(proto);
+
+	return 0;
+}
+
+/*
+ * Largest number of output frames for a block of input frames
+ */
+size_t polyphase_max_output(struct polyphase_t *pp, size_t frames) {
+	return (frames * pp->up) / pp->down + 1;
+}
+
+/*
+ * Resamples a block of mono samples and writes it out in the given
+ * output format. 24-bit output is packed, use OUTPUT_FORMAT_S32 for
+ * left-justified 24-bit.
+ *
+ * Returns the number of frames written to out.
+ */
+size_t polyphase_output(struct polyphase_t *pp, float *in, size_t frames,
+	float gain, uint8_t format, uint8_t channels, void *out) {
+	float *x = pp->in;
+	float *h;
+	float sample;
+	size_t base, outframes = 0;
+	uint8_t *out8 = out;
+	int16_t *out16 = out;
+	int32_t *out32 = out;
+	float *outf = out;
+	int32_t ival;
+
+	if (frames > pp->max_frames) frames = pp->max_frames;
+
+	// the history stays in front of the new block
+	memcpy(x + POLYPHASE_TAPS - 1, in, frames * sizeof(float));
+
+	while ((base = pp->pos / pp->up) < frames) {
+		h = pp->coeffs + (pp->pos % pp->up) * POLYPHASE_TAPS;
+		sample = dsp.dot(x + base, h, POLYPHASE_TAPS) * gain;
+
+		switch (format) {
+		case OUTPUT_FORMAT_FLOAT:
+			for (uint8_t c = 0; c < channels; c++) *outf++ = sample;
+			break;
+		case OUTPUT_FORMAT_S32:
+			ival = float2int_sample(sample);
+			for (uint8_t c = 0; c < channels; c++) *out32++ = ival;
+			break;
+		case OUTPUT_FORMAT_S24:
+			ival = float2s24_sample(sample);
+			for (uint8_t c = 0; c < channels; c++) {
+				*out8++ = ival;
+				*out8++ = ival >> 8;
+				*out8++ = ival >> 16;
+			}
+			break;
+		default:
+			ival = float2short_sample(sample);
+			for (uint8_t c = 0; c < channels; c++) *out16++ = ival;
+			break;
+		}
+
+		outframes++;
+		pp->pos += pp->down;
+	}
+
+	pp->pos -= frames * pp->up;
+	memmove(x, x + frames, (POLYPHASE_TAPS - 1) * sizeof(float));
+
+	return outframes;
+}
+
+void exit_polyphase(struct polyphase_t *pp) {
+	free(pp->coeffs);
+	free(pp->in);
+	pp->coeffs = NULL;
+	pp->in = NULL;
+}
@@ -0,0 +1,41 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2019 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// taps per phase of the output resampler
+#define POLYPHASE_TAPS	48
+
+/*
+ * Polyphase resampler for a rational ratio (up / down)
+ */
+typedef struct polyphase_t {
+	uint16_t up;
+	uint16_t down;
+	// coefficients, POLYPHASE_TAPS for each of the up phases
+	float *coeffs;
+	// input history followed by the current block
+	float *in;
+	size_t max_frames;
+	// position of the next output sample in 1/up input samples
+	uint32_t pos;
+} polyphase_t;
+
+extern int8_t init_polyphase(struct polyphase_t *pp, uint32_t in_rate, uint32_t out_rate, size_t max_frames);
+extern size_t polyphase_max_output(struct polyphase_t *pp, size_t frames);
+extern size_t polyphase_output(struct polyphase_t *pp, float *in, size_t frames,
+	float gain, uint8_t format, uint8_t channels, void *out);
+extern void exit_polyphase(struct polyphase_t *pp);
@@ -190,29 +190,111 @@ typedef struct rds_oda_t {
 	uint16_t scb;
 } rds_oda_t;
 
+// ODAs that can be registered
+#define MAX_ODAS 8
+
+// RDS signal context
+typedef struct rds_context {
+	uint8_t bit_buffer[BITS_PER_GROUP];
+	uint8_t bit_pos;
+	// float, or Q15 for fixed-point encoders
+	union {
+		float f[SAMPLE_BUFFER_SIZE];
+		int32_t q15[SAMPLE_BUFFER_SIZE];
+	} sample_buffer;
+	uint8_t prev_output;
+	uint8_t cur_output;
+	uint8_t cur_bit;
+	uint8_t sample_count;
+	uint16_t in_sample_index;
+	uint16_t out_sample_index;
+	float sample_pos;
+	float sample;
+} rds_context;
+
+/*
+ * RDS encoder state
+ *
+ * Everything one station needs to generate its RDS (and RDS2) streams.
+ * The symbol waveforms are shared by all encoders.
+ */
+typedef struct rds_encoder_t {
+	struct rds_params_t data;
+
+	// RDS data controls
+	struct {
+		uint8_t ps_update;
+		uint8_t rt_update;
+		uint8_t ab;
+		uint8_t rt_segments;
+		uint8_t rt_bursting;
+		uint8_t ptyn_update;
+	} state;
+
+	// ODA
+	struct rds_oda_t odas[MAX_ODAS];
+	struct {
+		uint8_t current;
+		uint8_t count;
+	} oda_state;
+
+	// RT+
+	struct {
+		uint8_t group;
+		uint8_t running;
+		uint8_t toggle;
+		uint8_t type[2];
+		uint8_t start[2];
+		uint8_t len[2];
+	} rtplus_cfg;
+
+	// group sequencing
+	struct {
+		uint8_t af_state;
+		char ps_text[PS_LENGTH];
+		uint8_t ps_state;
+		char rt_text[RT_LENGTH];
+		uint8_t rt_state;
+		char ptyn_text[PTYN_LENGTH];
+		uint8_t ptyn_state;
+		uint8_t other_groups[16];
+		uint8_t group_state;
+		uint8_t latest_minutes;
+		uint16_t out_blocks[GROUP_LENGTH];
+	} seq;
+
+	struct {
+		uint16_t logo_pos;
+		uint16_t out_blocks[GROUP_LENGTH];
+	} rds2;
+
+	// modulator state of the RDS and RDS2 streams
+	struct rds_context streams[4];
+} rds_encoder_t;
+
 // The PTY region. This determines which PTY list to use
 enum rds_pty_regions {
 	REGION_FCC, // NRSC RBDS
 	REGION_ROW  // Rest of the world
 };
 
-extern void init_rds_encoder(struct rds_params_t rds_params, char *call_sign);
-extern void get_rds_bits(uint8_t *bits);
-extern void set_rds_pi(uint16_t pi_code);
-extern void set_rds_rt(char *rt);
-extern void set_rds_ps(char *ps);
-extern void set_rds_rtplus_flags(uint8_t running, uint8_t toggle);
-extern void set_rds_rtplus_tags(uint8_t *tags);
-extern void set_rds_ta(uint8_t ta);
-extern void set_rds_pty(uint8_t pty);
-extern void set_rds_ptyn(char *ptyn);
-extern void set_rds_af(struct rds_af_t new_af_list);
+extern void init_rds_encoder(struct rds_encoder_t *enc, struct rds_params_t rds_params, char *call_sign);
+extern void get_rds_bits(struct rds_encoder_t *enc, uint8_t *bits);
+extern void set_rds_pi(struct rds_encoder_t *enc, uint16_t pi_code);
+extern void set_rds_rt(struct rds_encoder_t *enc, char *rt);
+extern void set_rds_ps(struct rds_encoder_t *enc, char *ps);
+extern void set_rds_rtplus_flags(struct rds_encoder_t *enc, uint8_t running, uint8_t toggle);
+extern void set_rds_rtplus_tags(struct rds_encoder_t *enc, uint8_t *tags);
+extern void set_rds_ta(struct rds_encoder_t *enc, uint8_t ta);
+extern void set_rds_pty(struct rds_encoder_t *enc, uint8_t pty);
+extern void set_rds_ptyn(struct rds_encoder_t *enc, char *ptyn);
+extern void set_rds_af(struct rds_encoder_t *enc, struct rds_af_t new_af_list);
 extern int8_t add_rds_af(struct rds_af_t *af_list, float freq);
-extern void set_rds_tp(uint8_t tp);
-extern void set_rds_ms(uint8_t ms);
-extern void set_rds_ab(uint8_t ab);
-extern void set_rds_ct(uint8_t ct);
-extern void set_rds_di(uint8_t di);
-extern float get_rds_sample(uint8_t stream_num);
+extern void set_rds_tp(struct rds_encoder_t *enc, uint8_t tp);
+extern void set_rds_ms(struct rds_encoder_t *enc, uint8_t ms);
+extern void set_rds_ab(struct rds_encoder_t *enc, uint8_t ab);
+extern void set_rds_ct(struct rds_encoder_t *enc, uint8_t ct);
+extern void set_rds_di(struct rds_encoder_t *enc, uint8_t di);
+extern float get_rds_sample(struct rds_encoder_t *enc, uint8_t stream_num);
 
 #endif /* RDS_H */
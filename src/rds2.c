@@ -37,7 +37,7 @@ extern unsigned int station_logo_len;
  * Station logo group (not fully implemented)
  * See https://www.youtube.com/watch?v=ticcJpCPoa8
  */
-static void get_logo_group(uint16_t *blocks) {
+static void get_logo_group(struct rds_encoder_t *enc, uint16_t *blocks) {
 	/*
 	 * Function Header
 	 *
@@ -45,24 +45,25 @@ static void get_logo_group(uint16_t *blocks) {
 	 * Could this be for indicating the tunneled group?
 	 */
 	static uint8_t fh = 8 << 4 | 1 << 3 /* group 8B? */ | 0;
-	static uint16_t logo_pos;
+	uint16_t logo_pos = enc->rds2.logo_pos;
 
 	blocks[0] |= fh << 8 | station_logo[logo_pos];
 	blocks[1] = station_logo[logo_pos+1] << 8 | station_logo[logo_pos+2];
 	blocks[2] = station_logo[logo_pos+3] << 8 | station_logo[logo_pos+4];
 	blocks[3] = station_logo[logo_pos+5] << 8 | station_logo[logo_pos+6];
 	if ((logo_pos += 7) >= station_logo_len) logo_pos = 0;
+	enc->rds2.logo_pos = logo_pos;
 }
 
 /*
  * RDS 2 group sequence
  */
-static void get_rds2_group(int stream_num, uint16_t *blocks) {
+static void get_rds2_group(struct rds_encoder_t *enc, int stream_num, uint16_t *blocks) {
 	switch (stream_num) {
 	case 0:
 	case 1:
 	case 2:
-		get_logo_group(blocks);
+		get_logo_group(enc, blocks);
 		break;
 	}
 
@@ -70,8 +71,7 @@ static void get_rds2_group(int stream_num, uint16_t *blocks) {
 	//	stream_num, blocks[0], blocks[1], blocks[2], blocks[3]);
 }
 
-void get_rds2_bits(uint8_t stream, uint8_t *bits) {
-	static uint16_t out_blocks[GROUP_LENGTH];
-	get_rds2_group(stream, out_blocks);
-	add_checkwords(out_blocks, bits);
+void get_rds2_bits(struct rds_encoder_t *enc, uint8_t stream, uint8_t *bits) {
+	get_rds2_group(enc, stream, enc->rds2.out_blocks);
+	add_checkwords(enc->rds2.out_blocks, bits);
 }
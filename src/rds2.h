@@ -16,4 +16,4 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-extern float get_rds2_bits(uint8_t stream_num, uint8_t *bits);
+extern void get_rds2_bits(struct rds_encoder_t *enc, uint8_t stream_num, uint8_t *bits);
@@ -17,66 +17,151 @@
  */
 
 #include "common.h"
-#ifdef RDS2
+#include <pthread.h>
+#include "rds_modulator.h"
 #include "rds2.h"
-#endif
-#include "fm_mpx.h"
 #include "waveforms.h"
-#include "rds_modulator.h"
+#include "shared_tables.h"
 
+/*
+ * Symbol waveforms
+ *
+ * These are only read by the modulators so all encoders share one
+ * copy. It is built by the first encoder (or taken from the shared or
+ * built-in tables) and freed by the last one.
+ */
 static float *sym_waveforms[2];
+static uint8_t sym_waveforms_shared;
+// Q15 copies for the fixed-point encoders
+static int16_t *sym_waveforms_q15[2];
+static uint16_t sym_waveform_users;
+static pthread_mutex_t sym_waveform_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /*
  * Also create the inverted version of the symbol waveform
  */
 void init_symbol_waveforms() {
+	uint32_t len[2];
+
+	pthread_mutex_lock(&sym_waveform_mutex);
+	if (sym_waveform_users++) {
+		pthread_mutex_unlock(&sym_waveform_mutex);
+		return;
+	}
+
+	sym_waveforms[0] = (float *)find_shared_table("symbol 0", &len[0]);
+	sym_waveforms[1] = (float *)find_shared_table("symbol 1", &len[1]);
+	if (sym_waveforms[0] != NULL && sym_waveforms[1] != NULL &&
+	    len[0] == FILTER_SIZE && len[1] == FILTER_SIZE) {
+		sym_waveforms_shared = 1;
+	} else {
+		sym_waveforms_shared = 0;
+
+		for (uint8_t i = 0; i < 2; i++) {
+			sym_waveforms[i] = malloc(FILTER_SIZE * sizeof(float));
+			for (uint16_t j = 0; j < FILTER_SIZE; j++) {
+				sym_waveforms[i][j] = (i) ?
+					+waveform_biphase[j] : -waveform_biphase[j];
+			}
+		}
+		share_table("symbol 0", sym_waveforms[0], FILTER_SIZE);
+		share_table("symbol 1", sym_waveforms[1], FILTER_SIZE);
+	}
+
 	for (uint8_t i = 0; i < 2; i++) {
-		sym_waveforms[i] = malloc(FILTER_SIZE * sizeof(float));
+		sym_waveforms_q15[i] = malloc(FILTER_SIZE * sizeof(int16_t));
 		for (uint16_t j = 0; j < FILTER_SIZE; j++) {
-			sym_waveforms[i][j] = (i) ?
-				+waveform_biphase[j] : -waveform_biphase[j];
+			sym_waveforms_q15[i][j] = lrintf(sym_waveforms[i][j] * 32768.0f);
 		}
 	}
+
+	pthread_mutex_unlock(&sym_waveform_mutex);
 }
 
 void exit_symbol_waveforms() {
-	for (uint8_t i = 0; i < 2; i++) {
-		free(sym_waveforms[i]);
+	pthread_mutex_lock(&sym_waveform_mutex);
+	if (sym_waveform_users && --sym_waveform_users == 0) {
+		for (uint8_t i = 0; i < 2; i++) {
+			if (!sym_waveforms_shared) free(sym_waveforms[i]);
+			sym_waveforms[i] = NULL;
+			free(sym_waveforms_q15[i]);
+			sym_waveforms_q15[i] = NULL;
+		}
 	}
+	pthread_mutex_unlock(&sym_waveform_mutex);
 }
 
-static struct rds_context rds_contexts[4];
+/*
+ * Moves on to the next bit of the stream and returns the differentially
+ * encoded symbol for it
+ */
+static inline uint8_t next_symbol(struct rds_encoder_t *enc, uint8_t stream_num) {
+	struct rds_context *rds = &enc->streams[stream_num];
+
+	if (rds->bit_pos == BITS_PER_GROUP) {
+		if (stream_num > 0) {
+			get_rds2_bits(enc, stream_num, rds->bit_buffer);
+		} else {
+			get_rds_bits(enc, rds->bit_buffer);
+		}
+		rds->bit_pos = 0;
+	}
+
+	// do differential encoding
+	rds->cur_bit = rds->bit_buffer[rds->bit_pos++];
+	rds->prev_output = rds->cur_output;
+	rds->cur_output = rds->prev_output ^ rds->cur_bit;
+
+	return rds->cur_output;
+}
 
 /* Get an RDS sample. This generates the envelope of the waveform using
  * pre-generated elementary waveform samples.
  */
-float get_rds_sample(uint8_t stream_num) {
-	struct rds_context *rds = &rds_contexts[stream_num];
+float get_rds_sample(struct rds_encoder_t *enc, uint8_t stream_num) {
+	struct rds_context *rds = &enc->streams[stream_num];
+	float *sample_buffer = rds->sample_buffer.f;
 
 	if (rds->sample_count == SAMPLES_PER_BIT) {
-		if (rds->bit_pos == BITS_PER_GROUP) {
-#ifdef RDS2
-			if (stream_num > 0) {
-				get_rds2_bits(stream_num, rds->bit_buffer);
-			} else {
-				get_rds_bits(rds->bit_buffer);
-			}
-#else
-			get_rds_bits(rds->bit_buffer);
-#endif
-			rds->bit_pos = 0;
+		uint8_t symbol = next_symbol(enc, stream_num);
+		uint16_t idx = rds->in_sample_index;
+
+		for (uint16_t j = 0; j < FILTER_SIZE; j++) {
+			sample_buffer[idx++] += sym_waveforms[symbol][j];
+			if (idx == SAMPLE_BUFFER_SIZE) idx = 0;
 		}
 
-		// do differential encoding
-		rds->cur_bit = rds->bit_buffer[rds->bit_pos++];
-		rds->prev_output = rds->cur_output;
-		rds->cur_output = rds->prev_output ^ rds->cur_bit;
+		rds->in_sample_index += SAMPLES_PER_BIT;
+		if (rds->in_sample_index == SAMPLE_BUFFER_SIZE)
+			rds->in_sample_index = 0;
+
+		rds->sample_count = 0;
+	}
+	rds->sample_count++;
 
+	rds->sample = sample_buffer[rds->out_sample_index];
+	sample_buffer[rds->out_sample_index++] = 0;
+	if (rds->out_sample_index == SAMPLE_BUFFER_SIZE)
+		rds->out_sample_index = 0;
+
+	return rds->sample;
+}
+
+/*
+ * Same as above with the Q15 pulses, for the fixed-point encoders.
+ * Returns a Q15 sample.
+ */
+int32_t get_rds_sample_q15(struct rds_encoder_t *enc, uint8_t stream_num) {
+	struct rds_context *rds = &enc->streams[stream_num];
+	int32_t *sample_buffer = rds->sample_buffer.q15;
+	int32_t sample;
+
+	if (rds->sample_count == SAMPLES_PER_BIT) {
+		uint8_t symbol = next_symbol(enc, stream_num);
 		uint16_t idx = rds->in_sample_index;
 
 		for (uint16_t j = 0; j < FILTER_SIZE; j++) {
-			rds->sample_buffer[idx++] +=
-				sym_waveforms[rds->cur_output][j];
+			sample_buffer[idx++] += sym_waveforms_q15[symbol][j];
 			if (idx == SAMPLE_BUFFER_SIZE) idx = 0;
 		}
 
@@ -88,10 +173,10 @@ float get_rds_sample(uint8_t stream_num) {
 	}
 	rds->sample_count++;
 
-	rds->sample = rds->sample_buffer[rds->out_sample_index];
-	rds->sample_buffer[rds->out_sample_index++] = 0;
+	sample = sample_buffer[rds->out_sample_index];
+	sample_buffer[rds->out_sample_index++] = 0;
 	if (rds->out_sample_index == SAMPLE_BUFFER_SIZE)
 		rds->out_sample_index = 0;
 
-	return rds->sample;
+	return sample;
 }
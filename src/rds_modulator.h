@@ -18,20 +18,6 @@
 
 #include "rds.h"
 
-// RDS signal context
-typedef struct rds_context {
-	uint8_t bit_buffer[BITS_PER_GROUP];
-	uint8_t bit_pos;
-	float sample_buffer[SAMPLE_BUFFER_SIZE];
-	uint8_t prev_output;
-	uint8_t cur_output;
-	uint8_t cur_bit;
-	uint8_t sample_count;
-	uint16_t in_sample_index;
-	uint16_t out_sample_index;
-	float sample_pos;
-	float sample;
-} rds_context;
-
 extern void init_symbol_waveforms();
 extern void exit_symbol_waveforms();
+extern int32_t get_rds_sample_q15(struct rds_encoder_t *enc, uint8_t stream_num);
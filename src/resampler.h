@@ -18,8 +18,20 @@
 
 #include <samplerate.h>
 
-#define CONVERTER_TYPE SRC_SINC_FASTEST
+/*
+ * Pull resampling stage
+ *
+ * The input callback is called whenever more input is needed. It
+ * points *audio at the next block of frames and returns how many there
+ * are, or 0 at the end of the input.
+ */
+typedef struct resampler_t {
+	SRC_STATE *state;
+	// output rate / input rate, may be changed between reads
+	double ratio;
+} resampler_t;
 
-extern int8_t resampler_init(SRC_STATE **src_state, uint8_t channels);
-extern int8_t resample(SRC_STATE *src_state, SRC_DATA src_data, size_t *frames_generated);
-extern void resampler_exit(SRC_STATE *src_state);
+extern int8_t resampler_init(struct resampler_t *rs, uint8_t channels, double ratio,
+	uint8_t quality, src_callback_t input, void *input_data);
+extern int32_t resample(struct resampler_t *rs, float *out, size_t frames);
+extern void resampler_exit(struct resampler_t *rs);
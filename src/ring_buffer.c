@@ -0,0 +1,110 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "ring_buffer.h"
+
+int8_t init_ring_buffer(struct ring_buffer_t *rb, size_t frames, uint8_t channels) {
+	memset(rb, 0, sizeof(struct ring_buffer_t));
+
+	rb->buffer = malloc(frames * channels * sizeof(float));
+	if (rb->buffer == NULL) return -1;
+
+	rb->size = frames;
+	rb->channels = channels;
+
+	return 0;
+}
+
+/*
+ * Number of frames that can be read
+ */
+size_t ring_buffer_fill(struct ring_buffer_t *rb) {
+	uint64_t write_pos = __atomic_load_n(&rb->write_pos, __ATOMIC_ACQUIRE);
+	uint64_t read_pos = __atomic_load_n(&rb->read_pos, __ATOMIC_ACQUIRE);
+
+	return write_pos - read_pos;
+}
+
+/*
+ * Number of frames that can be written
+ */
+size_t ring_buffer_space(struct ring_buffer_t *rb) {
+	return rb->size - ring_buffer_fill(rb);
+}
+
+/*
+ * Writes up to the given number of frames and returns how many were
+ * actually written. Must only be called by the producer.
+ */
+size_t ring_buffer_write(struct ring_buffer_t *rb, float *in, size_t frames) {
+	uint64_t write_pos = rb->write_pos;
+	size_t idx, part;
+
+	if (frames > ring_buffer_space(rb)) frames = ring_buffer_space(rb);
+
+	idx = write_pos % rb->size;
+	part = rb->size - idx;
+	if (part > frames) part = frames;
+
+	memcpy(rb->buffer + idx * rb->channels, in,
+		part * rb->channels * sizeof(float));
+	memcpy(rb->buffer, in + part * rb->channels,
+		(frames - part) * rb->channels * sizeof(float));
+
+	__atomic_store_n(&rb->write_pos, write_pos + frames, __ATOMIC_RELEASE);
+
+	return frames;
+}
+
+/*
+ * Reads up to the given number of frames and returns how many were
+ * actually read. Must only be called by the consumer.
+ */
+size_t ring_buffer_read(struct ring_buffer_t *rb, float *out, size_t frames) {
+	uint64_t read_pos = rb->read_pos;
+	size_t idx, part;
+
+	if (frames > ring_buffer_fill(rb)) frames = ring_buffer_fill(rb);
+
+	idx = read_pos % rb->size;
+	part = rb->size - idx;
+	if (part > frames) part = frames;
+
+	memcpy(out, rb->buffer + idx * rb->channels,
+		part * rb->channels * sizeof(float));
+	memcpy(out + part * rb->channels, rb->buffer,
+		(frames - part) * rb->channels * sizeof(float));
+
+	__atomic_store_n(&rb->read_pos, read_pos + frames, __ATOMIC_RELEASE);
+
+	return frames;
+}
+
+/*
+ * Drops everything in the buffer. Must only be called by the consumer.
+ */
+void ring_buffer_clear(struct ring_buffer_t *rb) {
+	__atomic_store_n(&rb->read_pos,
+		__atomic_load_n(&rb->write_pos, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+void exit_ring_buffer(struct ring_buffer_t *rb) {
+	free(rb->buffer);
+	rb->buffer = NULL;
+}
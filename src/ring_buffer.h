@@ -0,0 +1,39 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Single producer, single consumer ring buffer of audio frames
+ *
+ * The read and write positions only ever increase, so the fill level is
+ * simply their difference. Each position is only written by one side.
+ */
+typedef struct ring_buffer_t {
+	float *buffer;
+	size_t size; // in frames
+	uint8_t channels;
+	uint64_t read_pos;
+	uint64_t write_pos;
+} ring_buffer_t;
+
+extern int8_t init_ring_buffer(struct ring_buffer_t *rb, size_t frames, uint8_t channels);
+extern size_t ring_buffer_fill(struct ring_buffer_t *rb);
+extern size_t ring_buffer_space(struct ring_buffer_t *rb);
+extern size_t ring_buffer_write(struct ring_buffer_t *rb, float *in, size_t frames);
+extern size_t ring_buffer_read(struct ring_buffer_t *rb, float *out, size_t frames);
+extern void ring_buffer_clear(struct ring_buffer_t *rb);
+extern void exit_ring_buffer(struct ring_buffer_t *rb);
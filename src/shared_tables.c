@@ -0,0 +1,290 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fm_mpx.h"
+#include "shared_tables.h"
+
+/*
+ * Read-only tables shared between processes
+ *
+ * The carrier tables, filter coefficients and RDS symbol waveforms are
+ * the same for every instance. The first instance started with shared
+ * tables builds them into a POSIX shared memory segment and all of the
+ * others map it read-only instead of building their own.
+ *
+ * Every instance opens (or creates) the segment and takes a shared
+ * lock on it. If it is not ready yet, the instance takes an exclusive
+ * lock instead. Whoever gets that lock first and still finds the
+ * segment not ready builds it in place, and the rest wait on the lock.
+ * As the segment is never removed, a new one can not end up being
+ * built while another instance is still getting the lock on the
+ * first. A segment left behind by a builder that did not finish is
+ * simply built again by the next one.
+ *
+ * The segment stays around after the last instance exits so restarts
+ * do not have to build it again.
+ *
+ * Without a segment, the tables generated at build time (dsp_tables.c)
+ * are used. Only tables for other rates or sizes are built at run time.
+ */
+
+#define SHARED_TABLES_MAGIC	0x5854504D // "MPTX"
+
+typedef struct shared_table_t {
+	char key[SHARED_TABLE_KEY_LENGTH];
+	// in floats from the start of the table data
+	uint32_t offset;
+	uint32_t len;
+} shared_table_t;
+
+typedef struct shared_tables_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_tables;
+	uint32_t ready;
+	struct shared_table_t tables[MAX_SHARED_TABLES];
+	// the table data follows
+} shared_tables_header_t;
+
+// the mapped segment
+static struct shared_tables_header_t *segment;
+static size_t segment_len;
+
+// tables being collected
+static struct dsp_table_t *staged;
+static uint8_t num_staged;
+static pthread_mutex_t staged_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Called by the table builders with every table they build. The tables
+ * are only kept while they are being collected.
+ */
+void share_table(char *key, float *data, uint32_t len) {
+	float *copy;
+
+	if (staged == NULL) return;
+
+	pthread_mutex_lock(&staged_mutex);
+	// tables can be built more than once while they are collected
+	for (uint8_t i = 0; i < num_staged; i++) {
+		if (!strncmp(staged[i].key, key, SHARED_TABLE_KEY_LENGTH - 1)) {
+			pthread_mutex_unlock(&staged_mutex);
+			return;
+		}
+	}
+	if (num_staged < MAX_SHARED_TABLES) {
+		copy = malloc(len * sizeof(float));
+		if (copy == NULL) {
+			// left out, the instances build it themselves
+			pthread_mutex_unlock(&staged_mutex);
+			return;
+		}
+		strncpy(staged[num_staged].key, key, SHARED_TABLE_KEY_LENGTH - 1);
+		memcpy(copy, data, len * sizeof(float));
+		staged[num_staged].data = copy;
+		staged[num_staged].len = len;
+		num_staged++;
+	}
+	pthread_mutex_unlock(&staged_mutex);
+}
+
+/*
+ * Builds every table an encoder can use, by setting one up with every
+ * quality tier
+ *
+ * tables must have room for MAX_SHARED_TABLES tables. Returns the
+ * number of tables.
+ */
+uint8_t collect_tables(struct dsp_table_t *tables) {
+	struct fm_mpx_t *mpx;
+	uint8_t count;
+
+	memset(tables, 0, MAX_SHARED_TABLES * sizeof(struct dsp_table_t));
+
+	mpx = malloc(sizeof(struct fm_mpx_t));
+	if (mpx == NULL) return 0;
+	num_staged = 0;
+	staged = tables;
+	if (fm_mpx_init(mpx) == 0) {
+		// with the RDS2 carriers too
+		set_rds2_streams(mpx, MAX_RDS2_STREAMS);
+		for (uint8_t i = 0; i < NUM_QUALITY_TIERS; i++) set_quality(mpx, i);
+		fm_mpx_exit(mpx);
+	}
+	staged = NULL;
+	count = num_staged;
+	free(mpx);
+
+	return count;
+}
+
+void free_tables(struct dsp_table_t *tables, uint8_t count) {
+	for (uint8_t i = 0; i < count; i++) free((float *)tables[i].data);
+}
+
+/*
+ * Returns the shared or built-in copy of a table or NULL if there is
+ * none
+ */
+const float *find_shared_table(char *key, uint32_t *len) {
+	float *data;
+
+	// everything is built while the tables are being collected
+	if (staged != NULL) return NULL;
+
+	if (segment != NULL) {
+		data = (float *)(segment + 1);
+		for (uint32_t i = 0; i < segment->num_tables; i++) {
+			if (strncmp(segment->tables[i].key, key, SHARED_TABLE_KEY_LENGTH)) continue;
+			*len = segment->tables[i].len;
+			return data + segment->tables[i].offset;
+		}
+	}
+
+	for (uint8_t i = 0; i < num_builtin_tables; i++) {
+		if (strncmp(builtin_tables[i].key, key, SHARED_TABLE_KEY_LENGTH)) continue;
+		*len = builtin_tables[i].len;
+		return builtin_tables[i].data;
+	}
+
+	return NULL;
+}
+
+/*
+ * Builds every table and writes them to the segment
+ */
+static int8_t build_shared_tables(int fd) {
+	struct dsp_table_t tables[MAX_SHARED_TABLES];
+	struct shared_tables_header_t *header;
+	uint8_t num_tables;
+	uint32_t data_len = 0;
+	size_t len;
+	float *data;
+
+	num_tables = collect_tables(tables);
+
+	for (uint8_t i = 0; i < num_tables; i++) data_len += tables[i].len;
+	len = sizeof(struct shared_tables_header_t) + data_len * sizeof(float);
+
+	if (ftruncate(fd, len) == -1) goto error;
+	header = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (header == MAP_FAILED) goto error;
+
+	memset(header, 0, sizeof(struct shared_tables_header_t));
+	header->magic = SHARED_TABLES_MAGIC;
+	header->version = SHARED_TABLES_VERSION;
+	data = (float *)(header + 1);
+	data_len = 0;
+
+	for (uint8_t i = 0; i < num_tables; i++) {
+		memcpy(header->tables[i].key, tables[i].key, SHARED_TABLE_KEY_LENGTH);
+		header->tables[i].offset = data_len;
+		header->tables[i].len = tables[i].len;
+		memcpy(data + data_len, tables[i].data, tables[i].len * sizeof(float));
+		data_len += tables[i].len;
+	}
+	header->num_tables = num_tables;
+	header->ready = 1;
+
+	munmap(header, len);
+	free_tables(tables, num_tables);
+
+	return 0;
+
+error:
+	free_tables(tables, num_tables);
+	return -1;
+}
+
+static int8_t map_shared_tables(int fd) {
+	struct stat st;
+
+	if (fstat(fd, &st) == -1 ||
+	    (size_t)st.st_size < sizeof(struct shared_tables_header_t)) return -1;
+
+	segment_len = st.st_size;
+	segment = mmap(NULL, segment_len, PROT_READ, MAP_SHARED, fd, 0);
+	if (segment == MAP_FAILED) {
+		segment = NULL;
+		return -1;
+	}
+
+	if (segment->magic != SHARED_TABLES_MAGIC ||
+	    segment->version != SHARED_TABLES_VERSION ||
+	    !segment->ready || segment->num_tables > MAX_SHARED_TABLES) {
+		close_shared_tables();
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Maps the shared tables, building them first if this is the first
+ * instance. Must be called before any encoder is set up.
+ */
+int8_t open_shared_tables() {
+	int8_t r = 0;
+	int fd;
+
+	fd = shm_open(SHARED_TABLES_NAME, O_RDWR | O_CREAT, 0644);
+	// made by another user, only they can build it
+	if (fd == -1 && errno == EACCES) fd = shm_open(SHARED_TABLES_NAME, O_RDONLY, 0);
+	if (fd == -1) {
+		fprintf(stderr, "Error: could not open the shared tables.\n");
+		return -1;
+	}
+
+	flock(fd, LOCK_SH);
+	if (map_shared_tables(fd) == 0) {
+		fprintf(stderr, "Using shared tables %s.\n", SHARED_TABLES_NAME);
+	} else {
+		// new, or left over from a builder that did not finish
+		flock(fd, LOCK_EX);
+		if (map_shared_tables(fd) == 0) {
+			fprintf(stderr, "Using shared tables %s.\n", SHARED_TABLES_NAME);
+		} else if (build_shared_tables(fd) == 0 && map_shared_tables(fd) == 0) {
+			fprintf(stderr, "Built shared tables %s.\n", SHARED_TABLES_NAME);
+		} else {
+			r = -1;
+		}
+	}
+
+	flock(fd, LOCK_UN);
+	close(fd);
+	if (r == 0) return 0;
+
+	fprintf(stderr, "Error: could not set up the shared tables.\n");
+	return -1;
+}
+
+/*
+ * Unmaps the tables. Must not be called before all encoders have been
+ * closed.
+ */
+void close_shared_tables() {
+	if (segment != NULL) munmap(segment, segment_len);
+	segment = NULL;
+}
@@ -0,0 +1,44 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Bump the version (and the name with it) whenever a table changes so
+ * instances of different versions never map each other's tables.
+ */
+#define SHARED_TABLES_VERSION	4
+#define SHARED_TABLES_NAME	"/mpxgen-tables-4"
+
+#define MAX_SHARED_TABLES	32
+#define SHARED_TABLE_KEY_LENGTH	32
+
+typedef struct dsp_table_t {
+	char key[SHARED_TABLE_KEY_LENGTH];
+	const float *data;
+	uint32_t len;
+} dsp_table_t;
+
+// generated at build time by gen_tables (dsp_tables.c)
+extern const struct dsp_table_t builtin_tables[];
+extern const uint8_t num_builtin_tables;
+
+extern uint8_t collect_tables(struct dsp_table_t *tables);
+extern void free_tables(struct dsp_table_t *tables, uint8_t count);
+extern int8_t open_shared_tables();
+extern const float *find_shared_table(char *key, uint32_t *len);
+extern void share_table(char *key, float *data, uint32_t len);
+extern void close_shared_tables();
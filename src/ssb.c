@@ -17,82 +17,143 @@
  */
 
 #include "common.h"
+#include <pthread.h>
 #include "ssb.h"
+#include "dsp_kernels.h"
+#include "shared_tables.h"
 
 /*
  * Hilbert transform FIR filter
  *
- * https://www-users.cs.york.ac.uk/~fisher/mkfilter/
- * http://dp.nonoo.hu/projects/ham-dsp-tutorial/09-ssb-hartley/
+ * Equiripple design (see filter_design.c), as short as the spec allows
+ */
+
+/*
+ * Coefficient sets
  *
- * Filter creation based on the code from
- * https://github.com/MikeCurrington/mkfilter/
+ * Filters of the same spec use the same coefficients, so only one copy
+ * of each is kept. It is built by the first filter (or taken from the
+ * shared or built-in tables) and freed with the last one.
  */
+#define MAX_HILBERT_DESIGNS	4
 
-void init_hilbert_transformer(struct hilbert_fir_t *flt, uint16_t size) {
-	uint16_t half_size = size / 2;
-	double filter, window;
-	uint8_t odd = 0;
+static struct hilbert_design_t {
+	uint32_t sample_rate;
+	struct hilbert_spec_t spec;
+	float *coeffs;
+	uint16_t size;
+	uint16_t users;
+	// points into the shared or built-in tables
+	uint8_t shared;
+} designs[MAX_HILBERT_DESIGNS];
+static pthread_mutex_t design_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-	memset(flt, 0, sizeof(struct hilbert_fir_t));
-	flt->num_coeffs = size + 1;
-	flt->coeffs = malloc(flt->num_coeffs * sizeof(float));
-	flt->in_buffer = malloc(flt->num_coeffs * sizeof(float));
-
-	// start from the center
-	for (uint16_t i = 1; i < half_size + 1; i++) {
-		if (i & 1) { // calculate for odd indexes only
-			filter = 1.0 / (double)i;
-			// Hamming window
-			window = 0.54 - 0.46 * cos(M_2PI * (double)(half_size + i) / (double)size);
-			flt->coeffs[half_size+i] = (float)(-filter * window);
-			flt->coeffs[half_size-i] = (float)(+filter * window);
-		} else {
-			flt->coeffs[half_size+i] = 0.0f;
-			flt->coeffs[half_size-i] = 0.0f;
-		}
-	}
+static int8_t get_hilbert_design(struct hilbert_design_t *design, uint32_t sample_rate,
+	struct hilbert_spec_t spec) {
+	char key[SHARED_TABLE_KEY_LENGTH];
+	const float *coeffs;
+	uint32_t len;
+
+	design->sample_rate = sample_rate;
+	design->spec = spec;
 
-	// set center of filter to 0
-	flt->coeffs[half_size] = 0.0;
+	snprintf(key, SHARED_TABLE_KEY_LENGTH, "hilbert %u %.0f %.2f",
+		sample_rate, spec.low_edge, spec.ripple);
 
-	// calculate input gain
-	for (uint16_t i = half_size & 1 ? 0 : 1; i < flt->num_coeffs && flt->coeffs[i] > 0.0; i += 2) {
-		flt->gain += (odd) ? +flt->coeffs[i] : -flt->coeffs[i];
-		odd ^= 1;
+	coeffs = find_shared_table(key, &len);
+	if (coeffs != NULL) {
+		design->coeffs = (float *)coeffs;
+		design->size = len;
+		design->shared = 1;
+		return 0;
 	}
 
-	if (odd) flt->gain = -flt->gain;
-	flt->gain *= 2.0f;
+	design->coeffs = design_hilbert(sample_rate, spec, &design->size);
+	if (design->coeffs == NULL) return -1;
+	design->shared = 0;
 
-#if 0
-	printf("coeffs: ");
-	for (int i = 0; i < flt->num_coeffs; i++) {
-		printf("%.7f, ", flt->coeffs[i]);
+	share_table(key, design->coeffs, design->size);
+
+	return 0;
+}
+
+int8_t init_hilbert_transformer(struct hilbert_fir_t *flt, uint32_t sample_rate,
+	struct hilbert_spec_t spec) {
+	struct hilbert_design_t *design = NULL;
+
+	memset(flt, 0, sizeof(struct hilbert_fir_t));
+
+	pthread_mutex_lock(&design_mutex);
+	for (uint8_t i = 0; i < MAX_HILBERT_DESIGNS; i++) {
+		if (designs[i].users && designs[i].sample_rate == sample_rate &&
+		    designs[i].spec.low_edge == spec.low_edge &&
+		    designs[i].spec.ripple == spec.ripple) {
+			design = &designs[i];
+			break;
+		}
+		if (design == NULL && !designs[i].users) design = &designs[i];
 	}
-	printf("\ngain: %.7f\n", flt->gain);
-#endif
+	if (design == NULL) {
+		pthread_mutex_unlock(&design_mutex);
+		fprintf(stderr, "Error: too many Hilbert transformer designs.\n");
+		return -1;
+	}
+	if (!design->users && get_hilbert_design(design, sample_rate, spec) < 0) {
+		pthread_mutex_unlock(&design_mutex);
+		return -1;
+	}
+	design->users++;
+	pthread_mutex_unlock(&design_mutex);
+
+	flt->num_coeffs = design->size;
+	flt->coeffs = design->coeffs;
+	flt->delay = design->size - 1;
+	// twice over so the window is always in one piece
+	flt->in_buffer[0] = calloc(2 * flt->num_coeffs, sizeof(float));
+	flt->in_buffer[1] = calloc(2 * flt->num_coeffs, sizeof(float));
+
+	return 0;
 }
 
-float get_hilbert(struct hilbert_fir_t *flt, float in) {
-	float filter_out;
-	uint16_t filter_idx;
+/*
+ * Takes a sample without working out the output, for when the output
+ * is known to be 0 but the history has to be kept up
+ */
+void put_hilbert(struct hilbert_fir_t *flt, float in) {
+	float *in_buffer = flt->in_buffer[flt->phase];
+	uint16_t idx = flt->flt_buffer_idx[flt->phase];
 
-	flt->in_buffer[flt->flt_buffer_idx++] = in / flt->gain;
-	if (flt->flt_buffer_idx == flt->num_coeffs) flt->flt_buffer_idx = 0;
+	in_buffer[idx] = in_buffer[idx + flt->num_coeffs] = in;
+	if (++idx == flt->num_coeffs) idx = 0;
+	flt->flt_buffer_idx[flt->phase] = idx;
+	flt->phase ^= 1;
+}
 
-	filter_idx = flt->flt_buffer_idx;
+/*
+ * Only every other tap is not 0, so every other sample goes to the
+ * other history and the output only needs the one the sample went to
+ */
+float get_hilbert(struct hilbert_fir_t *flt, float in) {
+	uint8_t phase = flt->phase;
 
-	filter_out = 0.0f;
-	for (uint16_t i = 0; i < flt->num_coeffs; i++) {
-		filter_out += flt->in_buffer[filter_idx++] * flt->coeffs[i];
-		if (filter_idx == flt->num_coeffs) filter_idx = 0;
-	}
+	put_hilbert(flt, in);
 
-	return filter_out;
+	// oldest sample first
+	return dsp.dot(flt->in_buffer[phase] + flt->flt_buffer_idx[phase],
+		flt->coeffs, flt->num_coeffs);
 }
 
 void exit_hilbert_transformer(struct hilbert_fir_t *flt) {
-	free(flt->coeffs);
-	free(flt->in_buffer);
+	pthread_mutex_lock(&design_mutex);
+	for (uint8_t i = 0; i < MAX_HILBERT_DESIGNS; i++) {
+		if (!designs[i].users || designs[i].coeffs != flt->coeffs) continue;
+		if (--designs[i].users == 0 && !designs[i].shared) free(designs[i].coeffs);
+		break;
+	}
+	pthread_mutex_unlock(&design_mutex);
+
+	free(flt->in_buffer[0]);
+	free(flt->in_buffer[1]);
+	flt->coeffs = NULL;
+	flt->in_buffer[0] = flt->in_buffer[1] = NULL;
 }
@@ -16,18 +16,26 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "filter_design.h"
+
 /*
  * Object for a Hilbert transform filter
  *
  */
 typedef struct hilbert_fir_t {
+	// the taps that are not 0, shared by all filters of the same spec
 	float *coeffs;
-	float *in_buffer;
 	uint16_t num_coeffs;
-	float gain;
-	uint16_t flt_buffer_idx;
+	// group delay (samples)
+	uint16_t delay;
+	// the last num_coeffs samples of every other sample, twice over
+	float *in_buffer[2];
+	uint16_t flt_buffer_idx[2];
+	uint8_t phase;
 } hilbert_fir_t;
 
-extern void init_hilbert_transformer(struct hilbert_fir_t *flt, uint16_t size);
+extern int8_t init_hilbert_transformer(struct hilbert_fir_t *flt, uint32_t sample_rate,
+	struct hilbert_spec_t spec);
+extern void put_hilbert(struct hilbert_fir_t *flt, float in);
 extern float get_hilbert(struct hilbert_fir_t *flt, float in);
 extern void exit_hilbert_transformer(struct hilbert_fir_t *flt);
@@ -0,0 +1,571 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <pthread.h>
+#include <ctype.h>
+
+#include "fm_mpx.h"
+#include "control_pipe.h"
+#include "control_socket.h"
+#include "resampler.h"
+#include "polyphase.h"
+#include "output.h"
+#include "file_input.h"
+#include "station.h"
+
+/*
+ * Multi-station mode
+ *
+ * Runs every station listed in a station file from one process. Each
+ * station has its own encoder (audio chain, RDS data and control
+ * channels) and its own input and output file or pipe. The carrier
+ * tables, filter coefficients and RDS symbol waveforms are shared by
+ * all of them.
+ *
+ * The stations are run by a fixed pool of worker threads. A worker
+ * takes the free station that has had the fewest blocks so far and
+ * generates one block for it. With one worker the stations take
+ * strict turns. With more, a station whose blocks take longer (or
+ * whose output is slow) falls behind while it is being worked on, as
+ * the other workers do not wait for it: a slow output only holds up
+ * its own station. It is first in line again as soon as it is free.
+ */
+
+typedef struct station_t {
+	// from the station file
+	char audio_file[51];
+	char output_file[51];
+	char control_pipe[51];
+	char control_socket[51];
+	uint8_t rds;
+	uint8_t rds2_streams;
+	uint8_t fixed_point;
+	uint8_t quality;
+	uint8_t stereo_mode;
+	float asymmetry;
+	uint8_t mpx;
+	uint8_t wait;
+	struct rds_params_t rds_params;
+	char callsign[5];
+
+	struct fm_mpx_t encoder;
+	uint8_t encoder_open;
+
+	struct file_input_t input;
+	struct resampler_t resampler;
+	size_t input_frames;
+	uint8_t input_open;
+
+	struct file_output_t output;
+	struct polyphase_t output_kernel;
+	uint8_t output_open;
+
+	struct control_pipe_t ctl_pipe;
+	struct control_socket_t ctl_socket;
+	uint8_t ctl_pipe_open;
+	uint8_t ctl_socket_open;
+
+	// buffers
+	float *audio_in;
+	float *mpx_in;
+	float *mpx_out;
+	void *output_buf;
+
+	// held by the worker generating the station's next block
+	pthread_mutex_t lock;
+	uint8_t busy;
+	uint8_t done;
+	// generated so far, the station furthest behind goes first
+	uint64_t blocks;
+} station_t;
+
+static struct station_t *stations;
+static uint16_t num_stations;
+static uint16_t active_stations;
+
+static size_t block_size;
+// sample format handed to the output files
+static uint8_t block_format;
+static uint8_t *stop_stations;
+
+static void init_station_defaults(struct station_t *st) {
+	memset(st, 0, sizeof(struct station_t));
+
+	// same defaults as the single station mode
+	st->rds = 1;
+	st->mpx = 50;
+	st->wait = 1;
+	st->quality = QUALITY_STANDARD;
+	st->stereo_mode = STEREO_SSB;
+	st->asymmetry = DEFAULT_ASYMMETRY;
+	st->rds_params.pi = 0x1000;
+	memcpy(st->rds_params.ps, "Mpxgen", 6);
+	memcpy(st->rds_params.rt, "Mpxgen: FM Stereo and RDS encoder", 33);
+
+	pthread_mutex_init(&st->lock, NULL);
+}
+
+static char *trim(char *s) {
+	char *end;
+
+	while (isspace((unsigned char)*s)) s++;
+	end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1])) *--end = 0;
+
+	return s;
+}
+
+/*
+ * Sets a station option. The names are the long options of the single
+ * station mode.
+ */
+static int8_t set_station_option(struct station_t *st, char *name, char *value) {
+	int8_t quality;
+	int8_t stereo_mode;
+
+	if (!strcmp(name, "audio")) {
+		strncpy(st->audio_file, value, 50);
+	} else if (!strcmp(name, "output-file")) {
+		strncpy(st->output_file, value, 50);
+	} else if (!strcmp(name, "mpx")) {
+		st->mpx = strtoul(value, NULL, 10);
+		if (st->mpx < 1 || st->mpx > 100) {
+			fprintf(stderr, "MPX volume must be between 1 - 100.\n");
+			return -1;
+		}
+	} else if (!strcmp(name, "wait")) {
+		st->wait = strtoul(value, NULL, 10);
+	} else if (!strcmp(name, "rds")) {
+		st->rds = strtoul(value, NULL, 10);
+	} else if (!strcmp(name, "rds2")) {
+		st->rds2_streams = strtoul(value, NULL, 10);
+	} else if (!strcmp(name, "fixed-point")) {
+		st->fixed_point = strtoul(value, NULL, 10);
+	} else if (!strcmp(name, "quality")) {
+		quality = parse_quality(value);
+		if (quality < 0) {
+			fprintf(stderr, "Unknown quality: %s.\n", value);
+			return -1;
+		}
+		st->quality = quality;
+	} else if (!strcmp(name, "stereo-mode")) {
+		stereo_mode = parse_stereo_mode(value);
+		if (stereo_mode < 0) {
+			fprintf(stderr, "Unknown stereo mode: %s.\n", value);
+			return -1;
+		}
+		st->stereo_mode = stereo_mode;
+	} else if (!strcmp(name, "asymmetry")) {
+		st->asymmetry = strtof(value, NULL);
+		if (st->asymmetry < -1.0f || st->asymmetry > 1.0f) {
+			fprintf(stderr, "Asymmetry must be between -1 and 1.\n");
+			return -1;
+		}
+	} else if (!strcmp(name, "pi")) {
+		st->rds_params.pi = strtoul(value, NULL, 16);
+	} else if (!strcmp(name, "ps")) {
+		memset(st->rds_params.ps, 0, PS_LENGTH);
+		memcpy(st->rds_params.ps, value, strnlen(value, PS_LENGTH));
+	} else if (!strcmp(name, "rt")) {
+		memset(st->rds_params.rt, 0, RT_LENGTH);
+		memcpy(st->rds_params.rt, value, strnlen(value, RT_LENGTH));
+	} else if (!strcmp(name, "pty")) {
+		st->rds_params.pty = strtoul(value, NULL, 10);
+	} else if (!strcmp(name, "tp")) {
+		st->rds_params.tp = strtoul(value, NULL, 10);
+	} else if (!strcmp(name, "af")) {
+		if (add_rds_af(&st->rds_params.af, strtof(value, NULL)) < 0) return -1;
+	} else if (!strcmp(name, "ptyn")) {
+		memset(st->rds_params.ptyn, 0, PTYN_LENGTH);
+		memcpy(st->rds_params.ptyn, value, strnlen(value, PTYN_LENGTH));
+	} else if (!strcmp(name, "callsign")) {
+		strncpy(st->callsign, value, 4);
+	} else if (!strcmp(name, "ctl")) {
+		strncpy(st->control_pipe, value, 50);
+	} else if (!strcmp(name, "ctl-socket")) {
+		strncpy(st->control_socket, value, 50);
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Reads the station file
+ *
+ * Every station starts with a [station] line, followed by its options
+ * as "name = value" lines. Blank lines and lines starting with # are
+ * skipped.
+ */
+static int8_t load_stations(char *filename) {
+	char line[STATION_LINE_LENGTH];
+	struct station_t *st = NULL;
+	uint32_t line_num = 0;
+	char *s, *eq;
+	FILE *f;
+
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Error: could not open station file %s.\n", filename);
+		return -1;
+	}
+
+	stations = malloc(MAX_STATIONS * sizeof(struct station_t));
+	num_stations = 0;
+
+	while (fgets(line, STATION_LINE_LENGTH, f) != NULL) {
+		line_num++;
+		s = trim(line);
+		if (!s[0] || s[0] == '#') continue;
+
+		if (!strcmp(s, "[station]")) {
+			if (num_stations == MAX_STATIONS) {
+				fprintf(stderr, "Error: no more than %d stations can be run.\n",
+					MAX_STATIONS);
+				goto error;
+			}
+			st = &stations[num_stations++];
+			init_station_defaults(st);
+			continue;
+		}
+
+		eq = strchr(s, '=');
+		if (st == NULL || eq == NULL) {
+			fprintf(stderr, "Error: %s line %u: expected [station] or name = value.\n",
+				filename, line_num);
+			goto error;
+		}
+		*eq = 0;
+
+		if (set_station_option(st, trim(s), trim(eq + 1)) < 0) {
+			fprintf(stderr, "Error: %s line %u: bad option \"%s\".\n",
+				filename, line_num, trim(s));
+			goto error;
+		}
+	}
+
+	fclose(f);
+
+	if (!num_stations) {
+		fprintf(stderr, "Error: no stations in %s.\n", filename);
+		return -1;
+	}
+
+	return 0;
+
+error:
+	fclose(f);
+	for (uint16_t i = 0; i < num_stations; i++) {
+		pthread_mutex_destroy(&stations[i].lock);
+	}
+	num_stations = 0;
+	return -1;
+}
+
+/*
+ * Input callback of a station's input resampler
+ */
+static long read_station_input(void *data, float **audio) {
+	struct station_t *st = (struct station_t *)data;
+
+	*audio = st->audio_in;
+	if (read_file_input(&st->input, st->audio_in) < 0) return 0;
+
+	return st->input_frames;
+}
+
+static int8_t open_station(struct station_t *st, uint16_t num, uint8_t format) {
+	uint32_t sample_rate;
+
+	fprintf(stderr, "Station %u:\n", num);
+
+	if (!st->output_file[0]) {
+		fprintf(stderr, "Error: station %u has no output-file.\n", num);
+		return -1;
+	}
+
+	if (!st->audio_file[0] && !st->rds && !st->rds2_streams) {
+		fprintf(stderr, "Error: station %u has nothing to do.\n", num);
+		return -1;
+	}
+
+	if (fm_mpx_init(&st->encoder) < 0) return -1;
+	st->encoder_open = 1;
+	set_output_volume(&st->encoder, st->mpx);
+	if (!st->rds) set_carrier_volume(&st->encoder, 1, 0);
+	if (set_rds2_streams(&st->encoder, st->rds2_streams) < 0) return -1;
+	set_asym_dsb(&st->encoder, st->asymmetry);
+	if (set_stereo_mode(&st->encoder, st->stereo_mode) < 0) return -1;
+	if (set_quality(&st->encoder, st->quality) < 0) return -1;
+	if (set_fixed_point(&st->encoder, st->fixed_point) < 0) return -1;
+	init_rds_encoder(&st->encoder.rds, st->rds_params, st->callsign);
+
+	if (open_file_output(&st->output, st->output_file, OUTPUT_SAMPLE_RATE, 2, format) < 0)
+		return -1;
+	st->output_open = 1;
+
+	if (init_polyphase(&st->output_kernel, MPX_SAMPLE_RATE, OUTPUT_SAMPLE_RATE, block_size) < 0) {
+		fprintf(stderr, "Error: could not create the output resampler.\n");
+		return -1;
+	}
+	st->output_buf = malloc(polyphase_max_output(&st->output_kernel, block_size) *
+		2 * sizeof(int32_t));
+	st->mpx_out = malloc(block_size * sizeof(float));
+
+	if (st->audio_file[0]) {
+		st->input_frames = block_size / INPUT_BLOCK_DIVIDER;
+		if (open_file_input(&st->input, st->audio_file, &sample_rate,
+			st->wait, st->input_frames) < 0) return -1;
+		st->input_open = 1;
+
+		if (sample_rate < 16000) {
+			fprintf(stderr, "Input sample rate must be at least 16k.\n");
+			return -1;
+		}
+
+		st->audio_in = malloc(st->input_frames * 2 * sizeof(float));
+		st->mpx_in = malloc(block_size * 2 * sizeof(float));
+
+		if (resampler_init(&st->resampler, 2,
+			(double)MPX_SAMPLE_RATE / (double)sample_rate,
+			st->quality, read_station_input, st) < 0) return -1;
+	}
+
+	if (st->control_pipe[0]) {
+		if (open_control_pipe(&st->ctl_pipe, st->control_pipe, &st->encoder) == 0) {
+			fprintf(stderr, "Reading control commands on %s.\n", st->control_pipe);
+			st->ctl_pipe_open = 1;
+		} else {
+			fprintf(stderr, "Failed to open control pipe: %s.\n", st->control_pipe);
+		}
+	}
+
+	if (st->control_socket[0]) {
+		if (open_control_socket(&st->ctl_socket, st->control_socket, &st->encoder) == 0) {
+			fprintf(stderr, "Accepting control connections on %s.\n", st->control_socket);
+			st->ctl_socket_open = 1;
+		} else {
+			fprintf(stderr, "Failed to open control socket: %s.\n", st->control_socket);
+		}
+	}
+
+	return 0;
+}
+
+static void close_station(struct station_t *st) {
+	if (st->ctl_pipe_open) close_control_pipe(&st->ctl_pipe);
+	if (st->ctl_socket_open) close_control_socket(&st->ctl_socket);
+	if (st->input_open) close_file_input(&st->input);
+	if (st->output_open) close_file_output(&st->output);
+	resampler_exit(&st->resampler);
+	exit_polyphase(&st->output_kernel);
+	if (st->encoder_open) fm_mpx_exit(&st->encoder);
+	pthread_mutex_destroy(&st->lock);
+
+	free(st->audio_in);
+	free(st->mpx_in);
+	free(st->mpx_out);
+	free(st->output_buf);
+}
+
+/*
+ * Generates a block of MPX for a station and writes it out
+ *
+ * Returns -1 once the station has stopped (end of input or a write
+ * error).
+ */
+static int8_t run_station_block(struct station_t *st) {
+	int32_t frames;
+	size_t out_frames;
+
+	if (st->audio_file[0]) {
+		frames = resample(&st->resampler, st->mpx_in, block_size);
+		if (frames <= 0) return -1;
+
+		// the last block of the input
+		if ((size_t)frames < block_size) {
+			memset(st->mpx_in + frames * 2, 0,
+				(block_size - frames) * 2 * sizeof(float));
+		}
+
+		fm_mpx_get_samples(&st->encoder, st->mpx_in, st->mpx_out, block_size);
+	} else {
+		fm_rds_get_samples(&st->encoder, st->mpx_out, block_size);
+	}
+
+	out_frames = polyphase_output(&st->output_kernel, st->mpx_out, block_size,
+		get_output_volume(&st->encoder), block_format, 2, st->output_buf);
+
+	return write_file_output(&st->output, st->output_buf, out_frames) < 0 ? -1 : 0;
+}
+
+/*
+ * Locks the station with the fewest blocks out of those that are free.
+ * Returns NULL if every station is taken or has stopped.
+ */
+static struct station_t *take_station() {
+	struct station_t *st, *next;
+
+	while (1) {
+		next = NULL;
+		for (uint16_t i = 0; i < num_stations; i++) {
+			st = &stations[i];
+			if (__atomic_load_n(&st->done, __ATOMIC_ACQUIRE) ||
+			    __atomic_load_n(&st->busy, __ATOMIC_ACQUIRE)) continue;
+			if (next == NULL || __atomic_load_n(&st->blocks, __ATOMIC_RELAXED) <
+			    __atomic_load_n(&next->blocks, __ATOMIC_RELAXED)) next = st;
+		}
+		if (next == NULL) return NULL;
+
+		// another worker may have taken it since
+		if (pthread_mutex_trylock(&next->lock) == 0) break;
+	}
+	__atomic_store_n(&next->busy, 1, __ATOMIC_RELEASE);
+
+	return next;
+}
+
+static void *station_worker() {
+	struct station_t *st;
+
+	while (!*stop_stations && __atomic_load_n(&active_stations, __ATOMIC_ACQUIRE)) {
+		st = take_station();
+		if (st == NULL) {
+			// every station is taken or has stopped
+			usleep(1000);
+			continue;
+		}
+
+		if (!st->done && run_station_block(st) < 0) {
+			fprintf(stderr, "Station %u stopped.\n", (unsigned)(st - stations) + 1);
+			__atomic_store_n(&st->done, 1, __ATOMIC_RELEASE);
+			__atomic_sub_fetch(&active_stations, 1, __ATOMIC_RELEASE);
+		}
+		__atomic_store_n(&st->blocks, st->blocks + 1, __ATOMIC_RELAXED);
+
+		__atomic_store_n(&st->busy, 0, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&st->lock);
+	}
+
+	pthread_exit(NULL);
+}
+
+/*
+ * Polls the control pipes and sockets of all stations
+ */
+static void *station_control_worker() {
+	while (!*stop_stations && __atomic_load_n(&active_stations, __ATOMIC_ACQUIRE)) {
+		for (uint16_t i = 0; i < num_stations; i++) {
+			if (stations[i].ctl_pipe_open) poll_control_pipe(&stations[i].ctl_pipe);
+			if (stations[i].ctl_socket_open) poll_control_socket(&stations[i].ctl_socket, 0);
+			if (stations[i].encoder_open) finish_change(&stations[i].encoder);
+		}
+		usleep(10000);
+	}
+
+	pthread_exit(NULL);
+}
+
+/*
+ * Runs all stations in the station file until they have all stopped
+ * or stop is set
+ *
+ * workers is the number of worker threads (0 for one per CPU).
+ */
+int8_t run_stations(char *filename, size_t block, uint8_t format,
+	uint16_t workers, uint8_t *stop) {
+	pthread_t *worker_threads;
+	pthread_t control_thread;
+	uint16_t workers_running = 0;
+	uint8_t control_running = 0;
+	uint8_t control = 0;
+	int8_t r = 0;
+
+	block_size = block;
+	stop_stations = stop;
+	// libsndfile takes 24-bit samples as left-justified ints
+	block_format = format == OUTPUT_FORMAT_S24 ? OUTPUT_FORMAT_S32 : format;
+
+	if (load_stations(filename) < 0) {
+		free(stations);
+		return -1;
+	}
+
+	for (uint16_t i = 0; i < num_stations; i++) {
+		if (open_station(&stations[i], i + 1, format) < 0) {
+			r = -1;
+			goto exit;
+		}
+		if (stations[i].ctl_pipe_open || stations[i].ctl_socket_open) control = 1;
+	}
+
+	if (!workers) workers = sysconf(_SC_NPROCESSORS_ONLN);
+	// there is never more than one block of work per station
+	if (workers > num_stations) workers = num_stations;
+
+	active_stations = num_stations;
+
+	worker_threads = malloc(workers * sizeof(pthread_t));
+
+	for (uint16_t i = 0; i < workers; i++) {
+		if (pthread_create(&worker_threads[i], NULL, station_worker, NULL) != 0) {
+			fprintf(stderr, "Could not create station worker thread.\n");
+			*stop = 1;
+			r = -1;
+			break;
+		}
+		workers_running++;
+	}
+
+	if (control && !*stop) {
+		if (pthread_create(&control_thread, NULL, station_control_worker, NULL) != 0) {
+			fprintf(stderr, "Could not create control thread.\n");
+			*stop = 1;
+			r = -1;
+		} else {
+			control_running = 1;
+		}
+	}
+
+	if (!*stop) {
+		fprintf(stderr, "Running %u stations on %u worker threads.\n",
+			num_stations, workers);
+	}
+
+	while (!*stop && __atomic_load_n(&active_stations, __ATOMIC_ACQUIRE)) {
+		usleep(100000);
+	}
+
+	fprintf(stderr, "Waiting for threads to shut down.\n");
+	*stop = 1;
+	for (uint16_t i = 0; i < workers_running; i++) {
+		pthread_join(worker_threads[i], NULL);
+	}
+	if (control_running) pthread_join(control_thread, NULL);
+	free(worker_threads);
+
+exit:
+	for (uint16_t i = 0; i < num_stations; i++) {
+		close_station(&stations[i]);
+	}
+	free(stations);
+
+	return r;
+}
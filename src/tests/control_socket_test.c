@@ -0,0 +1,108 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Control socket check
+ *
+ * Sends a whole receive buffer of empty lines, which gets the largest
+ * possible batch of replies ("ERR" for every byte), then a command to
+ * make sure the server is still taking them.
+ */
+
+#include "common.h"
+#include <sys/socket.h>
+
+#include "fm_mpx.h"
+#include "control_socket.h"
+
+#define SOCKET_PATH	"/tmp/mpxgen-check.sock"
+
+static struct fm_mpx_t mpx;
+static struct control_socket_t ctl;
+
+// reads replies until len bytes have come or the server goes quiet
+static size_t read_replies(int fd, char *buf, size_t len) {
+	size_t got = 0;
+	ssize_t r;
+
+	for (uint16_t tries = 0; got < len && tries < 100; tries++) {
+		poll_control_socket(&ctl, 10);
+		while (got < len && (r = recv(fd, buf + got, len - got, MSG_DONTWAIT)) > 0)
+			got += r;
+	}
+
+	return got;
+}
+
+int main() {
+	struct rds_params_t rds_params = {.pi = 0x1000};
+	char callsign[5] = {0};
+	struct sockaddr_un addr;
+	static char lines[CTL_SOCK_BUFFER_SIZE];
+	static char replies[CTL_SOCK_BUFFER_SIZE * 4 + 1];
+	int fd;
+	size_t got;
+
+	if (fm_mpx_init(&mpx) < 0) return 1;
+	init_rds_encoder(&mpx.rds, rds_params, callsign);
+
+	if (open_control_socket(&ctl, SOCKET_PATH, &mpx) < 0) {
+		fprintf(stderr, "FAIL: could not open %s\n", SOCKET_PATH);
+		return 1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, SOCKET_PATH);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) < 0) {
+		fprintf(stderr, "FAIL: could not connect\n");
+		return 1;
+	}
+	poll_control_socket(&ctl, 10);
+
+	memset(lines, '\n', CTL_SOCK_BUFFER_SIZE);
+	if (send(fd, lines, CTL_SOCK_BUFFER_SIZE, 0) != CTL_SOCK_BUFFER_SIZE) return 1;
+
+	got = read_replies(fd, replies, CTL_SOCK_BUFFER_SIZE * 4);
+	if (got != CTL_SOCK_BUFFER_SIZE * 4) {
+		fprintf(stderr, "FAIL: %zu reply bytes for %u empty lines\n",
+			got, CTL_SOCK_BUFFER_SIZE);
+		return 1;
+	}
+	for (size_t i = 0; i < got; i += 4) {
+		if (memcmp(replies + i, "ERR\n", 4)) {
+			fprintf(stderr, "FAIL: reply %zu is not ERR\n", i / 4);
+			return 1;
+		}
+	}
+
+	send(fd, "PS Check\n", 9, 0);
+	got = read_replies(fd, replies, 3);
+	if (got != 3 || memcmp(replies, "OK\n", 3)) {
+		fprintf(stderr, "FAIL: no OK for a command after the empty lines\n");
+		return 1;
+	}
+
+	close(fd);
+	close_control_socket(&ctl);
+	fm_mpx_exit(&mpx);
+
+	printf("control socket: ok\n");
+	return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * mpxgen - FM multiplex encoder with Stereo and RDS
+ * Copyright (C) 2021 Anthony96922
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sample conversion check
+ *
+ * Runs every conversion on buffers of 0 to 70 samples at a few offsets,
+ * so each vector loop and each tail length is hit, and compares the
+ * output bit for bit with the plain C loop. The buffers are full of
+ * edge values (+-1.0, overs, infinities, NaN, rounding ties) and noise.
+ *
+ * The Makefile builds this once for the default instruction set and,
+ * on x86, once more with AVX2.
+ */
+
+#include "common.h"
+#include "audio_conversion.h"
+
+#define MAX_LEN		70
+#define MAX_OFFSET	3
+#define BUF_LEN		((MAX_LEN + MAX_OFFSET) * 2)
+
+static float f_in[BUF_LEN];
+static int16_t s16_in[BUF_LEN];
+static int32_t s32_in[BUF_LEN];
+static uint8_t bytes_in[BUF_LEN * 3];
+
+static uint32_t failures;
+
+static const float float_edges[] = {
+	0.0f, -0.0f, 1.0f, -1.0f, 0.5f, -0.5f,
+	1.0001f, -1.0001f, 1.5f, -2.0f, 1e10f, -1e10f,
+	0.5f / S16_SCALE, 1.5f / S16_SCALE, -2.5f / S16_SCALE,
+	0.5f / S32_SCALE, 1.5f / S32_SCALE, 1e-40f,
+	32767.5f / 32767.0f, -32768.5f / 32767.0f
+};
+
+static const int32_t int_edges[] = {
+	0, 1, -1, INT16_MAX, INT16_MIN, INT32_MAX, INT32_MIN,
+	0x7fffff, -0x800000, 0x12345678
+};
+
+// xorshift, so every run sees the same noise
+static uint32_t noise() {
+	static uint32_t x = 2463534242u;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+static void fill_inputs() {
+	uint32_t n_edges = sizeof(float_edges) / sizeof(float);
+
+	for (uint32_t i = 0; i < BUF_LEN; i++) {
+		if (i % 3 == 0) {
+			f_in[i] = float_edges[(i / 3) % n_edges];
+		} else {
+			f_in[i] = ((int32_t)noise() / 2147483648.0f) * 1.2f;
+		}
+		s16_in[i] = noise();
+		s32_in[i] = noise();
+	}
+	f_in[7] = INFINITY;
+	f_in[8] = -INFINITY;
+	f_in[10] = NAN;
+	f_in[BUF_LEN - 2] = NAN;
+
+	for (uint32_t i = 0; i < sizeof(int_edges) / sizeof(int32_t); i++) {
+		s16_in[i * 5] = int_edges[i];
+		s32_in[i * 5] = int_edges[i];
+	}
+
+	for (uint32_t i = 0; i < BUF_LEN * 3; i++) {
+		bytes_in[i] = noise();
+	}
+}
+
+static void check(const char *name, size_t len, size_t offset,
+	const void *out, const void *ref, size_t size) {
+	if (memcmp(out, ref, size) == 0) return;
+
+	if (failures++ < 10) {
+		fprintf(stderr, "conversion: %s differs from the C loop (%lu samples at %lu)\n",
+			name, len, offset);
+	}
+}
+
+static void check_length(size_t n, size_t o) {
+	static int16_t s16_out[BUF_LEN * 2], s16_ref[BUF_LEN * 2];
+	static int32_t s32_out[BUF_LEN], s32_ref[BUF_LEN];
+	static uint8_t bytes_out[BUF_LEN * 3], bytes_ref[BUF_LEN * 3];
+	static float f_out[BUF_LEN * 2], f_ref[BUF_LEN * 2];
+	static float f_out2[BUF_LEN], f_ref2[BUF_LEN];
+	float *f = f_in + o;
+	int32_t x;
+
+	memset(s16_out, 0, sizeof(s16_out));
+	memset(s16_ref, 0, sizeof(s16_ref));
+	float2short(f, s16_out, n);
+	for (size_t i = 0; i < n; i++) s16_ref[i] = float2short_sample(f[i]);
+	check("float2short", n, o, s16_out, s16_ref, sizeof(s16_out));
+
+	memset(s32_out, 0, sizeof(s32_out));
+	memset(s32_ref, 0, sizeof(s32_ref));
+	float2int(f, s32_out, n);
+	for (size_t i = 0; i < n; i++) s32_ref[i] = float2int_sample(f[i]);
+	check("float2int", n, o, s32_out, s32_ref, sizeof(s32_out));
+
+	memset(bytes_out, 0, sizeof(bytes_out));
+	memset(bytes_ref, 0, sizeof(bytes_ref));
+	float2s24_3le(f, bytes_out, n);
+	for (size_t i = 0; i < n; i++) {
+		x = float2int_sample(f[i]);
+		bytes_ref[i * 3 + 0] = x >> 8;
+		bytes_ref[i * 3 + 1] = x >> 16;
+		bytes_ref[i * 3 + 2] = x >> 24;
+	}
+	check("float2s24_3le", n, o, bytes_out, bytes_ref, sizeof(bytes_out));
+
+	memset(f_out, 0, sizeof(f_out));
+	memset(f_ref, 0, sizeof(f_ref));
+	short2float(s16_in + o, f_out, n);
+	for (size_t i = 0; i < n; i++) f_ref[i] = s16_in[o + i] * (1.0f / S16_SCALE);
+	check("short2float", n, o, f_out, f_ref, sizeof(f_out));
+
+	memset(f_out, 0, sizeof(f_out));
+	memset(f_ref, 0, sizeof(f_ref));
+	char2float((int8_t *)(s16_in + o), f_out, n);
+	for (size_t i = 0; i < n; i++) f_ref[i] = s16_in[o + i] / S16_SCALE;
+	check("char2float", n, o, f_out, f_ref, sizeof(f_out));
+
+	memset(f_out, 0, sizeof(f_out));
+	memset(f_ref, 0, sizeof(f_ref));
+	int2float(s32_in + o, f_out, n);
+	for (size_t i = 0; i < n; i++) f_ref[i] = s32_in[o + i] * (1.0f / S32_SCALE);
+	check("int2float", n, o, f_out, f_ref, sizeof(f_out));
+
+	memset(f_out, 0, sizeof(f_out));
+	memset(f_ref, 0, sizeof(f_ref));
+	s24le2float(s32_in + o, f_out, n);
+	for (size_t i = 0; i < n; i++) {
+		f_ref[i] = (int32_t)((uint32_t)s32_in[o + i] << 8) * (1.0f / S32_SCALE);
+	}
+	check("s24le2float", n, o, f_out, f_ref, sizeof(f_out));
+
+	memset(f_out, 0, sizeof(f_out));
+	memset(f_ref, 0, sizeof(f_ref));
+	s24_3le2float(bytes_in + o * 3, f_out, n);
+	for (size_t i = 0; i < n; i++) {
+		x = (int32_t)((uint32_t)bytes_in[(o + i) * 3 + 0] << 8 |
+			(uint32_t)bytes_in[(o + i) * 3 + 1] << 16 |
+			(uint32_t)bytes_in[(o + i) * 3 + 2] << 24);
+		f_ref[i] = x * (1.0f / S32_SCALE);
+	}
+	check("s24_3le2float", n, o, f_out, f_ref, sizeof(f_out));
+
+	memset(s16_out, 0, sizeof(s16_out));
+	memset(s16_ref, 0, sizeof(s16_ref));
+	stereoizes16(s16_in + o, s16_out, n);
+	for (size_t i = 0; i < n; i++) s16_ref[i * 2] = s16_ref[i * 2 + 1] = s16_in[o + i];
+	check("stereoizes16", n, o, s16_out, s16_ref, sizeof(s16_out));
+
+	memset(f_out, 0, sizeof(f_out));
+	memset(f_ref, 0, sizeof(f_ref));
+	stereoizef(f, f_out, n);
+	for (size_t i = 0; i < n; i++) f_ref[i * 2] = f_ref[i * 2 + 1] = f[i];
+	check("stereoizef", n, o, f_out, f_ref, sizeof(f_out));
+
+	// in place, with the mono samples in the back half
+	memset(f_out, 0, sizeof(f_out));
+	memcpy(f_out + n, f, n * sizeof(float));
+	stereoizef(f_out + n, f_out, n);
+	check("stereoizef in place", n, o, f_out, f_ref, sizeof(f_out));
+
+	memset(f_out, 0, sizeof(f_out));
+	memset(f_ref, 0, sizeof(f_ref));
+	interleavef(f, f + MAX_LEN, f_out, n);
+	for (size_t i = 0; i < n; i++) {
+		f_ref[i * 2] = f[i];
+		f_ref[i * 2 + 1] = f[MAX_LEN + i];
+	}
+	check("interleavef", n, o, f_out, f_ref, sizeof(f_out));
+
+	memset(f_out, 0, sizeof(f_out));
+	memset(f_ref, 0, sizeof(f_ref));
+	memset(f_out2, 0, sizeof(f_out2));
+	memset(f_ref2, 0, sizeof(f_ref2));
+	deinterleavef(f, f_out, f_out2, n);
+	for (size_t i = 0; i < n; i++) {
+		f_ref[i] = f[i * 2];
+		f_ref2[i] = f[i * 2 + 1];
+	}
+	check("deinterleavef", n, o, f_out, f_ref, sizeof(f_out));
+	check("deinterleavef", n, o, f_out2, f_ref2, sizeof(f_out2));
+}
+
+int main() {
+	const char *isa = "scalar";
+
+#if defined(__AVX2__)
+	isa = "avx2";
+#elif defined(__SSE2__)
+	isa = "sse2";
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	isa = "neon";
+#endif
+
+	fill_inputs();
+
+	for (size_t o = 0; o <= MAX_OFFSET; o++) {
+		for (size_t n = 0; n <= MAX_LEN; n++) {
+			check_length(n, o);
+		}
+	}
+
+	if (failures) {
+		fprintf(stderr, "conversion (%s): %u failures\n", isa, failures);
+		return 1;
+	}
+
+	printf("conversion (%s): ok\n", isa);
+
+	return 0;
+}